@@ -0,0 +1,185 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "aho_corasick.h"
+
+static inline uint8_t
+fold (uint8_t c, bool match_case)
+{
+    return match_case ? c : tolower (c);
+}
+
+static void
+build_classes (AhoCorasick *ac,
+               const char **patterns,
+               uint32_t num_patterns,
+               bool match_case)
+{
+    // class 0 is shared by all bytes which aren't part of any pattern
+    uint32_t num_classes = 1;
+    for (uint32_t i = 0; i < num_patterns; i++) {
+        if (!patterns[i]) {
+            continue;
+        }
+        for (const uint8_t *c = (const uint8_t *)patterns[i]; *c != '\0'; c++) {
+            const uint8_t folded = fold (*c, match_case);
+            if (ac->classes[folded]) {
+                continue;
+            }
+            ac->classes[folded] = num_classes;
+            if (!match_case) {
+                ac->classes[toupper (folded)] = num_classes;
+            }
+            num_classes++;
+        }
+    }
+    ac->num_classes = num_classes;
+}
+
+AhoCorasick *
+aho_corasick_new (const char **patterns,
+                  uint32_t num_patterns,
+                  bool match_case)
+{
+    assert (patterns != NULL);
+    assert (num_patterns <= AHO_CORASICK_MAX_PATTERNS);
+
+    AhoCorasick *ac = calloc (1, sizeof (AhoCorasick));
+    assert (ac != NULL);
+
+    build_classes (ac, patterns, num_patterns, match_case);
+
+    uint32_t max_states = 1;
+    for (uint32_t i = 0; i < num_patterns; i++) {
+        if (patterns[i]) {
+            max_states += strlen (patterns[i]);
+        }
+    }
+
+    const uint32_t num_classes = ac->num_classes;
+    ac->delta = calloc ((size_t)max_states * num_classes, sizeof (uint32_t));
+    assert (ac->delta != NULL);
+    ac->output = calloc (max_states, sizeof (uint64_t));
+    assert (ac->output != NULL);
+
+    // build the trie, state 0 is the root and can't be the target of a
+    // trie edge, so 0 marks a missing edge for now
+    uint32_t num_states = 1;
+    for (uint32_t i = 0; i < num_patterns; i++) {
+        if (!patterns[i]) {
+            continue;
+        }
+        uint32_t state = 0;
+        for (const uint8_t *c = (const uint8_t *)patterns[i]; *c != '\0'; c++) {
+            uint32_t *next = &ac->delta[state * num_classes + ac->classes[*c]];
+            if (!*next) {
+                *next = num_states++;
+            }
+            state = *next;
+        }
+        ac->output[state] |= 1ull << i;
+        ac->all_patterns |= 1ull << i;
+    }
+    ac->num_states = num_states;
+
+    // breadth first: set the fail links and turn the missing edges into
+    // transitions, so the scan never has to follow a fail link
+    uint32_t *fail = calloc (num_states, sizeof (uint32_t));
+    assert (fail != NULL);
+    uint32_t *queue = calloc (num_states, sizeof (uint32_t));
+    assert (queue != NULL);
+    uint32_t head = 0;
+    uint32_t tail = 0;
+    for (uint32_t a = 0; a < num_classes; a++) {
+        const uint32_t next = ac->delta[a];
+        if (next) {
+            fail[next] = 0;
+            queue[tail++] = next;
+        }
+    }
+    while (head < tail) {
+        const uint32_t state = queue[head++];
+        ac->output[state] |= ac->output[fail[state]];
+        for (uint32_t a = 0; a < num_classes; a++) {
+            uint32_t *next = &ac->delta[state * num_classes + a];
+            const uint32_t fallback = ac->delta[fail[state] * num_classes + a];
+            if (*next) {
+                fail[*next] = fallback;
+                queue[tail++] = *next;
+            }
+            else {
+                *next = fallback;
+            }
+        }
+    }
+    free (queue);
+    queue = NULL;
+    free (fail);
+    fail = NULL;
+
+    return ac;
+}
+
+void
+aho_corasick_free (AhoCorasick *ac)
+{
+    if (!ac) {
+        return;
+    }
+    if (ac->delta) {
+        free (ac->delta);
+        ac->delta = NULL;
+    }
+    if (ac->output) {
+        free (ac->output);
+        ac->output = NULL;
+    }
+    free (ac);
+    ac = NULL;
+}
+
+uint64_t
+aho_corasick_scan (AhoCorasick *ac, const char *text)
+{
+    assert (ac != NULL);
+    assert (text != NULL);
+
+    const uint32_t *delta = ac->delta;
+    const uint32_t num_classes = ac->num_classes;
+    const uint64_t all_patterns = ac->all_patterns;
+
+    // empty patterns end in the root and are always found
+    uint64_t found = ac->output[0];
+    uint32_t state = 0;
+    for (const uint8_t *c = (const uint8_t *)text; *c != '\0'; c++) {
+        state = delta[state * num_classes + ac->classes[*c]];
+        const uint64_t output = ac->output[state];
+        if (output) {
+            found |= output;
+            if (found == all_patterns) {
+                break;
+            }
+        }
+    }
+    return found;
+}
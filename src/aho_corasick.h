@@ -0,0 +1,56 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define AHO_CORASICK_MAX_PATTERNS 64
+
+typedef struct _AhoCorasick AhoCorasick;
+
+// Automaton which finds any number of (up to 64) patterns in a single pass
+// over a text. Bytes which don't occur in any pattern share one input class,
+// which keeps the transition table small enough to stay in the cache.
+struct _AhoCorasick
+{
+    // transitions, num_states * num_classes entries
+    uint32_t *delta;
+    // patterns which end in a state, including those of its fail links
+    uint64_t *output;
+    uint32_t num_states;
+    uint32_t num_classes;
+    // bits of all patterns, the scan stops once all of them are found
+    uint64_t all_patterns;
+    uint8_t classes[256];
+};
+
+// Pattern i sets bit i of the scan result. NULL patterns are skipped, so
+// several automatons can share the numbering of one list of terms.
+AhoCorasick *
+aho_corasick_new (const char **patterns,
+                  uint32_t num_patterns,
+                  bool match_case);
+
+void
+aho_corasick_free (AhoCorasick *ac);
+
+// returns the bits of all patterns which occur in text
+uint64_t
+aho_corasick_scan (AhoCorasick *ac, const char *text);
@@ -158,3 +158,60 @@ darray_sort (DynamicArray *array, int (*comp_func)(const void *, const void *))
 
     qsort (array->data, array->num_items, sizeof (void *), comp_func);
 }
+
+static int
+compare_items (const void *a, const void *b, void *data)
+{
+    int (**comp_func)(const void *, const void *) = data;
+    return (*comp_func) (a, b);
+}
+
+void
+darray_sort_multi_threaded (DynamicArray *array,
+                            int (*comp_func)(const void *, const void *),
+                            FsearchThreadPool *pool)
+{
+    assert (array != NULL);
+    assert (array->data != NULL);
+    assert (comp_func != NULL);
+
+    fsearch_thread_pool_sort (pool,
+                              array->data,
+                              array->num_items,
+                              sizeof (void *),
+                              compare_items,
+                              &comp_func);
+}
+
+typedef struct {
+    void **src;
+    void **dest;
+} distribute_ctx;
+
+static void
+copy_items (uint32_t start, uint32_t end, gpointer data)
+{
+    distribute_ctx *ctx = data;
+    memcpy (ctx->dest + start, ctx->src + start, (end - start) * sizeof (void *));
+}
+
+void
+darray_distribute (DynamicArray *array, FsearchThreadPool *pool)
+{
+    assert (array != NULL);
+    assert (array->data != NULL);
+
+    if (!pool || array->max_items == 0) {
+        return;
+    }
+    // large allocations are mapped lazily, every page ends up on the numa
+    // node of the worker which writes to it first
+    void **data = malloc (array->max_items * sizeof (void *));
+    assert (data != NULL);
+
+    distribute_ctx ctx = {array->data, data};
+    fsearch_thread_pool_parallel_for_workers (pool, 0, array->max_items, copy_items, &ctx);
+
+    free (array->data);
+    array->data = data;
+}
@@ -20,12 +20,25 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include "fsearch_thread_pool.h"
 
 typedef struct _DynamicArray DynamicArray;
 
 void
 darray_sort (DynamicArray *array, int (*comp_func)(const void *, const void *));
 
+// sorts on all threads of the pool
+void
+darray_sort_multi_threaded (DynamicArray *array,
+                            int (*comp_func)(const void *, const void *),
+                            FsearchThreadPool *pool);
+
+// moves the items to new memory, written by the workers of the pool in the
+// parts fsearch_thread_pool_parallel_for_workers assigns them, so every
+// worker reads its part from its own numa node
+void
+darray_distribute (DynamicArray *array, FsearchThreadPool *pool);
+
 uint32_t
 darray_get_size (DynamicArray *array);
 
@@ -0,0 +1,743 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <glib.h>
+
+#include "bitmap.h"
+
+// a chunk with more values than this is cheaper to store as a bitset
+#define ARRAY_MAX_CARDINALITY 4096
+#define BITSET_NUM_WORDS (65536 / 64)
+
+typedef struct {
+    // upper 16 bits of all values in this container
+    uint16_t key;
+    bool is_bitset;
+    uint32_t cardinality;
+    uint32_t capacity;
+    // sorted lower 16 bits if !is_bitset, otherwise BITSET_NUM_WORDS words
+    uint16_t *values;
+    uint64_t *words;
+} bitmap_container_t;
+
+struct _Bitmap
+{
+    bitmap_container_t *containers;
+    uint32_t num_containers;
+    uint32_t capacity;
+};
+
+static void
+container_clear (bitmap_container_t *c)
+{
+    if (c->values) {
+        free (c->values);
+        c->values = NULL;
+    }
+    if (c->words) {
+        free (c->words);
+        c->words = NULL;
+    }
+    c->cardinality = 0;
+    c->capacity = 0;
+}
+
+static void
+container_to_bitset (bitmap_container_t *c)
+{
+    assert (!c->is_bitset);
+
+    uint64_t *words = calloc (BITSET_NUM_WORDS, sizeof (uint64_t));
+    assert (words != NULL);
+    for (uint32_t i = 0; i < c->cardinality; i++) {
+        const uint16_t low = c->values[i];
+        words[low >> 6] |= 1ull << (low & 63);
+    }
+    const uint32_t cardinality = c->cardinality;
+    container_clear (c);
+    c->words = words;
+    c->cardinality = cardinality;
+    c->is_bitset = true;
+}
+
+// returns the index of the first value >= low
+static uint32_t
+container_array_lower_bound (const bitmap_container_t *c, uint16_t low)
+{
+    uint32_t lo = 0;
+    uint32_t hi = c->cardinality;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (c->values[mid] < low) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void
+container_add (bitmap_container_t *c, uint16_t low)
+{
+    if (c->is_bitset) {
+        const uint64_t bit = 1ull << (low & 63);
+        if (!(c->words[low >> 6] & bit)) {
+            c->words[low >> 6] |= bit;
+            c->cardinality++;
+        }
+        return;
+    }
+
+    uint32_t pos = c->cardinality;
+    // values are usually added in increasing order
+    if (pos > 0 && c->values[pos - 1] >= low) {
+        pos = container_array_lower_bound (c, low);
+        if (c->values[pos] == low) {
+            return;
+        }
+    }
+    if (c->cardinality == ARRAY_MAX_CARDINALITY) {
+        container_to_bitset (c);
+        container_add (c, low);
+        return;
+    }
+    if (c->cardinality == c->capacity) {
+        c->capacity = c->capacity ? c->capacity * 2 : 4;
+        c->values = realloc (c->values, c->capacity * sizeof (uint16_t));
+        assert (c->values != NULL);
+    }
+    memmove (c->values + pos + 1, c->values + pos, (c->cardinality - pos) * sizeof (uint16_t));
+    c->values[pos] = low;
+    c->cardinality++;
+}
+
+static bool
+container_contains (const bitmap_container_t *c, uint16_t low)
+{
+    if (c->is_bitset) {
+        return c->words[low >> 6] & (1ull << (low & 63));
+    }
+    const uint32_t pos = container_array_lower_bound (c, low);
+    return pos < c->cardinality && c->values[pos] == low;
+}
+
+// returns the index of the first container with key >= key
+static uint32_t
+bitmap_lower_bound (const Bitmap *bitmap, uint16_t key)
+{
+    uint32_t lo = 0;
+    uint32_t hi = bitmap->num_containers;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (bitmap->containers[mid].key < key) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static bitmap_container_t *
+bitmap_insert_container (Bitmap *bitmap, uint32_t pos, uint16_t key)
+{
+    if (bitmap->num_containers == bitmap->capacity) {
+        bitmap->capacity = bitmap->capacity ? bitmap->capacity * 2 : 4;
+        bitmap->containers = realloc (bitmap->containers,
+                                      bitmap->capacity * sizeof (bitmap_container_t));
+        assert (bitmap->containers != NULL);
+    }
+    memmove (bitmap->containers + pos + 1,
+             bitmap->containers + pos,
+             (bitmap->num_containers - pos) * sizeof (bitmap_container_t));
+    bitmap->num_containers++;
+
+    bitmap_container_t *c = &bitmap->containers[pos];
+    memset (c, 0, sizeof (bitmap_container_t));
+    c->key = key;
+    return c;
+}
+
+Bitmap *
+bitmap_new (void)
+{
+    Bitmap *bitmap = calloc (1, sizeof (Bitmap));
+    assert (bitmap != NULL);
+    return bitmap;
+}
+
+void
+bitmap_free (Bitmap *bitmap)
+{
+    if (!bitmap) {
+        return;
+    }
+    for (uint32_t i = 0; i < bitmap->num_containers; i++) {
+        container_clear (&bitmap->containers[i]);
+    }
+    if (bitmap->containers) {
+        free (bitmap->containers);
+        bitmap->containers = NULL;
+    }
+    free (bitmap);
+    bitmap = NULL;
+}
+
+void
+bitmap_add (Bitmap *bitmap, uint32_t value)
+{
+    assert (bitmap != NULL);
+
+    const uint16_t key = value >> 16;
+    uint32_t pos = bitmap->num_containers;
+    if (pos == 0 || bitmap->containers[pos - 1].key != key) {
+        pos = bitmap_lower_bound (bitmap, key);
+        if (pos == bitmap->num_containers || bitmap->containers[pos].key != key) {
+            bitmap_insert_container (bitmap, pos, key);
+        }
+    }
+    else {
+        pos--;
+    }
+    container_add (&bitmap->containers[pos], value & 0xFFFF);
+}
+
+bool
+bitmap_contains (const Bitmap *bitmap, uint32_t value)
+{
+    assert (bitmap != NULL);
+
+    const uint16_t key = value >> 16;
+    const uint32_t pos = bitmap_lower_bound (bitmap, key);
+    if (pos == bitmap->num_containers || bitmap->containers[pos].key != key) {
+        return false;
+    }
+    return container_contains (&bitmap->containers[pos], value & 0xFFFF);
+}
+
+uint32_t
+bitmap_get_cardinality (const Bitmap *bitmap)
+{
+    assert (bitmap != NULL);
+
+    uint32_t cardinality = 0;
+    for (uint32_t i = 0; i < bitmap->num_containers; i++) {
+        cardinality += bitmap->containers[i].cardinality;
+    }
+    return cardinality;
+}
+
+size_t
+bitmap_get_memory_usage (const Bitmap *bitmap)
+{
+    assert (bitmap != NULL);
+
+    size_t size = sizeof (Bitmap) + bitmap->capacity * sizeof (bitmap_container_t);
+    for (uint32_t i = 0; i < bitmap->num_containers; i++) {
+        const bitmap_container_t *c = &bitmap->containers[i];
+        size += c->is_bitset
+            ? BITSET_NUM_WORDS * sizeof (uint64_t)
+            : c->capacity * sizeof (uint16_t);
+    }
+    return size;
+}
+
+static void
+container_copy (bitmap_container_t *dest, const bitmap_container_t *src)
+{
+    *dest = *src;
+    if (src->is_bitset) {
+        dest->words = malloc (BITSET_NUM_WORDS * sizeof (uint64_t));
+        assert (dest->words != NULL);
+        memcpy (dest->words, src->words, BITSET_NUM_WORDS * sizeof (uint64_t));
+    }
+    else {
+        dest->capacity = src->cardinality;
+        dest->values = malloc (MAX (src->cardinality, 1) * sizeof (uint16_t));
+        assert (dest->values != NULL);
+        memcpy (dest->values, src->values, src->cardinality * sizeof (uint16_t));
+    }
+}
+
+static void
+container_or (bitmap_container_t *dest,
+              const bitmap_container_t *a,
+              const bitmap_container_t *b)
+{
+    memset (dest, 0, sizeof (bitmap_container_t));
+    dest->key = a->key;
+
+    if (!a->is_bitset && !b->is_bitset
+        && a->cardinality + b->cardinality <= ARRAY_MAX_CARDINALITY) {
+        // merge two sorted arrays
+        dest->capacity = MAX (a->cardinality + b->cardinality, 1);
+        dest->values = malloc (dest->capacity * sizeof (uint16_t));
+        assert (dest->values != NULL);
+        uint32_t i = 0;
+        uint32_t j = 0;
+        uint32_t n = 0;
+        while (i < a->cardinality && j < b->cardinality) {
+            const uint16_t va = a->values[i];
+            const uint16_t vb = b->values[j];
+            dest->values[n++] = va < vb ? va : vb;
+            i += va <= vb;
+            j += vb <= va;
+        }
+        while (i < a->cardinality) {
+            dest->values[n++] = a->values[i++];
+        }
+        while (j < b->cardinality) {
+            dest->values[n++] = b->values[j++];
+        }
+        dest->cardinality = n;
+        return;
+    }
+
+    dest->is_bitset = true;
+    dest->words = calloc (BITSET_NUM_WORDS, sizeof (uint64_t));
+    assert (dest->words != NULL);
+    const bitmap_container_t *sources[2] = {a, b};
+    for (uint32_t s = 0; s < 2; s++) {
+        const bitmap_container_t *c = sources[s];
+        if (c->is_bitset) {
+            for (uint32_t w = 0; w < BITSET_NUM_WORDS; w++) {
+                dest->words[w] |= c->words[w];
+            }
+        }
+        else {
+            for (uint32_t i = 0; i < c->cardinality; i++) {
+                dest->words[c->values[i] >> 6] |= 1ull << (c->values[i] & 63);
+            }
+        }
+    }
+    for (uint32_t w = 0; w < BITSET_NUM_WORDS; w++) {
+        dest->cardinality += __builtin_popcountll (dest->words[w]);
+    }
+}
+
+Bitmap *
+bitmap_or (const Bitmap *a, const Bitmap *b)
+{
+    assert (a != NULL);
+    assert (b != NULL);
+
+    Bitmap *result = bitmap_new ();
+    result->capacity = MAX (a->num_containers + b->num_containers, 1);
+    result->containers = calloc (result->capacity, sizeof (bitmap_container_t));
+    assert (result->containers != NULL);
+
+    uint32_t i = 0;
+    uint32_t j = 0;
+    while (i < a->num_containers || j < b->num_containers) {
+        bitmap_container_t *dest = &result->containers[result->num_containers++];
+        if (j == b->num_containers
+            || (i < a->num_containers && a->containers[i].key < b->containers[j].key)) {
+            container_copy (dest, &a->containers[i++]);
+        }
+        else if (i == a->num_containers
+                 || b->containers[j].key < a->containers[i].key) {
+            container_copy (dest, &b->containers[j++]);
+        }
+        else {
+            container_or (dest, &a->containers[i++], &b->containers[j++]);
+        }
+    }
+    return result;
+}
+
+Bitmap *
+bitmap_copy (const Bitmap *bitmap)
+{
+    assert (bitmap != NULL);
+
+    Bitmap *copy = bitmap_new ();
+    copy->capacity = MAX (bitmap->num_containers, 1);
+    copy->containers = calloc (copy->capacity, sizeof (bitmap_container_t));
+    assert (copy->containers != NULL);
+    for (uint32_t i = 0; i < bitmap->num_containers; i++) {
+        container_copy (&copy->containers[i], &bitmap->containers[i]);
+    }
+    copy->num_containers = bitmap->num_containers;
+    return copy;
+}
+
+void
+bitmap_or_inplace (Bitmap *dest, const Bitmap *src)
+{
+    assert (dest != NULL);
+    assert (src != NULL);
+
+    for (uint32_t i = 0; i < src->num_containers; i++) {
+        const bitmap_container_t *c = &src->containers[i];
+        uint32_t pos = dest->num_containers;
+        // the values of src usually come after those of dest
+        if (pos > 0 && dest->containers[pos - 1].key >= c->key) {
+            pos = bitmap_lower_bound (dest, c->key);
+        }
+        if (pos < dest->num_containers && dest->containers[pos].key == c->key) {
+            bitmap_container_t merged;
+            container_or (&merged, &dest->containers[pos], c);
+            container_clear (&dest->containers[pos]);
+            dest->containers[pos] = merged;
+        }
+        else {
+            bitmap_container_t *inserted = bitmap_insert_container (dest, pos, c->key);
+            container_copy (inserted, c);
+        }
+    }
+}
+
+// turns a bitset with few values back into an array
+static void
+container_shrink (bitmap_container_t *c)
+{
+    if (!c->is_bitset || c->cardinality > ARRAY_MAX_CARDINALITY) {
+        return;
+    }
+    uint16_t *values = malloc (MAX (c->cardinality, 1) * sizeof (uint16_t));
+    assert (values != NULL);
+    uint32_t n = 0;
+    for (uint32_t w = 0; w < BITSET_NUM_WORDS; w++) {
+        uint64_t word = c->words[w];
+        while (word) {
+            values[n++] = (w << 6) + __builtin_ctzll (word);
+            word &= word - 1;
+        }
+    }
+    const uint32_t cardinality = c->cardinality;
+    container_clear (c);
+    c->is_bitset = false;
+    c->values = values;
+    c->cardinality = cardinality;
+    c->capacity = MAX (cardinality, 1);
+}
+
+static void
+container_and (bitmap_container_t *dest,
+               const bitmap_container_t *a,
+               const bitmap_container_t *b)
+{
+    memset (dest, 0, sizeof (bitmap_container_t));
+    dest->key = a->key;
+
+    if (a->is_bitset && b->is_bitset) {
+        dest->is_bitset = true;
+        dest->words = malloc (BITSET_NUM_WORDS * sizeof (uint64_t));
+        assert (dest->words != NULL);
+        for (uint32_t w = 0; w < BITSET_NUM_WORDS; w++) {
+            dest->words[w] = a->words[w] & b->words[w];
+            dest->cardinality += __builtin_popcountll (dest->words[w]);
+        }
+        container_shrink (dest);
+        return;
+    }
+
+    // the result is at most as large as the smaller array
+    if (a->is_bitset) {
+        const bitmap_container_t *tmp = a;
+        a = b;
+        b = tmp;
+    }
+    dest->capacity = MAX (a->cardinality, 1);
+    dest->values = malloc (dest->capacity * sizeof (uint16_t));
+    assert (dest->values != NULL);
+    uint32_t n = 0;
+    if (b->is_bitset) {
+        for (uint32_t i = 0; i < a->cardinality; i++) {
+            const uint16_t v = a->values[i];
+            dest->values[n] = v;
+            n += (b->words[v >> 6] >> (v & 63)) & 1;
+        }
+    }
+    else {
+        uint32_t i = 0;
+        uint32_t j = 0;
+        while (i < a->cardinality && j < b->cardinality) {
+            const uint16_t va = a->values[i];
+            const uint16_t vb = b->values[j];
+            if (va == vb) {
+                dest->values[n++] = va;
+            }
+            i += va <= vb;
+            j += vb <= va;
+        }
+    }
+    dest->cardinality = n;
+}
+
+// all values of a which aren't in b
+static void
+container_andnot (bitmap_container_t *dest,
+                  const bitmap_container_t *a,
+                  const bitmap_container_t *b)
+{
+    memset (dest, 0, sizeof (bitmap_container_t));
+    dest->key = a->key;
+
+    if (a->is_bitset) {
+        dest->is_bitset = true;
+        dest->words = malloc (BITSET_NUM_WORDS * sizeof (uint64_t));
+        assert (dest->words != NULL);
+        if (b->is_bitset) {
+            for (uint32_t w = 0; w < BITSET_NUM_WORDS; w++) {
+                dest->words[w] = a->words[w] & ~b->words[w];
+            }
+        }
+        else {
+            memcpy (dest->words, a->words, BITSET_NUM_WORDS * sizeof (uint64_t));
+            for (uint32_t i = 0; i < b->cardinality; i++) {
+                dest->words[b->values[i] >> 6] &= ~(1ull << (b->values[i] & 63));
+            }
+        }
+        for (uint32_t w = 0; w < BITSET_NUM_WORDS; w++) {
+            dest->cardinality += __builtin_popcountll (dest->words[w]);
+        }
+        container_shrink (dest);
+        return;
+    }
+
+    dest->capacity = MAX (a->cardinality, 1);
+    dest->values = malloc (dest->capacity * sizeof (uint16_t));
+    assert (dest->values != NULL);
+    uint32_t n = 0;
+    if (b->is_bitset) {
+        for (uint32_t i = 0; i < a->cardinality; i++) {
+            const uint16_t v = a->values[i];
+            dest->values[n] = v;
+            n += !((b->words[v >> 6] >> (v & 63)) & 1);
+        }
+    }
+    else {
+        uint32_t j = 0;
+        for (uint32_t i = 0; i < a->cardinality; i++) {
+            const uint16_t v = a->values[i];
+            while (j < b->cardinality && b->values[j] < v) {
+                j++;
+            }
+            if (j == b->cardinality || b->values[j] != v) {
+                dest->values[n++] = v;
+            }
+        }
+    }
+    dest->cardinality = n;
+}
+
+Bitmap *
+bitmap_and (const Bitmap *a, const Bitmap *b)
+{
+    assert (a != NULL);
+    assert (b != NULL);
+
+    Bitmap *result = bitmap_new ();
+    result->capacity = MAX (MIN (a->num_containers, b->num_containers), 1);
+    result->containers = calloc (result->capacity, sizeof (bitmap_container_t));
+    assert (result->containers != NULL);
+
+    uint32_t i = 0;
+    uint32_t j = 0;
+    while (i < a->num_containers && j < b->num_containers) {
+        const uint16_t key_a = a->containers[i].key;
+        const uint16_t key_b = b->containers[j].key;
+        if (key_a < key_b) {
+            i++;
+        }
+        else if (key_b < key_a) {
+            j++;
+        }
+        else {
+            bitmap_container_t *dest = &result->containers[result->num_containers];
+            container_and (dest, &a->containers[i++], &b->containers[j++]);
+            if (dest->cardinality) {
+                result->num_containers++;
+            }
+            else {
+                container_clear (dest);
+            }
+        }
+    }
+    return result;
+}
+
+Bitmap *
+bitmap_andnot (const Bitmap *a, const Bitmap *b)
+{
+    assert (a != NULL);
+    assert (b != NULL);
+
+    Bitmap *result = bitmap_new ();
+    result->capacity = MAX (a->num_containers, 1);
+    result->containers = calloc (result->capacity, sizeof (bitmap_container_t));
+    assert (result->containers != NULL);
+
+    uint32_t j = 0;
+    for (uint32_t i = 0; i < a->num_containers; i++) {
+        const bitmap_container_t *c = &a->containers[i];
+        while (j < b->num_containers && b->containers[j].key < c->key) {
+            j++;
+        }
+        bitmap_container_t *dest = &result->containers[result->num_containers];
+        if (j < b->num_containers && b->containers[j].key == c->key) {
+            container_andnot (dest, c, &b->containers[j]);
+        }
+        else {
+            container_copy (dest, c);
+        }
+        if (dest->cardinality) {
+            result->num_containers++;
+        }
+        else {
+            container_clear (dest);
+        }
+    }
+    return result;
+}
+
+Bitmap *
+bitmap_new_from_unsorted (const uint32_t *values, uint32_t num_values)
+{
+    assert (values != NULL || num_values == 0);
+
+    Bitmap *bitmap = bitmap_new ();
+    if (num_values == 0) {
+        return bitmap;
+    }
+
+    // bucket the lower 16 bits by container, a counting sort on the keys
+    uint32_t max_key = 0;
+    for (uint32_t i = 0; i < num_values; i++) {
+        max_key = MAX (max_key, values[i] >> 16);
+    }
+    uint32_t *offsets = calloc (max_key + 2, sizeof (uint32_t));
+    assert (offsets != NULL);
+    for (uint32_t i = 0; i < num_values; i++) {
+        offsets[(values[i] >> 16) + 1]++;
+    }
+    for (uint32_t key = 1; key <= max_key + 1; key++) {
+        offsets[key] += offsets[key - 1];
+    }
+    uint16_t *lows = malloc (num_values * sizeof (uint16_t));
+    assert (lows != NULL);
+    uint32_t *fill = malloc ((max_key + 1) * sizeof (uint32_t));
+    assert (fill != NULL);
+    memcpy (fill, offsets, (max_key + 1) * sizeof (uint32_t));
+    for (uint32_t i = 0; i < num_values; i++) {
+        lows[fill[values[i] >> 16]++] = values[i] & 0xFFFF;
+    }
+    free (fill);
+    fill = NULL;
+
+    // every bucket is set in a bitset, which also brings it in order
+    for (uint32_t key = 0; key <= max_key; key++) {
+        if (offsets[key + 1] == offsets[key]) {
+            continue;
+        }
+        bitmap_container_t *c = bitmap_insert_container (bitmap, bitmap->num_containers, key);
+        c->is_bitset = true;
+        c->words = calloc (BITSET_NUM_WORDS, sizeof (uint64_t));
+        assert (c->words != NULL);
+        for (uint32_t i = offsets[key]; i < offsets[key + 1]; i++) {
+            c->words[lows[i] >> 6] |= 1ull << (lows[i] & 63);
+        }
+        for (uint32_t w = 0; w < BITSET_NUM_WORDS; w++) {
+            c->cardinality += __builtin_popcountll (c->words[w]);
+        }
+        container_shrink (c);
+    }
+    free (lows);
+    lows = NULL;
+    free (offsets);
+    offsets = NULL;
+    return bitmap;
+}
+
+Bitmap *
+bitmap_new_full (uint32_t num_values)
+{
+    Bitmap *bitmap = bitmap_new ();
+    for (uint64_t start = 0; start < num_values; start += 65536) {
+        bitmap_container_t *c = bitmap_insert_container (bitmap, bitmap->num_containers, start >> 16);
+        c->is_bitset = true;
+        c->words = calloc (BITSET_NUM_WORDS, sizeof (uint64_t));
+        assert (c->words != NULL);
+        c->cardinality = MIN (num_values - start, 65536);
+        const uint32_t num_full_words = c->cardinality / 64;
+        memset (c->words, 0xFF, num_full_words * sizeof (uint64_t));
+        if (c->cardinality % 64) {
+            c->words[num_full_words] = (1ull << (c->cardinality % 64)) - 1;
+        }
+        container_shrink (c);
+    }
+    return bitmap;
+}
+
+void
+bitmap_iter_init (BitmapIter *iter, const Bitmap *bitmap, uint32_t from)
+{
+    assert (iter != NULL);
+    assert (bitmap != NULL);
+
+    iter->bitmap = bitmap;
+    iter->index = 0;
+    const uint16_t key = from >> 16;
+    iter->container = bitmap_lower_bound (bitmap, key);
+    if (iter->container < bitmap->num_containers
+        && bitmap->containers[iter->container].key == key) {
+        const bitmap_container_t *c = &bitmap->containers[iter->container];
+        const uint16_t low = from & 0xFFFF;
+        iter->index = c->is_bitset ? low : container_array_lower_bound (c, low);
+    }
+}
+
+bool
+bitmap_iter_next (BitmapIter *iter, uint32_t *value)
+{
+    assert (iter != NULL);
+    assert (value != NULL);
+
+    const Bitmap *bitmap = iter->bitmap;
+    while (iter->container < bitmap->num_containers) {
+        const bitmap_container_t *c = &bitmap->containers[iter->container];
+        if (c->is_bitset) {
+            while (iter->index < 65536) {
+                const uint32_t w = iter->index >> 6;
+                // skip the bits we've already visited in this word
+                const uint64_t word = c->words[w] & (~0ull << (iter->index & 63));
+                if (word) {
+                    const uint32_t low = (w << 6) + __builtin_ctzll (word);
+                    iter->index = low + 1;
+                    *value = ((uint32_t)c->key << 16) | low;
+                    return true;
+                }
+                iter->index = (w + 1) << 6;
+            }
+        }
+        else if (iter->index < c->cardinality) {
+            *value = ((uint32_t)c->key << 16) | c->values[iter->index++];
+            return true;
+        }
+        iter->container++;
+        iter->index = 0;
+    }
+    return false;
+}
@@ -0,0 +1,91 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Compressed bitmap of uint32_t values, similar to a roaring bitmap:
+// values are grouped in chunks of 65536 by their upper 16 bits and every
+// chunk is either stored as a sorted array of its lower 16 bits (sparse)
+// or as a plain bitset (dense).
+
+typedef struct _Bitmap Bitmap;
+
+typedef struct
+{
+    const Bitmap *bitmap;
+    uint32_t container;
+    uint32_t index;
+} BitmapIter;
+
+Bitmap *
+bitmap_new (void);
+
+void
+bitmap_free (Bitmap *bitmap);
+
+void
+bitmap_add (Bitmap *bitmap, uint32_t value);
+
+bool
+bitmap_contains (const Bitmap *bitmap, uint32_t value);
+
+uint32_t
+bitmap_get_cardinality (const Bitmap *bitmap);
+
+size_t
+bitmap_get_memory_usage (const Bitmap *bitmap);
+
+// builds a bitmap from values in any order in linear time, duplicates are
+// only added once
+Bitmap *
+bitmap_new_from_unsorted (const uint32_t *values, uint32_t num_values);
+
+// returns a bitmap with all values below num_values
+Bitmap *
+bitmap_new_full (uint32_t num_values);
+
+Bitmap *
+bitmap_copy (const Bitmap *bitmap);
+
+// returns a new bitmap with all values of a and b
+Bitmap *
+bitmap_or (const Bitmap *a, const Bitmap *b);
+
+// adds all values of src to dest, cheapest if they're larger than those of
+// dest, e.g. when the matches of consecutive ranges are collected
+void
+bitmap_or_inplace (Bitmap *dest, const Bitmap *src);
+
+// returns a new bitmap with the values which are in both a and b
+Bitmap *
+bitmap_and (const Bitmap *a, const Bitmap *b);
+
+// returns a new bitmap with the values of a which aren't in b
+Bitmap *
+bitmap_andnot (const Bitmap *a, const Bitmap *b);
+
+// iterates over all values >= from in increasing order
+void
+bitmap_iter_init (BitmapIter *iter, const Bitmap *bitmap, uint32_t from);
+
+bool
+bitmap_iter_next (BitmapIter *iter, uint32_t *value);
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <assert.h>
 #include "btree.h"
+#include "string_utils.h"
 
 BTreeNode *
 btree_node_new (const char *name,
@@ -38,7 +39,10 @@ btree_node_new (const char *name,
     new->next = NULL;
 
     // data
+    const size_t name_len = strlen (name);
     new->name = strdup (name);
+    new->signature = fsearch_str_signature (name);
+    new->name_len = name_len < UINT16_MAX ? name_len : UINT16_MAX;
     new->mtime = mtime;
     new->size = size;
     new->pos = pos;
@@ -178,6 +182,16 @@ btree_node_depth (BTreeNode *node)
     return depth;
 }
 
+uint64_t
+btree_node_path_signature (BTreeNode *node)
+{
+    uint64_t signature = fsearch_str_signature ("/");
+    for (BTreeNode *temp = node; temp; temp = temp->parent) {
+        signature |= temp->signature;
+    }
+    return signature;
+}
+
 uint32_t
 btree_node_n_children (BTreeNode *node)
 {
@@ -32,11 +32,23 @@ struct _BTreeNode
 
     // data
     char *name;
+    // characters of the name, see fsearch_str_signature
+    uint64_t signature;
+    // strlen of the name, names are limited to NAME_MAX (root nodes to
+    // PATH_MAX) so 16 bits are plenty
+    uint16_t name_len;
+    // position in the prefix index of the database, see db_get_prefix_bitmap
+    uint32_t prefix_pos;
 
     time_t mtime;
     off_t size;
     uint32_t pos;
+    // index into the extension dictionary of the database
+    uint16_t ext_id;
     bool is_dir;
+    // the name or that of a parent starts with a dot, set when the entries
+    // list is built
+    bool is_hidden;
 };
 
 BTreeNode *
@@ -73,6 +85,10 @@ btree_node_n_nodes (BTreeNode *node);
 uint32_t
 btree_node_depth (BTreeNode *node);
 
+// signature of the full path, without building it
+uint64_t
+btree_node_path_signature (BTreeNode *node);
+
 uint32_t
 btree_node_n_children (BTreeNode *node);
 
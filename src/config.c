@@ -29,6 +29,12 @@
 const char *config_file_name = "fsearch.conf";
 const char *config_folder_name = "fsearch";
 
+static const char *thread_pool_policy_names[] = {
+    [FSEARCH_THREAD_POOL_POLICY_PHYSICAL_CORES] = "physical_cores",
+    [FSEARCH_THREAD_POOL_POLICY_ALL_CPUS] = "all_cpus",
+    [FSEARCH_THREAD_POOL_POLICY_CUSTOM] = "custom",
+};
+
 void
 build_config_dir (char *path, size_t len)
 {
@@ -124,6 +130,32 @@ config_load_string (GKeyFile *key_file,
     return result;
 }
 
+static FsearchThreadPoolPolicy
+config_load_thread_pool_policy (GKeyFile *key_file,
+                                const char *group_name,
+                                const char *key,
+                                FsearchThreadPoolPolicy default_value)
+{
+    char *name = config_load_string (key_file, group_name, key, NULL);
+    if (!name) {
+        return default_value;
+    }
+    FsearchThreadPoolPolicy result = default_value;
+    bool found = false;
+    for (uint32_t i = 0; i < G_N_ELEMENTS (thread_pool_policy_names); i++) {
+        if (!strcmp (name, thread_pool_policy_names[i])) {
+            result = i;
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        fprintf(stderr, "load_config: invalid value: unknown thread pool policy %s\n", name);
+    }
+    g_free (name);
+    return result;
+}
+
 bool
 load_config (FsearchConfig *config)
 {
@@ -266,6 +298,14 @@ load_config (FsearchConfig *config)
                                                     "Search",
                                                     "enable_regex",
                                                     false);
+        config->enable_fuzzy = config_load_boolean (key_file,
+                                                    "Search",
+                                                    "enable_fuzzy",
+                                                    false);
+        config->rank_by_relevance = config_load_boolean (key_file,
+                                                         "Search",
+                                                         "rank_by_relevance",
+                                                         false);
         config->search_in_path = config_load_boolean (key_file,
                                                       "Search",
                                                       "search_in_path",
@@ -282,6 +322,14 @@ load_config (FsearchConfig *config)
                                                    "Search",
                                                    "num_results",
                                                    10000);
+        config->result_cache_size = config_load_integer (key_file,
+                                                         "Search",
+                                                         "result_cache_size",
+                                                         32);
+        config->progressive_results = config_load_boolean (key_file,
+                                                           "Search",
+                                                           "progressive_results",
+                                                           true);
 
         // Database
         config->update_database_on_launch = config_load_boolean (key_file,
@@ -296,6 +344,28 @@ load_config (FsearchConfig *config)
                                                        "Database",
                                                        "follow_symbolic_links",
                                                        false);
+        config->build_suffix_index = config_load_boolean (key_file,
+                                                          "Database",
+                                                          "build_suffix_index",
+                                                          false);
+        config->lower_background_priority = config_load_boolean (key_file,
+                                                                 "Database",
+                                                                 "lower_background_priority",
+                                                                 true);
+
+        // Threads
+        config->thread_pool_policy = config_load_thread_pool_policy (key_file,
+                                                                     "Threads",
+                                                                     "policy",
+                                                                     FSEARCH_THREAD_POOL_POLICY_ALL_CPUS);
+        config->thread_pool_num_threads = config_load_integer (key_file,
+                                                               "Threads",
+                                                               "num_threads",
+                                                               0);
+        config->thread_pool_cpus = config_load_string (key_file,
+                                                       "Threads",
+                                                       "cpus",
+                                                       NULL);
 
         // Locations
         uint32_t pos = 1;
@@ -345,10 +415,14 @@ load_default_config (FsearchConfig *config)
     config->search_as_you_type = true;
     config->match_case = false;
     config->enable_regex = false;
+    config->enable_fuzzy = false;
+    config->rank_by_relevance = false;
     config->search_in_path = false;
     config->hide_results_on_empty_search = true;
     config->limit_results = true;
     config->num_results = 10000;
+    config->result_cache_size = 32;
+    config->progressive_results = true;
 
     // Interface
     config->enable_dark_theme = false;
@@ -387,6 +461,13 @@ load_default_config (FsearchConfig *config)
     config->update_database_on_launch = false;
     config->exclude_hidden_items = false;
     config->follow_symlinks = false;
+    config->build_suffix_index = false;
+    config->lower_background_priority = true;
+
+    // Threads
+    config->thread_pool_policy = FSEARCH_THREAD_POOL_POLICY_ALL_CPUS;
+    config->thread_pool_num_threads = 0;
+    config->thread_pool_cpus = NULL;
 
     // Locations
     config->locations = NULL;
@@ -444,15 +525,26 @@ save_config (FsearchConfig *config)
     g_key_file_set_boolean (key_file, "Search", "auto_search_in_path", config->auto_search_in_path);
     g_key_file_set_boolean (key_file, "Search", "search_in_path", config->search_in_path);
     g_key_file_set_boolean (key_file, "Search", "enable_regex", config->enable_regex);
+    g_key_file_set_boolean (key_file, "Search", "enable_fuzzy", config->enable_fuzzy);
+    g_key_file_set_boolean (key_file, "Search", "rank_by_relevance", config->rank_by_relevance);
     g_key_file_set_boolean (key_file, "Search", "match_case", config->match_case);
     g_key_file_set_boolean (key_file, "Search", "hide_results_on_empty_search", config->hide_results_on_empty_search);
     g_key_file_set_boolean (key_file, "Search", "limit_results", config->limit_results);
     g_key_file_set_integer (key_file, "Search", "num_results", config->num_results);
+    g_key_file_set_integer (key_file, "Search", "result_cache_size", config->result_cache_size);
+    g_key_file_set_boolean (key_file, "Search", "progressive_results", config->progressive_results);
 
     // Database
     g_key_file_set_boolean (key_file, "Database", "update_database_on_launch", config->update_database_on_launch);
     g_key_file_set_boolean (key_file, "Database", "exclude_hidden_files_and_folders", config->exclude_hidden_items);
     g_key_file_set_boolean (key_file, "Database", "follow_symbolic_links", config->follow_symlinks);
+    g_key_file_set_boolean (key_file, "Database", "build_suffix_index", config->build_suffix_index);
+    g_key_file_set_boolean (key_file, "Database", "lower_background_priority", config->lower_background_priority);
+
+    // Threads
+    g_key_file_set_string (key_file, "Threads", "policy", thread_pool_policy_names[config->thread_pool_policy]);
+    g_key_file_set_integer (key_file, "Threads", "num_threads", config->thread_pool_num_threads);
+    g_key_file_set_string (key_file, "Threads", "cpus", config->thread_pool_cpus ? config->thread_pool_cpus : "");
 
     if (config->locations) {
         uint32_t pos = 1;
@@ -503,6 +595,10 @@ config_free (FsearchConfig *config)
         g_list_free_full (config->exclude_locations, (GDestroyNotify)free);
         config->exclude_locations = NULL;
     }
+    if (config->thread_pool_cpus) {
+        g_free (config->thread_pool_cpus);
+        config->thread_pool_cpus = NULL;
+    }
     free (config);
     config = NULL;
 }
@@ -22,6 +22,8 @@
 #include <stdint.h>
 #include <glib.h>
 
+#include "fsearch_thread_pool.h"
+
 typedef struct _FsearchConfig FsearchConfig;
 
 struct _FsearchConfig
@@ -31,6 +33,8 @@ struct _FsearchConfig
     bool hide_results_on_empty_search;
     bool search_in_path;
     bool enable_regex;
+    bool enable_fuzzy;
+    bool rank_by_relevance;
     bool match_case;
     bool auto_search_in_path;
     bool search_as_you_type;
@@ -74,8 +78,22 @@ struct _FsearchConfig
     bool update_database_on_launch;
     bool exclude_hidden_items;
     bool follow_symlinks;
+    // full text index for substring searches, costs about 5 bytes per
+    // character of all names
+    bool build_suffix_index;
+    bool lower_background_priority;
 
     uint32_t num_results;
+    // memory for caching the results of recent queries in MiB, 0 disables it
+    uint32_t result_cache_size;
+    // show the first results of slow searches while they're still running
+    bool progressive_results;
+
+    // Threads
+    FsearchThreadPoolPolicy thread_pool_policy;
+    // only used by the custom policy, see fsearch_thread_pool_init
+    uint32_t thread_pool_num_threads;
+    char *thread_pool_cpus;
 
     GList *locations;
     GList *exclude_locations;
@@ -0,0 +1,246 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+#include <glib.h>
+
+#include "cpu_topology.h"
+#include "debug.h"
+
+#define SYSFS_CPU_DIR "/sys/devices/system/cpu"
+#define SYSFS_NODE_DIR "/sys/devices/system/node"
+#define MAX_CPUS CPU_SETSIZE
+
+uint32_t
+fsearch_cpu_list_parse (const char *list, uint32_t *cpus, uint32_t max_cpus)
+{
+    assert (list != NULL);
+    assert (cpus != NULL);
+
+    uint32_t num_cpus = 0;
+    const char *p = list;
+    while (*p != '\0' && *p != '\n') {
+        char *end = NULL;
+        const long first = strtol (p, &end, 10);
+        if (end == p || first < 0) {
+            return 0;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtol (p, &end, 10);
+            if (end == p || last < first) {
+                return 0;
+            }
+            p = end;
+        }
+        for (long cpu = first; cpu <= last && num_cpus < max_cpus; cpu++) {
+            cpus[num_cpus++] = cpu;
+        }
+        if (*p == ',') {
+            p++;
+        }
+        else if (*p != '\0' && *p != '\n') {
+            return 0;
+        }
+    }
+    return num_cpus;
+}
+
+static bool
+read_cpu_list (const char *path, uint32_t *cpus, uint32_t *num_cpus)
+{
+    gchar *contents = NULL;
+    if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+        return false;
+    }
+    *num_cpus = fsearch_cpu_list_parse (contents, cpus, MAX_CPUS);
+    g_free (contents);
+    return *num_cpus > 0;
+}
+
+static int32_t
+read_topology_id (uint32_t cpu, const char *name, int32_t default_value)
+{
+    char path[256] = "";
+    snprintf (path, sizeof (path), SYSFS_CPU_DIR "/cpu%u/topology/%s", cpu, name);
+
+    gchar *contents = NULL;
+    if (!g_file_get_contents (path, &contents, NULL, NULL)) {
+        return default_value;
+    }
+    const int32_t id = atoi (contents);
+    g_free (contents);
+    return id;
+}
+
+static int
+compare_cpus (const void *a, const void *b)
+{
+    const FsearchCpu *cpu_a = a;
+    const FsearchCpu *cpu_b = b;
+    return cpu_a->id < cpu_b->id ? -1 : cpu_a->id > cpu_b->id;
+}
+
+static void
+topology_assign_nodes (FsearchCpuTopology *topology)
+{
+    topology->num_nodes = 1;
+
+    uint32_t *nodes = calloc (MAX_CPUS, sizeof (uint32_t));
+    uint32_t *node_cpus = calloc (MAX_CPUS, sizeof (uint32_t));
+    assert (nodes != NULL);
+    assert (node_cpus != NULL);
+
+    uint32_t num_nodes = 0;
+    if (read_cpu_list (SYSFS_NODE_DIR "/online", nodes, &num_nodes)) {
+        for (uint32_t i = 0; i < num_nodes; i++) {
+            char path[256] = "";
+            snprintf (path, sizeof (path), SYSFS_NODE_DIR "/node%u/cpulist", nodes[i]);
+            uint32_t num_node_cpus = 0;
+            if (!read_cpu_list (path, node_cpus, &num_node_cpus)) {
+                continue;
+            }
+            for (uint32_t j = 0; j < num_node_cpus; j++) {
+                FsearchCpu *cpu = (FsearchCpu *)fsearch_cpu_topology_lookup (topology, node_cpus[j]);
+                if (cpu) {
+                    cpu->node = nodes[i];
+                }
+            }
+            topology->num_nodes = MAX (topology->num_nodes, nodes[i] + 1);
+        }
+    }
+    free (node_cpus);
+    free (nodes);
+}
+
+FsearchCpuTopology *
+fsearch_cpu_topology_new (void)
+{
+    FsearchCpuTopology *topology = calloc (1, sizeof (FsearchCpuTopology));
+    assert (topology != NULL);
+
+    uint32_t *online = calloc (MAX_CPUS, sizeof (uint32_t));
+    assert (online != NULL);
+    uint32_t num_online = 0;
+    if (!read_cpu_list (SYSFS_CPU_DIR "/online", online, &num_online)) {
+        num_online = MIN (g_get_num_processors (), MAX_CPUS);
+        for (uint32_t i = 0; i < num_online; i++) {
+            online[i] = i;
+        }
+    }
+
+    cpu_set_t allowed;
+    CPU_ZERO (&allowed);
+    const bool has_affinity = sched_getaffinity (0, sizeof (allowed), &allowed) == 0;
+
+    topology->cpus = calloc (num_online, sizeof (FsearchCpu));
+    assert (topology->cpus != NULL);
+    for (uint32_t i = 0; i < num_online; i++) {
+        const uint32_t id = online[i];
+        // taskset and cgroups may restrict us to some of the cpus
+        if (has_affinity && !CPU_ISSET (id, &allowed)) {
+            continue;
+        }
+        FsearchCpu *cpu = &topology->cpus[topology->num_cpus++];
+        cpu->id = id;
+        // without topology information every cpu is a core of its own
+        cpu->core_id = read_topology_id (id, "core_id", id);
+        cpu->package_id = read_topology_id (id, "physical_package_id", 0);
+        cpu->node = 0;
+    }
+    free (online);
+    online = NULL;
+
+    if (topology->num_cpus == 0) {
+        // can't happen unless sysfs is inconsistent with our affinity
+        topology->cpus[0].id = 0;
+        topology->cpus[0].core_id = 0;
+        topology->num_cpus = 1;
+    }
+    qsort (topology->cpus, topology->num_cpus, sizeof (FsearchCpu), compare_cpus);
+
+    topology_assign_nodes (topology);
+
+    const FsearchCpu **cores = calloc (topology->num_cpus, sizeof (FsearchCpu *));
+    assert (cores != NULL);
+    topology->num_cores = fsearch_cpu_topology_get_cores (topology, cores, topology->num_cpus);
+    free (cores);
+    cores = NULL;
+
+    trace ("cpu topology: %d cpus, %d cores, %d numa nodes\n",
+           topology->num_cpus,
+           topology->num_cores,
+           topology->num_nodes);
+    return topology;
+}
+
+void
+fsearch_cpu_topology_free (FsearchCpuTopology *topology)
+{
+    if (!topology) {
+        return;
+    }
+    if (topology->cpus) {
+        free (topology->cpus);
+        topology->cpus = NULL;
+    }
+    free (topology);
+    topology = NULL;
+}
+
+uint32_t
+fsearch_cpu_topology_get_cores (FsearchCpuTopology *topology,
+                                const FsearchCpu **cpus,
+                                uint32_t max_cpus)
+{
+    assert (topology != NULL);
+    assert (cpus != NULL);
+
+    uint32_t num_cpus = 0;
+    for (uint32_t i = 0; i < topology->num_cpus && num_cpus < max_cpus; i++) {
+        const FsearchCpu *cpu = &topology->cpus[i];
+        bool first_sibling = true;
+        for (uint32_t j = 0; j < num_cpus; j++) {
+            if (cpus[j]->core_id == cpu->core_id && cpus[j]->package_id == cpu->package_id) {
+                first_sibling = false;
+                break;
+            }
+        }
+        if (first_sibling) {
+            cpus[num_cpus++] = cpu;
+        }
+    }
+    return num_cpus;
+}
+
+const FsearchCpu *
+fsearch_cpu_topology_lookup (FsearchCpuTopology *topology, uint32_t id)
+{
+    assert (topology != NULL);
+
+    FsearchCpu key = {.id = id};
+    return bsearch (&key, topology->cpus, topology->num_cpus, sizeof (FsearchCpu), compare_cpus);
+}
@@ -0,0 +1,66 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The logical cpus this process may run on, as reported by sysfs, with the
+// physical core, package and numa node each one belongs to.
+
+typedef struct {
+    // the cpu number the kernel uses
+    uint32_t id;
+    // cpus with the same package and core id are smt siblings
+    int32_t core_id;
+    int32_t package_id;
+    // 0 without numa
+    uint32_t node;
+} FsearchCpu;
+
+typedef struct {
+    // sorted by id
+    FsearchCpu *cpus;
+    uint32_t num_cpus;
+    uint32_t num_cores;
+    uint32_t num_nodes;
+} FsearchCpuTopology;
+
+// falls back to one core per cpu on a single node if sysfs can't be read
+FsearchCpuTopology *
+fsearch_cpu_topology_new (void);
+
+void
+fsearch_cpu_topology_free (FsearchCpuTopology *topology);
+
+// returns the first cpu of every physical core, at most max_cpus of them
+uint32_t
+fsearch_cpu_topology_get_cores (FsearchCpuTopology *topology,
+                                const FsearchCpu **cpus,
+                                uint32_t max_cpus);
+
+// NULL if the process may not run on cpu id
+const FsearchCpu *
+fsearch_cpu_topology_lookup (FsearchCpuTopology *topology, uint32_t id);
+
+// parses a cpu list like "0-3,8,10-11" as used by sysfs and taskset,
+// returns the number of cpus stored or 0 if the list is invalid
+uint32_t
+fsearch_cpu_list_parse (const char *list, uint32_t *cpus, uint32_t max_cpus);
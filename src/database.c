@@ -29,9 +29,12 @@
 #include <dirent.h>
 #include <errno.h>
 #include <err.h>
+#include <stdatomic.h>
 #include <glib/gstdio.h>
 
 #include "database.h"
+#include "bitmap.h"
+#include "suffix_index.h"
 #include "config.h"
 #include "fsearch.h"
 #include "debug.h"
@@ -50,19 +53,62 @@ struct _Database
     GPtrArray *filtered_entries;
     uint32_t num_entries;
 
-    time_t timestamp;
+    // number of entries whose name contains a given (case folded) byte,
+    // used by the search to estimate how selective a query term is
+    uint32_t char_counts[256];
 
-    GMutex mutex;
-    bool busy;
-};
+    // extension dictionary: every distinct (lower case) extension gets an
+    // id, which is stored in the nodes, and a bitmap of the entries with
+    // that extension
+    GHashTable *ext_ids;
+    GPtrArray *ext_names;
+    GPtrArray *ext_bitmaps;
+    bool ext_overflow;
 
-struct _DatabaseSearch
-{
-    GPtrArray *results;
+    // positions of all folders and of all hidden entries, so the filters
+    // can narrow the candidates of a search instead of testing every entry
+    Bitmap *folders;
+    Bitmap *hidden;
+
+    // positions of all entries ordered by their case folded names byte by
+    // byte, so all names with a given prefix form a consecutive range
+    uint32_t *prefix_index;
 
-    gchar *query;
-    uint32_t search_mode;
-    uint32_t search_in_path;
+    // optional full text index over all names, NULL unless it was built
+    SuffixIndex *suffix_index;
+    // how long building it took in microseconds
+    int64_t suffix_index_build_time;
+
+    // incremented whenever the entries change, so anything derived from
+    // them (e.g. cached search results) can tell it's outdated
+    uint64_t generation;
+
+    time_t timestamp;
+
+    // sorting and building the indexes run on it
+    FsearchThreadPool *pool;
+
+    // searches only read the database, so any number of them may hold the
+    // lock at the same time, while a writer has to wait for all of them
+    GRWLock lock;
+
+#ifdef DEBUG
+    // how often the lock was taken and how often and how long that meant
+    // waiting for someone else
+    atomic_uint_fast64_t num_reads;
+    atomic_uint_fast64_t num_read_waits;
+    atomic_int_fast64_t read_wait_time;
+    atomic_uint_fast64_t num_writes;
+    atomic_uint_fast64_t num_write_waits;
+    atomic_int_fast64_t write_wait_time;
+#endif
+
+    // a database is built once and then published as an immutable
+    // snapshot, everyone who uses it after that holds a reference
+    volatile gint ref_count;
+
+    // set when the app quits during a scan, so the walk stops early
+    atomic_bool build_cancelled;
 };
 
 struct _DatabaseLocation
@@ -72,11 +118,26 @@ struct _DatabaseLocation
     uint32_t num_items;
 };
 
+// generations are unique across all databases, so a snapshot can't be
+// mistaken for an earlier one which happened to live at the same address
+static GMutex generation_mutex;
+static uint64_t last_generation = 0;
+
+static uint64_t
+db_next_generation (void)
+{
+    g_mutex_lock (&generation_mutex);
+    const uint64_t next = ++last_generation;
+    g_mutex_unlock (&generation_mutex);
+    return next;
+}
+
 enum {
     WALK_OK = 0,
     WALK_BADPATTERN,
     WALK_NAMETOOLONG,
     WALK_BADIO,
+    WALK_CANCELLED,
 };
 
 // Forward declarations
@@ -87,14 +148,11 @@ static DatabaseLocation *
 db_location_get_for_path (Database *db, const char *path);
 
 static DatabaseLocation *
-db_location_build_tree (const char *dname, void (*callback)(const char *));
+db_location_build_tree (Database *db, const char *dname, void (*callback)(const char *));
 
 static DatabaseLocation *
 db_location_new (void);
 
-static void
-db_list_add_location (Database *db, DatabaseLocation *location);
-
 // Implemenation
 
 static void
@@ -139,7 +197,9 @@ db_location_load_from_file (const char *fname)
     if (fread (&minorver, 1, 1, fp) != 1) {
         goto load_fail;
     }
-    if (minorver != 1) {
+    // versions before 3 may lack hidden items, which were only indexed
+    // if they weren't excluded in the preferences, so they're rescanned
+    if (minorver != 3) {
         printf ("bad minorver=%d\n", minorver);
         goto load_fail;
     }
@@ -209,7 +269,15 @@ db_location_load_from_file (const char *fname)
             goto load_fail;
         }
 
+        // read prefix index position
+        uint32_t prefix_pos = 0;
+        if (fread (&prefix_pos, 1, 4, fp) != 4) {
+            printf("failed to read prefix index position\n");
+            goto load_fail;
+        }
+
         BTreeNode *new = btree_node_new (name, mtime, size, pos, is_dir);
+        new->prefix_pos = prefix_pos;
         if (!prev) {
             prev = new;
             root = new;
@@ -268,7 +336,7 @@ db_location_write_to_file (DatabaseLocation *location, const char *path)
         goto save_fail;
     }
 
-    const uint8_t minorver = 1;
+    const uint8_t minorver = 3;
     if (fwrite (&minorver, 1, 1, fp) != 1) {
         goto save_fail;
     }
@@ -318,6 +386,12 @@ db_location_write_to_file (DatabaseLocation *location, const char *path)
                 goto save_fail;
             }
 
+            // write prefix index position
+            uint32_t prefix_pos = node->prefix_pos;
+            if (fwrite (&prefix_pos, 1, 4, fp) != 4) {
+                goto save_fail;
+            }
+
             BTreeNode *temp = node->children;
             if (!temp) {
                 // reached end of children, write delimiter
@@ -380,7 +454,8 @@ directory_is_excluded (const char *name, GList *excludes)
 }
 
 static int
-db_location_walk_tree_recursive (DatabaseLocation *location,
+db_location_walk_tree_recursive (Database *db,
+                                 DatabaseLocation *location,
                                  GList *excludes,
                                  const char *dname,
                                  GTimer *timer,
@@ -402,6 +477,9 @@ db_location_walk_tree_recursive (DatabaseLocation *location,
         //warn("can't open %s", dname);
         return WALK_BADIO;
     }
+    // a rescan runs in the background, let searches go first
+    fsearch_thread_pool_yield ();
+
     gulong duration = 0;
     g_timer_elapsed (timer, &duration);
 
@@ -416,6 +494,10 @@ db_location_walk_tree_recursive (DatabaseLocation *location,
     struct dirent *dent = NULL;
     errno = 0;
     while ((dent = readdir (dir))) {
+        if (atomic_load (&db->build_cancelled)) {
+            res = WALK_CANCELLED;
+            break;
+        }
         if (!(spec & WS_DOTFILES) && dent->d_name[0] == '.') {
             // file is dotfile, skip
             continue;
@@ -454,7 +536,8 @@ db_location_walk_tree_recursive (DatabaseLocation *location,
         if (is_dir) {
             /* recursively follow dirs */
             if ((spec & WS_RECURSIVE))
-                db_location_walk_tree_recursive (location,
+                db_location_walk_tree_recursive (db,
+                                                 location,
                                                  excludes,
                                                  fn,
                                                  timer,
@@ -472,23 +555,23 @@ db_location_walk_tree_recursive (DatabaseLocation *location,
 }
 
 static DatabaseLocation *
-db_location_build_tree (const char *dname, void (*callback)(const char *))
+db_location_build_tree (Database *db, const char *dname, void (*callback)(const char *))
 {
     BTreeNode *root = btree_node_new (dname, 0, 0, 0, true);
     DatabaseLocation *location = db_location_new ();
     location->entries = root;
     FsearchConfig *config = fsearch_application_get_config (FSEARCH_APPLICATION_DEFAULT);
 
-    int spec = WS_DEFAULT;
-    if (!config->exclude_hidden_items) {
-        spec |= WS_DOTFILES;
-    }
+    // hidden items are always indexed and only excluded by the search, so
+    // the setting can change without a rescan
+    int spec = WS_DEFAULT | WS_DOTFILES;
     if (config->follow_symlinks) {
         spec |= WS_FOLLOWLINK;
     }
     GTimer *timer = g_timer_new ();
     g_timer_start (timer);
-    uint32_t res = db_location_walk_tree_recursive (location,
+    uint32_t res = db_location_walk_tree_recursive (db,
+                                                    location,
                                                     config->exclude_locations,
                                                     dname,
                                                     timer,
@@ -512,10 +595,18 @@ db_location_new (void)
     return location;
 }
 
+// parents are traversed before their children
+static inline void
+db_node_update_hidden (BTreeNode *node)
+{
+    node->is_hidden = node->name[0] == '.' || (node->parent && node->parent->is_hidden);
+}
+
 bool
 db_list_insert_node (BTreeNode *node, void *data)
 {
     Database *db = data;
+    db_node_update_hidden (node);
     darray_set_item (db->entries, node, node->pos);
     db->num_entries++;
     return true;
@@ -527,13 +618,19 @@ db_traverse_tree_insert (BTreeNode *node, void *data)
     btree_node_traverse (node, db_list_insert_node, data);
 }
 
-static uint32_t temp_index = 0;
+// every build has its own, so several databases can be built at once
+typedef struct {
+    Database *db;
+    uint32_t index;
+} list_add_ctx;
 
 bool
 db_list_add_node (BTreeNode *node, void *data)
 {
-    Database *db = data;
-    darray_set_item (db->entries, node, temp_index++);
+    list_add_ctx *ctx = data;
+    Database *db = ctx->db;
+    db_node_update_hidden (node);
+    darray_set_item (db->entries, node, ctx->index++);
     db->num_entries++;
     return true;
 }
@@ -556,13 +653,13 @@ db_list_insert_location (Database *db, DatabaseLocation *location)
 
 
 static void
-db_list_add_location (Database *db, DatabaseLocation *location)
+db_list_add_location (list_add_ctx *ctx, DatabaseLocation *location)
 {
-    g_assert (db != NULL);
+    g_assert (ctx != NULL);
     g_assert (location != NULL);
     g_assert (location->entries != NULL);
 
-    btree_node_children_foreach (location->entries, db_traverse_tree_add, db);
+    btree_node_children_foreach (location->entries, db_traverse_tree_add, ctx);
 }
 
 static DatabaseLocation *
@@ -686,6 +783,7 @@ db_save_locations (Database *db)
     g_return_val_if_fail (db->locations != NULL, false);
 
     //db_update_sort_index (db);
+    db_read_lock (db);
     GList *locations = db->locations;
     for (GList *l = locations; l != NULL; l = l->next) {
         DatabaseLocation *location = (DatabaseLocation *)l->data;
@@ -693,6 +791,7 @@ db_save_locations (Database *db)
         const char *location_path = root->name;
         db_save_location (db, location_path);
     }
+    db_read_unlock (db);
     return true;
 }
 
@@ -716,29 +815,26 @@ db_location_get_path (const char *location_name)
 bool
 db_location_load (Database *db, const char *location_name)
 {
-    db_lock (db);
-    db->busy = true;
     gchar *load_path = db_location_get_path (location_name);
     if (!load_path) {
-        db->busy = false;
-        db_unlock (db);
         return false;
     }
+    // reading the file doesn't touch the database, only adding the
+    // location to it has to be exclusive
     DatabaseLocation *location = db_location_load_from_file (load_path);
     g_free (load_path);
     load_path = NULL;
 
+    db_lock (db);
     if (location) {
         location->num_items = btree_node_n_nodes (location->entries);
         trace ("number of nodes: %d\n", location->num_items);
         db->locations = g_list_append (db->locations, location);
         db->num_entries += location->num_items;
-        db->busy = false;
         db_update_timestamp (db);
         db_unlock (db);
         return true;
     }
-    db->busy = false;
     db_update_timestamp (db);
     db_unlock (db);
     return false;
@@ -750,11 +846,12 @@ db_location_build_new (Database *db,
                        void (*callback)(const char *))
 {
     g_assert (db != NULL);
-    db_lock (db);
     trace ("load location: %s\n", location_name);
 
-    DatabaseLocation *location = db_location_build_tree (location_name, callback);
+    // the scan can take minutes, so it runs without holding the lock
+    DatabaseLocation *location = db_location_build_tree (db, location_name, callback);
 
+    db_lock (db);
     if (location) {
         trace ("location num entries: %d\n", location->num_items);
         db->locations = g_list_append (db->locations, location);
@@ -796,6 +893,528 @@ db_locations_get_num_entries (Database *db)
     return num_entries;
 }
 
+typedef struct {
+    Database *db;
+    GMutex mutex;
+} char_counts_ctx;
+
+static void
+count_chars (uint32_t start, uint32_t end, gpointer data)
+{
+    char_counts_ctx *ctx = data;
+    Database *db = ctx->db;
+
+    uint32_t char_counts[256] = {0};
+    for (uint32_t i = start; i < end; ++i) {
+        BTreeNode *node = darray_get_item (db->entries, i);
+        if (!node || !node->name) {
+            continue;
+        }
+        // count every byte only once per name
+        uint64_t seen[4] = {0};
+        for (const unsigned char *c = (unsigned char *)node->name; *c != '\0'; c++) {
+            const unsigned char folded = tolower (*c);
+            const uint64_t bit = 1ull << (folded & 63);
+            if (!(seen[folded >> 6] & bit)) {
+                seen[folded >> 6] |= bit;
+                char_counts[folded]++;
+            }
+        }
+    }
+
+    g_mutex_lock (&ctx->mutex);
+    for (uint32_t i = 0; i < 256; i++) {
+        db->char_counts[i] += char_counts[i];
+    }
+    g_mutex_unlock (&ctx->mutex);
+}
+
+static void
+db_update_char_counts (Database *db)
+{
+    g_assert (db != NULL);
+
+    memset (db->char_counts, 0, sizeof (db->char_counts));
+    if (!db->entries) {
+        return;
+    }
+
+    char_counts_ctx ctx = {db};
+    g_mutex_init (&ctx.mutex);
+    fsearch_thread_pool_parallel_for (db->pool, 0, db->num_entries, 16384, count_chars, &ctx);
+    g_mutex_clear (&ctx.mutex);
+}
+
+static void
+db_entry_bitmaps_clear (Database *db)
+{
+    g_assert (db != NULL);
+
+    if (db->folders) {
+        bitmap_free (db->folders);
+        db->folders = NULL;
+    }
+    if (db->hidden) {
+        bitmap_free (db->hidden);
+        db->hidden = NULL;
+    }
+}
+
+static void
+db_update_entry_bitmaps (Database *db)
+{
+    g_assert (db != NULL);
+
+    db_entry_bitmaps_clear (db);
+    if (!db->entries) {
+        return;
+    }
+    db->folders = bitmap_new ();
+    db->hidden = bitmap_new ();
+    for (uint32_t i = 0; i < db->num_entries; ++i) {
+        BTreeNode *node = darray_get_item (db->entries, i);
+        if (!node) {
+            continue;
+        }
+        if (node->is_dir) {
+            bitmap_add (db->folders, i);
+        }
+        if (node->is_hidden) {
+            bitmap_add (db->hidden, i);
+        }
+    }
+}
+
+static void
+db_ext_index_clear (Database *db)
+{
+    g_assert (db != NULL);
+
+    if (db->ext_ids) {
+        g_hash_table_destroy (db->ext_ids);
+        db->ext_ids = NULL;
+    }
+    if (db->ext_names) {
+        g_ptr_array_free (db->ext_names, TRUE);
+        db->ext_names = NULL;
+    }
+    if (db->ext_bitmaps) {
+        g_ptr_array_free (db->ext_bitmaps, TRUE);
+        db->ext_bitmaps = NULL;
+    }
+    db->ext_overflow = false;
+}
+
+static uint16_t
+db_ext_index_intern (Database *db, const char *ext)
+{
+    gpointer value = NULL;
+    if (g_hash_table_lookup_extended (db->ext_ids, ext, NULL, &value)) {
+        return GPOINTER_TO_UINT (value);
+    }
+    if (db->ext_names->len >= DB_EXT_ID_OTHER) {
+        // all ids are taken, the remaining extensions share one
+        db->ext_overflow = true;
+        return DB_EXT_ID_OTHER;
+    }
+    const uint16_t id = db->ext_names->len;
+    char *name = g_strdup (ext);
+    g_ptr_array_add (db->ext_names, name);
+    g_ptr_array_add (db->ext_bitmaps, bitmap_new ());
+    g_hash_table_insert (db->ext_ids, name, GUINT_TO_POINTER (id));
+    return id;
+}
+
+static void
+db_update_ext_index (Database *db)
+{
+    g_assert (db != NULL);
+
+    db_ext_index_clear (db);
+    // names are owned by ext_names
+    db->ext_ids = g_hash_table_new (g_str_hash, g_str_equal);
+    db->ext_names = g_ptr_array_new_with_free_func (g_free);
+    db->ext_bitmaps = g_ptr_array_new_with_free_func ((GDestroyNotify)bitmap_free);
+    if (!db->entries) {
+        return;
+    }
+
+    // reserve the first id for entries without extension
+    db_ext_index_intern (db, "");
+    Bitmap *other = NULL;
+
+    char ext[256] = "";
+    for (uint32_t i = 0; i < db->num_entries; ++i) {
+        BTreeNode *node = darray_get_item (db->entries, i);
+        if (!node) {
+            continue;
+        }
+        uint16_t id = DB_EXT_ID_NONE;
+        const char *dot = node->is_dir ? NULL : strrchr (node->name, '.');
+        // a leading dot marks a hidden file, not an extension
+        if (dot && dot != node->name && strlen (dot + 1) < sizeof (ext)) {
+            uint32_t len = 0;
+            for (const char *c = dot + 1; *c != '\0'; c++) {
+                ext[len++] = tolower (*c);
+            }
+            ext[len] = '\0';
+            id = db_ext_index_intern (db, ext);
+        }
+        node->ext_id = id;
+        if (id == DB_EXT_ID_OTHER) {
+            if (!other) {
+                other = bitmap_new ();
+            }
+            bitmap_add (other, i);
+        }
+        else {
+            bitmap_add (g_ptr_array_index (db->ext_bitmaps, id), i);
+        }
+    }
+    if (other) {
+        g_ptr_array_add (db->ext_bitmaps, other);
+    }
+
+#ifdef DEBUG
+    size_t bitmap_size = 0;
+    for (uint32_t i = 0; i < db->ext_bitmaps->len; i++) {
+        bitmap_size += bitmap_get_memory_usage (g_ptr_array_index (db->ext_bitmaps, i));
+    }
+    trace ("ext index: %d extensions, %zu bytes of bitmaps\n",
+           db->ext_names->len,
+           bitmap_size);
+#endif
+}
+
+bool
+db_lookup_ext_id (Database *db, const char *ext, uint16_t *id)
+{
+    g_assert (db != NULL);
+    g_assert (ext != NULL);
+    g_assert (id != NULL);
+
+    if (!db->ext_ids) {
+        return false;
+    }
+    gchar *folded = g_ascii_strdown (ext, -1);
+    gpointer value = NULL;
+    bool found = g_hash_table_lookup_extended (db->ext_ids, folded, NULL, &value);
+    g_free (folded);
+    if (found) {
+        *id = GPOINTER_TO_UINT (value);
+        return true;
+    }
+    if (db->ext_overflow) {
+        // might be one of the extensions which didn't get an id
+        *id = DB_EXT_ID_OTHER;
+        return true;
+    }
+    return false;
+}
+
+const char *
+db_get_ext_name (Database *db, uint16_t id)
+{
+    g_assert (db != NULL);
+
+    if (!db->ext_names || id >= db->ext_names->len) {
+        return NULL;
+    }
+    return g_ptr_array_index (db->ext_names, id);
+}
+
+Bitmap *
+db_get_ext_bitmap (Database *db, uint16_t id)
+{
+    g_assert (db != NULL);
+
+    if (!db->ext_bitmaps) {
+        return NULL;
+    }
+    if (id == DB_EXT_ID_OTHER) {
+        // stored after all regular ids, if there are any such entries
+        if (!db->ext_overflow) {
+            return NULL;
+        }
+        return g_ptr_array_index (db->ext_bitmaps, db->ext_bitmaps->len - 1);
+    }
+    if (id >= db->ext_names->len) {
+        return NULL;
+    }
+    return g_ptr_array_index (db->ext_bitmaps, id);
+}
+
+Bitmap *
+db_get_folder_bitmap (Database *db)
+{
+    g_assert (db != NULL);
+    return db->folders;
+}
+
+Bitmap *
+db_get_hidden_bitmap (Database *db)
+{
+    g_assert (db != NULL);
+    return db->hidden;
+}
+
+// compares the case folded names byte by byte
+static int
+prefix_compare (const char *a, const char *b)
+{
+    const unsigned char *s1 = (const unsigned char *)a;
+    const unsigned char *s2 = (const unsigned char *)b;
+    while (*s1 != '\0' && g_ascii_tolower (*s1) == g_ascii_tolower (*s2)) {
+        s1++;
+        s2++;
+    }
+    return g_ascii_tolower (*s1) - g_ascii_tolower (*s2);
+}
+
+static int
+sort_by_folded_name (const void *a, const void *b)
+{
+    BTreeNode *node_a = *(BTreeNode **)a;
+    BTreeNode *node_b = *(BTreeNode **)b;
+    int res = prefix_compare (node_a->name, node_b->name);
+    if (res) {
+        return res;
+    }
+    // keep the order stable for names which only differ in case
+    return node_a->pos < node_b->pos ? -1 : node_a->pos > node_b->pos;
+}
+
+static int
+compare_folded_names (const void *a, const void *b, void *data)
+{
+    return sort_by_folded_name (a, b);
+}
+
+static void
+db_prefix_index_clear (Database *db)
+{
+    g_assert (db != NULL);
+
+    if (db->prefix_index) {
+        g_free (db->prefix_index);
+        db->prefix_index = NULL;
+    }
+}
+
+// Restores the index from the positions loaded with the database, returns
+// false if they're missing or don't fit the current entries
+static bool
+db_prefix_index_restore (Database *db)
+{
+    const uint32_t num_entries = db->num_entries;
+    uint32_t *index = db->prefix_index;
+    memset (index, 0xff, num_entries * sizeof (uint32_t));
+
+    for (uint32_t i = 0; i < num_entries; ++i) {
+        BTreeNode *node = darray_get_item (db->entries, i);
+        if (!node
+            || node->prefix_pos >= num_entries
+            || index[node->prefix_pos] != UINT32_MAX) {
+            return false;
+        }
+        index[node->prefix_pos] = i;
+    }
+    for (uint32_t i = 1; i < num_entries; ++i) {
+        BTreeNode *prev = darray_get_item (db->entries, index[i - 1]);
+        BTreeNode *node = darray_get_item (db->entries, index[i]);
+        if (sort_by_folded_name (&prev, &node) > 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void
+db_update_prefix_index (Database *db)
+{
+    g_assert (db != NULL);
+
+    db_prefix_index_clear (db);
+    if (!db->entries || !db->num_entries) {
+        return;
+    }
+    const uint32_t num_entries = db->num_entries;
+    db->prefix_index = g_new (uint32_t, num_entries);
+    if (db_prefix_index_restore (db)) {
+        trace ("prefix index: restored\n");
+        return;
+    }
+
+    BTreeNode **nodes = g_new (BTreeNode *, num_entries);
+    for (uint32_t i = 0; i < num_entries; ++i) {
+        nodes[i] = darray_get_item (db->entries, i);
+        g_assert (nodes[i] != NULL);
+    }
+    fsearch_thread_pool_sort (db->pool,
+                              nodes,
+                              num_entries,
+                              sizeof (BTreeNode *),
+                              compare_folded_names,
+                              NULL);
+    for (uint32_t i = 0; i < num_entries; ++i) {
+        nodes[i]->prefix_pos = i;
+        db->prefix_index[i] = nodes[i]->pos;
+    }
+    g_free (nodes);
+    nodes = NULL;
+    trace ("prefix index: sorted %d entries\n", num_entries);
+}
+
+// like prefix_compare, but only up to the end of prefix
+static int
+prefix_compare_n (const char *name, const char *prefix)
+{
+    const unsigned char *s1 = (const unsigned char *)name;
+    const unsigned char *s2 = (const unsigned char *)prefix;
+    while (*s2 != '\0') {
+        const int res = g_ascii_tolower (*s1) - g_ascii_tolower (*s2);
+        if (res) {
+            return res;
+        }
+        s1++;
+        s2++;
+    }
+    return 0;
+}
+
+Bitmap *
+db_get_prefix_bitmap (Database *db, const char *prefix)
+{
+    g_assert (db != NULL);
+    g_assert (prefix != NULL);
+
+    if (!db->prefix_index) {
+        return NULL;
+    }
+    const uint32_t *index = db->prefix_index;
+
+    // first entry which isn't less than the prefix ...
+    uint32_t lo = 0;
+    uint32_t hi = db->num_entries;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        BTreeNode *node = darray_get_item (db->entries, index[mid]);
+        if (prefix_compare_n (node->name, prefix) < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    const uint32_t first = lo;
+    // ... and the first one after all names starting with it
+    hi = db->num_entries;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        BTreeNode *node = darray_get_item (db->entries, index[mid]);
+        if (prefix_compare_n (node->name, prefix) <= 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    const uint32_t last = lo;
+
+    // the range is ordered by name, not by position
+    return bitmap_new_from_unsorted (index + first, last - first);
+}
+
+void
+db_build_suffix_index (Database *db)
+{
+    g_assert (db != NULL);
+
+    // the index is built while searches can still run, only swapping it
+    // in is exclusive
+    db_read_lock (db);
+    if (!db->entries || !db->num_entries) {
+        db_read_unlock (db);
+        return;
+    }
+    const uint64_t generation = db->generation;
+    const uint32_t num_entries = db->num_entries;
+
+    const gint64 start = g_get_monotonic_time ();
+    SuffixIndex *suffix_index = suffix_index_new (db->entries, num_entries, db->pool);
+    db_read_unlock (db);
+    const gint64 build_time = g_get_monotonic_time () - start;
+
+    if (suffix_index) {
+        trace ("suffix index: %d entries, %.1f MiB, built in %.2f s\n",
+               num_entries,
+               suffix_index_get_memory_usage (suffix_index) / (1024.0 * 1024.0),
+               build_time / (double)G_USEC_PER_SEC);
+    }
+    else {
+        trace ("suffix index: names too large, not built\n");
+    }
+
+    db_lock (db);
+    if (db->generation != generation) {
+        // the entries changed in the meantime, the index doesn't match them
+        trace ("suffix index: entries changed, discarding it\n");
+        if (suffix_index) {
+            suffix_index_free (suffix_index);
+            suffix_index = NULL;
+        }
+        db_unlock (db);
+        return;
+    }
+    if (db->suffix_index) {
+        suffix_index_free (db->suffix_index);
+    }
+    db->suffix_index = suffix_index;
+    db->suffix_index_build_time = suffix_index ? build_time : 0;
+    db_unlock (db);
+}
+
+bool
+db_get_suffix_index_stats (Database *db, size_t *memory_usage, int64_t *build_time)
+{
+    g_assert (db != NULL);
+
+    if (!db->suffix_index) {
+        return false;
+    }
+    if (memory_usage) {
+        *memory_usage = suffix_index_get_memory_usage (db->suffix_index);
+    }
+    if (build_time) {
+        *build_time = db->suffix_index_build_time;
+    }
+    return true;
+}
+
+uint32_t
+db_count_substring (Database *db, const char *needle)
+{
+    g_assert (db != NULL);
+    g_assert (needle != NULL);
+
+    if (!db->suffix_index) {
+        return UINT32_MAX;
+    }
+    return suffix_index_count (db->suffix_index, needle);
+}
+
+Bitmap *
+db_get_substring_bitmap (Database *db, const char *needle)
+{
+    g_assert (db != NULL);
+    g_assert (needle != NULL);
+
+    if (!db->suffix_index) {
+        return NULL;
+    }
+    return suffix_index_locate (db->suffix_index, needle);
+}
+
 void
 db_build_initial_entries_list (Database *db)
 {
@@ -809,12 +1428,17 @@ db_build_initial_entries_list (Database *db)
     db->entries = darray_new (num_entries);
 
     GList *locations = db->locations;
-    temp_index = 0;
+    list_add_ctx ctx = {db, 0};
     for (GList *l = locations; l != NULL; l = l->next) {
-        db_list_add_location (db, l->data);
+        db_list_add_location (&ctx, l->data);
     }
     db_sort (db);
+    darray_distribute (db->entries, db->pool);
     db_update_sort_index (db);
+    db_update_char_counts (db);
+    db_update_entry_bitmaps (db);
+    db_update_ext_index (db);
+    db_update_prefix_index (db);
     db_unlock (db);
 }
 
@@ -834,6 +1458,11 @@ db_update_entries_list (Database *db)
     for (GList *l = locations; l != NULL; l = l->next) {
         db_list_insert_location (db, l->data);
     }
+    darray_distribute (db->entries, db->pool);
+    db_update_char_counts (db);
+    db_update_entry_bitmaps (db);
+    db_update_ext_index (db);
+    db_update_prefix_index (db);
     db_unlock (db);
 }
 
@@ -845,10 +1474,13 @@ db_location_get_entries (DatabaseLocation *location)
 }
 
 Database *
-db_database_new ()
+db_database_new (FsearchThreadPool *pool)
 {
     Database *db = g_new0 (Database, 1);
-    g_mutex_init (&db->mutex);
+    db->pool = pool;
+    db->ref_count = 1;
+    db->generation = db_next_generation ();
+    g_rw_lock_init (&db->lock);
     return db;
 }
 
@@ -863,6 +1495,14 @@ db_entries_clear (Database *db)
         db->entries = NULL;
     }
     db->num_entries = 0;
+    db_entry_bitmaps_clear (db);
+    db_ext_index_clear (db);
+    db_prefix_index_clear (db);
+    if (db->suffix_index) {
+        suffix_index_free (db->suffix_index);
+        db->suffix_index = NULL;
+    }
+    db->generation = db_next_generation ();
 }
 
 void
@@ -871,7 +1511,7 @@ db_free (Database *db)
     g_assert (db != NULL);
 
     db_entries_clear (db);
-    g_mutex_clear (&db->mutex);
+    g_rw_lock_clear (&db->lock);
     g_free (db);
     db = NULL;
     return;
@@ -884,6 +1524,13 @@ db_get_timestamp (Database *db)
     return db->timestamp;
 }
 
+uint64_t
+db_get_generation (Database *db)
+{
+    g_assert (db != NULL);
+    return db->generation;
+}
+
 uint32_t
 db_get_num_entries (Database *db)
 {
@@ -891,27 +1538,90 @@ db_get_num_entries (Database *db)
     return db->num_entries;
 }
 
+uint32_t
+db_get_char_count (Database *db, unsigned char c)
+{
+    g_assert (db != NULL);
+    return db->char_counts[tolower (c)];
+}
+
 void
 db_unlock (Database *db)
 {
     g_assert (db != NULL);
-    g_mutex_unlock (&db->mutex);
+    g_rw_lock_writer_unlock (&db->lock);
 }
 
 void
 db_lock (Database *db)
 {
     g_assert (db != NULL);
-    g_mutex_lock (&db->mutex);
+#ifdef DEBUG
+    if (!g_rw_lock_writer_trylock (&db->lock)) {
+        const gint64 start = g_get_monotonic_time ();
+        g_rw_lock_writer_lock (&db->lock);
+        atomic_fetch_add (&db->num_write_waits, 1);
+        atomic_fetch_add (&db->write_wait_time, g_get_monotonic_time () - start);
+    }
+    atomic_fetch_add (&db->num_writes, 1);
+#else
+    g_rw_lock_writer_lock (&db->lock);
+#endif
 }
 
 bool
 db_try_lock (Database *db)
 {
     g_assert (db != NULL);
-    return g_mutex_trylock (&db->mutex);
+    if (!g_rw_lock_writer_trylock (&db->lock)) {
+        return false;
+    }
+#ifdef DEBUG
+    atomic_fetch_add (&db->num_writes, 1);
+#endif
+    return true;
 }
 
+void
+db_read_unlock (Database *db)
+{
+    g_assert (db != NULL);
+    g_rw_lock_reader_unlock (&db->lock);
+}
+
+void
+db_read_lock (Database *db)
+{
+    g_assert (db != NULL);
+#ifdef DEBUG
+    if (!g_rw_lock_reader_trylock (&db->lock)) {
+        const gint64 start = g_get_monotonic_time ();
+        g_rw_lock_reader_lock (&db->lock);
+        atomic_fetch_add (&db->num_read_waits, 1);
+        atomic_fetch_add (&db->read_wait_time, g_get_monotonic_time () - start);
+    }
+    atomic_fetch_add (&db->num_reads, 1);
+#else
+    g_rw_lock_reader_lock (&db->lock);
+#endif
+}
+
+#ifdef DEBUG
+void
+db_get_lock_stats (Database *db, DatabaseLockStats *stats)
+{
+    g_assert (db != NULL);
+    g_assert (stats != NULL);
+
+    stats->num_reads = atomic_load (&db->num_reads);
+    stats->num_read_waits = atomic_load (&db->num_read_waits);
+    stats->read_wait_time = atomic_load (&db->read_wait_time);
+    stats->num_writes = atomic_load (&db->num_writes);
+    stats->num_write_waits = atomic_load (&db->num_write_waits);
+    stats->write_wait_time = atomic_load (&db->write_wait_time);
+}
+#endif
+
 DynamicArray *
 db_get_entries (Database *db)
 {
@@ -961,7 +1671,8 @@ db_sort (Database *db)
     g_assert (db->entries != NULL);
 
     trace ("start sorting\n");
-    darray_sort (db->entries, sort_by_name);
+    darray_sort_multi_threaded (db->entries, sort_by_name, db->pool);
+    db->generation = db_next_generation ();
     trace ("finished sorting\n");
 }
 
@@ -992,3 +1703,39 @@ db_clear (Database *db)
     return true;
 }
 
+Database *
+db_ref (Database *db)
+{
+    g_assert (db != NULL);
+    g_atomic_int_inc (&db->ref_count);
+    return db;
+}
+
+void
+db_unref (Database *db)
+{
+    g_assert (db != NULL);
+    if (!g_atomic_int_dec_and_test (&db->ref_count)) {
+        return;
+    }
+    trace ("free database snapshot\n");
+    if (db->locations) {
+        db_location_free_all (db);
+    }
+    db_free (db);
+}
+
+void
+db_cancel_build (Database *db)
+{
+    g_assert (db != NULL);
+    atomic_store (&db->build_cancelled, true);
+}
+
+bool
+db_build_is_cancelled (Database *db)
+{
+    g_assert (db != NULL);
+    return atomic_load (&db->build_cancelled);
+}
+
@@ -23,9 +23,15 @@
 #include <stdbool.h>
 #include "array.h"
 #include "btree.h"
+#include "bitmap.h"
 
 typedef struct _Database Database;
 
+// extension id of folders and files without an extension
+#define DB_EXT_ID_NONE 0
+// shared by all extensions once the dictionary is full
+#define DB_EXT_ID_OTHER UINT16_MAX
+
 typedef struct _DatabaseLocation DatabaseLocation;
 
 void
@@ -51,8 +57,26 @@ db_location_get_entries (DatabaseLocation *location);
 void
 db_free (Database *db);
 
+// the new database has a reference count of one
+Database *
+db_database_new (FsearchThreadPool *pool);
+
+// Once a database is built it isn't modified anymore, a rebuild builds a
+// new one instead. Searches take a reference on the database they run
+// on, so it stays alive until the last of them is done with it.
 Database *
-db_database_new ();
+db_ref (Database *db);
+
+void
+db_unref (Database *db);
+
+// stops the scans of a database which is still being built, they fail
+// once they notice it
+void
+db_cancel_build (Database *db);
+
+bool
+db_build_is_cancelled (Database *db);
 
 gboolean
 db_list_append_node (BTreeNode *node,
@@ -73,9 +97,62 @@ db_build_initial_entries_list (Database *db);
 time_t
 db_get_timestamp (Database *db);
 
+// changes whenever the entries of the database change
+uint64_t
+db_get_generation (Database *db);
+
 uint32_t
 db_get_num_entries (Database *db);
 
+// number of entries whose name contains c, ignoring case
+uint32_t
+db_get_char_count (Database *db, unsigned char c);
+
+// looks up the id of a file extension (without the dot), ignoring case
+bool
+db_lookup_ext_id (Database *db, const char *ext, uint16_t *id);
+
+const char *
+db_get_ext_name (Database *db, uint16_t id);
+
+// bitmap of the positions of all entries with the given extension id
+Bitmap *
+db_get_ext_bitmap (Database *db, uint16_t id);
+
+// bitmap of the positions of all folders, NULL if there are no entries
+Bitmap *
+db_get_folder_bitmap (Database *db);
+
+// bitmap of the positions of all entries which are hidden themselves or
+// inside a hidden folder, NULL if there are no entries
+Bitmap *
+db_get_hidden_bitmap (Database *db);
+
+// bitmap of the positions of all entries whose name starts with prefix,
+// ignoring (ASCII) case; NULL if the database has no prefix index
+Bitmap *
+db_get_prefix_bitmap (Database *db, const char *prefix);
+
+// builds the optional suffix index over all names
+void
+db_build_suffix_index (Database *db);
+
+// the memory the suffix index takes in bytes and the time it took to build
+// in microseconds, returns false if there's none
+bool
+db_get_suffix_index_stats (Database *db, size_t *memory_usage, int64_t *build_time);
+
+// number of occurrences of needle in all names, ignoring case, or
+// UINT32_MAX if there's no suffix index
+uint32_t
+db_count_substring (Database *db, const char *needle);
+
+// bitmap of the positions of all entries whose name contains needle,
+// ignoring case; NULL if there's no suffix index
+Bitmap *
+db_get_substring_bitmap (Database *db, const char *needle);
+
+// exclusive access, for changing the database
 void
 db_unlock (Database *db);
 
@@ -85,6 +162,31 @@ db_lock (Database *db);
 bool
 db_try_lock (Database *db);
 
+// shared access, any number of searches can read the database at once
+void
+db_read_unlock (Database *db);
+
+void
+db_read_lock (Database *db);
+
+#ifdef DEBUG
+// only counted in debug builds
+typedef struct
+{
+    uint64_t num_reads;
+    // how often a reader had to wait for a writer
+    uint64_t num_read_waits;
+    // total time readers spent waiting in microseconds
+    int64_t read_wait_time;
+    uint64_t num_writes;
+    uint64_t num_write_waits;
+    int64_t write_wait_time;
+} DatabaseLockStats;
+
+void
+db_get_lock_stats (Database *db, DatabaseLockStats *stats);
+#endif
+
 DynamicArray *
 db_get_entries (Database *db);
 
@@ -22,22 +22,46 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include <assert.h>
 #include <ctype.h>
+#include <stdatomic.h>
 #include <pcre.h>
 
 #include "database_search.h"
 #include "fsearch_window.h"
 #include "string_utils.h"
 #include "query.h"
+#include "predicate.h"
+#include "fuzzy.h"
+#include "top_k.h"
+#include "regex_literals.h"
+#include "aho_corasick.h"
+#include "result_cache.h"
 #include "debug.h"
 
 #define OVECCOUNT 3
+#define JIT_STACK_START_SIZE (32 * 1024)
+#define JIT_STACK_MAX_SIZE (512 * 1024)
+
+// The search loops are written once as inline functions and instantiated
+// for every combination of the flags they test per entry, so those tests
+// are folded into straight code. The instance is picked once per search.
+#define SEARCH_KERNEL_INLINE static inline __attribute__ ((always_inline))
+
+#define SEARCH_JOBS_PER_THREAD 4
+
+// progressive searches deliver their first results once they run that
+// long, and further ones at most that often
+#define PROGRESSIVE_RESULTS_DELAY (50 * G_TIME_SPAN_MILLISECOND)
+#define PROGRESSIVE_RESULTS_INTERVAL (100 * G_TIME_SPAN_MILLISECOND)
 
 struct _DatabaseSearchEntry
 {
     BTreeNode *node;
     uint32_t pos;
+    // relevance, only set for ranked results
+    int32_t score;
 };
 
 typedef struct search_query_s {
@@ -45,24 +69,160 @@ typedef struct search_query_s {
     size_t query_len;
     uint32_t has_uppercase;
     uint32_t has_separator;
+    // entries whose signature lacks any of these bits can't match the term
+    uint64_t signature;
+    // term has to be matched against the full path
+    bool needs_path;
+    // estimated fraction of entries which match the term
+    double selectivity;
+    // terms joined with | belong to the same group
+    uint32_t group;
+    // term was prefixed with !
+    bool negated;
     //uint32_t found;
 } search_query_t;
 
+typedef struct search_regex_s {
+    pcre *regex;
+    pcre_extra *extra;
+    // literals every match must contain, used to skip most candidates
+    // without running the regex engine; NULL if there are none
+    RegexLiterals *literals;
+    bool has_jit;
+} search_regex_t;
+
+// Terms are combined like "a b|!c", which means a AND (b OR NOT c). Every
+// group is a mask of terms of which at least one must be found, or one of
+// its negated terms must be missing.
+typedef struct search_group_s {
+    uint64_t terms;
+    uint64_t negated_terms;
+} search_group_t;
+
+typedef struct search_matcher_s {
+    search_group_t *groups;
+    uint32_t num_groups;
+    // finds all terms which are matched against the name in a single pass
+    AhoCorasick *name_automaton;
+    // and those which need the full path, NULL if there are none
+    AhoCorasick *path_automaton;
+    uint64_t path_terms;
+    // combined signatures of the terms every match must contain
+    uint64_t name_signature;
+    uint64_t path_signature;
+    // length of the longest term every name must contain
+    uint32_t name_min_len;
+} search_matcher_t;
+
+typedef struct search_waiter_s {
+    void (*callback)(void *);
+    void *callback_data;
+    // results of a progressive search the window got already
+    uint32_t num_delivered;
+} search_waiter_t;
+
+// A search as it is queued and run by the service
+typedef struct search_job_s {
+    FsearchThreadPool *pool;
+    DatabaseSearchService *service;
+    // deliver results while the search is still running
+    bool progressive;
+    // the database as it was when the search was queued
+    Database *db;
+    DynamicArray *entries;
+    uint32_t num_entries;
+    uint64_t generation;
+    // the query of the window which queued the job first
+    FsearchQuery *query;
+    // normalized query and flags, jobs with the same key and database give
+    // the same results
+    char *key;
+    // the windows waiting for the results
+    GPtrArray *waiters;
+    // collect all matches of the search in matches, for the result cache
+    bool collect_matches;
+    Bitmap *matches;
+    // matches of a cached query this one narrows down, owned by the cache
+    const Bitmap *refine;
+    // set once no window waits for the results anymore, the workers stop
+    // and the results are thrown away
+    atomic_bool cancelled;
+} search_job_t;
+
+struct _DatabaseSearchService {
+    FsearchThreadPool *pool;
+
+    GThread *thread;
+    bool terminate;
+    GMutex mutex;
+    GCond start_cond;
+    // pending jobs in the order they were queued
+    GQueue jobs;
+    // windows may still join the running job
+    search_job_t *running;
+
+    // results of recent queries, only accessed by the search thread
+    ResultCache *cache;
+    Database *cache_db;
+    uint64_t cache_generation;
+    // budget of the cache in bytes, applied by the search thread
+    size_t cache_size;
+    bool progressive;
+};
+
+// lets the search thread wait for the chunks of a progressive search in
+// database order
+typedef struct search_progress_s {
+    GMutex mutex;
+    GCond done_cond;
+} search_progress_t;
+
 typedef struct search_context_s {
-    DatabaseSearch *search;
+    search_job_t *search;
     BTreeNode **results;
     search_query_t **queries;
+    search_regex_t *regex;
+    // NULL if the query has no filter predicates
+    PredicateProgram *predicates;
+    // positions of the entries which can match, NULL if all can
+    Bitmap *candidates;
+    // set for queries with several terms or | and ! operators
+    search_matcher_t *matcher;
+    // fuzzy mode: one pattern per query and the best matches of this thread
+    FuzzyPattern **fuzzy;
+    TopK *top_k;
+    // every thread needs its own jit stack, the compiled pattern is shared
+    pcre_jit_stack *jit_stack;
     uint32_t num_queries;
+    // the results buffer holds at most max_results, past that the matches
+    // are only counted
     uint32_t num_results;
+    uint32_t num_matched_folders;
+    uint32_t num_matched_files;
+    // all matches of the chunk, only collected if the job keeps them
+    Bitmap *matches;
     uint32_t start_pos;
     uint32_t end_pos;
+    // progressive searches run the loop through search_chunk_run
+    ThreadFunc thread_func;
+    search_progress_t *progress;
+    bool done;
 } search_thread_context_t;
 
+// the search loops only look at the cancel flag every that many entries
+#define SEARCH_CANCEL_CHECK_INTERVAL 4096
+
+static inline bool
+search_job_is_cancelled (search_job_t *job)
+{
+    return atomic_load_explicit (&job->cancelled, memory_order_relaxed);
+}
+
 static DatabaseSearchResult *
-db_perform_normal_search (DatabaseSearch *search, FsearchQuery *q);
+db_perform_normal_search (search_job_t *search);
 
 static DatabaseSearchResult *
-db_perform_empty_search (DatabaseSearch *search);
+db_perform_empty_search (search_job_t *search);
 
 DatabaseSearchEntry *
 db_search_entry_new (BTreeNode *node, uint32_t pos);
@@ -85,52 +245,631 @@ query_is_empty (const char *s)
     return 1;
 }
 
-static gpointer
-fsearch_search_thread (gpointer user_data)
+static char *
+search_key_new (FsearchQuery *q)
 {
-    DatabaseSearch *search = user_data;
+    GString *key = g_string_new (NULL);
+    g_string_append_printf (key,
+                            "%d%d%d%d%d%d%d%d:%d:%u:",
+                            q->hide_results,
+                            q->match_case,
+                            q->enable_regex,
+                            q->enable_fuzzy,
+                            q->rank_by_relevance,
+                            q->search_in_path,
+                            q->auto_search_in_path,
+                            q->exclude_hidden,
+                            q->filter,
+                            q->max_results);
+
+    // leading and trailing whitespace is ignored by all search modes, runs
+    // of spaces only separate terms unless the query is a regex
+    char *text = g_strstrip (g_strdup (q->query ? q->query : ""));
+    for (const char *c = text; *c != '\0'; c++) {
+        if (*c == ' ' && c[1] == ' ' && !q->enable_regex) {
+            continue;
+        }
+        g_string_append_c (key, *c);
+    }
+    g_free (text);
+    text = NULL;
 
-    g_mutex_lock (&search->query_mutex);
-    while (true) {
-        g_cond_wait (&search->search_thread_start_cond, &search->query_mutex);
-        if (search->search_thread_terminate) {
-            break;
+    return g_string_free (key, FALSE);
+}
+
+// takes ownership of matches
+static CachedResult *
+cached_result_new_from_result (DatabaseSearchResult *result, Bitmap *matches)
+{
+    GPtrArray *results = result->results;
+    CachedResult *cached = cached_result_new (results->len, result->ranked, matches);
+    for (uint32_t i = 0; i < results->len && cached->positions; i++) {
+        DatabaseSearchEntry *entry = g_ptr_array_index (results, i);
+        cached->positions[i] = entry->node->pos;
+        if (cached->scores) {
+            cached->scores[i] = entry->score;
         }
-        while (true) {
-            FsearchQuery *query = search->query_ctx;
-            if (!query) {
-                break;
+    }
+    cached->num_folders = result->num_folders;
+    cached->num_files = result->num_files;
+    cached->num_matched_folders = result->num_matched_folders;
+    cached->num_matched_files = result->num_matched_files;
+    return cached;
+}
+
+static DatabaseSearchResult *
+db_search_result_new_from_cache (search_job_t *search, CachedResult *cached)
+{
+    GPtrArray *results = g_ptr_array_sized_new (cached->num_results);
+    g_ptr_array_set_free_func (results, (GDestroyNotify)db_search_entry_free);
+    if (cached->positions) {
+        for (uint32_t i = 0; i < cached->num_results; i++) {
+            BTreeNode *node = darray_get_item (search->entries, cached->positions[i]);
+            DatabaseSearchEntry *entry = db_search_entry_new (node, i);
+            if (cached->scores) {
+                entry->score = cached->scores[i];
             }
-            search->query_ctx = NULL;
-            g_mutex_unlock (&search->query_mutex);
-            // if query is empty string we are done here
-            DatabaseSearchResult *result = NULL;
-            if (query_is_empty (query->query)) {
-                if (!search->hide_results) {
-                    result = db_perform_empty_search (search);
-                }
-                else {
-                    result = calloc (1, sizeof (DatabaseSearchResult));
-                }
+            g_ptr_array_add (results, entry);
+        }
+    }
+    else {
+        // unranked results are the first matches in database order
+        BitmapIter iter;
+        bitmap_iter_init (&iter, cached->matches, 0);
+        uint32_t pos = 0;
+        for (uint32_t i = 0; i < cached->num_results && bitmap_iter_next (&iter, &pos); i++) {
+            BTreeNode *node = darray_get_item (search->entries, pos);
+            g_ptr_array_add (results, db_search_entry_new (node, i));
+        }
+    }
+
+    DatabaseSearchResult *result_ctx = calloc (1, sizeof (DatabaseSearchResult));
+    assert (result_ctx != NULL);
+    result_ctx->results = results;
+    result_ctx->num_folders = cached->num_folders;
+    result_ctx->num_files = cached->num_files;
+    result_ctx->num_matched_folders = cached->num_matched_folders;
+    result_ctx->num_matched_files = cached->num_matched_files;
+    result_ctx->ranked = cached->ranked;
+    return result_ctx;
+}
+
+// copies the results starting at from, the copy continues the results
+// before that if there are any
+static DatabaseSearchResult *
+db_search_result_copy_from (DatabaseSearchResult *result, uint32_t from)
+{
+    DatabaseSearchResult *copy = calloc (1, sizeof (DatabaseSearchResult));
+    assert (copy != NULL);
+    *copy = *result;
+    if (result->db) {
+        copy->db = db_ref (result->db);
+    }
+    copy->error_message = g_strdup (result->error_message);
+    copy->append = from > 0;
+    if (result->results) {
+        assert (from <= result->results->len);
+        copy->results = g_ptr_array_sized_new (result->results->len - from);
+        g_ptr_array_set_free_func (copy->results, (GDestroyNotify)db_search_entry_free);
+        for (uint32_t i = from; i < result->results->len; i++) {
+            DatabaseSearchEntry *entry = g_ptr_array_index (result->results, i);
+            DatabaseSearchEntry *entry_copy = db_search_entry_new (entry->node, entry->pos);
+            entry_copy->score = entry->score;
+            g_ptr_array_add (copy->results, entry_copy);
+        }
+    }
+    return copy;
+}
+
+static DatabaseSearchResult *
+db_search_result_copy (DatabaseSearchResult *result)
+{
+    return db_search_result_copy_from (result, 0);
+}
+
+static void
+db_search_result_free (DatabaseSearchResult *result)
+{
+    if (!result) {
+        return;
+    }
+    if (result->results) {
+        g_ptr_array_free (result->results, TRUE);
+        result->results = NULL;
+    }
+    if (result->error_message) {
+        g_free (result->error_message);
+        result->error_message = NULL;
+    }
+    if (result->db) {
+        db_unref (result->db);
+        result->db = NULL;
+    }
+    free (result);
+    result = NULL;
+}
+
+// the text of a search key, after the flags, filter and max_results
+static const char *
+search_key_get_text (const char *key)
+{
+    const char *text = key;
+    for (uint32_t i = 0; i < 3; i++) {
+        text = strchr (text, ':') + 1;
+    }
+    return text;
+}
+
+// Adding text to plain terms can only remove matches, so a query whose
+// text contains that of another one only matches a subset of its matches.
+// Regex, fuzzy, the | and ! operators and predicates don't work like that,
+// neither do terms which switch to the path once they contain a /.
+static bool
+search_query_can_refine (FsearchQuery *q)
+{
+    if (!q->query || q->enable_regex || q->enable_fuzzy) {
+        return false;
+    }
+    if (strpbrk (q->query, "|!:")) {
+        return false;
+    }
+    if (q->auto_search_in_path && !q->search_in_path && strchr (q->query, '/')) {
+        return false;
+    }
+    return true;
+}
+
+static bool
+cached_result_contains_matches (const char *key, CachedResult *cached, void *data)
+{
+    const char *new_key = data;
+    if (!cached->matches) {
+        return false;
+    }
+    // the flags and filter have to be the same, max_results doesn't limit
+    // the collected matches
+    const char *max_results = strchr (strchr (key, ':') + 1, ':');
+    const size_t len = max_results - key + 1;
+    if (strncmp (key, new_key, len)) {
+        return false;
+    }
+    const char *text = search_key_get_text (key);
+    return *text != '\0' && strstr (search_key_get_text (new_key), text);
+}
+
+static DatabaseSearchResult *
+db_perform_cached_search (DatabaseSearchService *service, search_job_t *search)
+{
+    assert (service != NULL);
+    assert (search != NULL);
+
+    if (service->cache->budget == 0) {
+        return db_perform_normal_search (search);
+    }
+
+    // cached positions are only valid for the entries they were taken from
+    if (service->cache_db != search->db || service->cache_generation != search->generation) {
+        result_cache_clear (service->cache);
+        service->cache_db = search->db;
+        service->cache_generation = search->generation;
+    }
+
+    CachedResult *cached = result_cache_lookup (service->cache, search->key);
+    if (cached) {
+        trace ("result cache: hit for \"%s\"\n", search->key);
+        return db_search_result_new_from_cache (search, cached);
+    }
+
+    // most queries are typed one character at a time, only the matches of
+    // the previous one have to be searched then
+    if (search_query_can_refine (search->query)) {
+        cached = result_cache_find (service->cache, cached_result_contains_matches, search->key);
+        if (cached) {
+            trace ("result cache: refining %d matches\n",
+                   bitmap_get_cardinality (cached->matches));
+            search->refine = cached->matches;
+        }
+    }
+
+    search->collect_matches = true;
+    DatabaseSearchResult *result = db_perform_normal_search (search);
+    search->refine = NULL;
+    // a cancelled search stopped early, its results are incomplete
+    if (!result->error_message && result->results && !search_job_is_cancelled (search)) {
+        Bitmap *matches = search->matches;
+        search->matches = NULL;
+        result_cache_insert (service->cache,
+                             search->key,
+                             cached_result_new_from_result (result, matches));
+    }
+    return result;
+}
+
+// the job holds a reference on the database, so its entries stay valid
+// even if a rebuild publishes a new one in the meantime
+static search_job_t *
+search_job_new (DatabaseSearchService *service, FsearchQuery *query)
+{
+    search_job_t *job = calloc (1, sizeof (search_job_t));
+    assert (job != NULL);
+
+    job->pool = service->pool;
+    job->service = service;
+    job->db = db_ref (query->db);
+    job->entries = db_get_entries (query->db);
+    job->num_entries = db_get_num_entries (query->db);
+    job->generation = db_get_generation (query->db);
+    job->query = query;
+    job->key = search_key_new (query);
+    job->waiters = g_ptr_array_new_with_free_func (g_free);
+    return job;
+}
+
+static void
+search_job_free (search_job_t *job)
+{
+    if (!job) {
+        return;
+    }
+    if (job->query) {
+        fsearch_query_free (job->query);
+        job->query = NULL;
+    }
+    if (job->key) {
+        g_free (job->key);
+        job->key = NULL;
+    }
+    if (job->waiters) {
+        g_ptr_array_free (job->waiters, TRUE);
+        job->waiters = NULL;
+    }
+    if (job->matches) {
+        bitmap_free (job->matches);
+        job->matches = NULL;
+    }
+    if (job->db) {
+        db_unref (job->db);
+        job->db = NULL;
+    }
+    free (job);
+    job = NULL;
+}
+
+static bool
+search_job_equal (search_job_t *a, search_job_t *b)
+{
+    return a->db == b->db
+        && a->generation == b->generation
+        && !strcmp (a->key, b->key);
+}
+
+static void
+search_job_add_waiter (search_job_t *job, void (*callback)(void *), void *callback_data)
+{
+    for (uint32_t i = 0; i < job->waiters->len; i++) {
+        search_waiter_t *waiter = g_ptr_array_index (job->waiters, i);
+        if (waiter->callback_data == callback_data) {
+            return;
+        }
+    }
+    search_waiter_t *waiter = g_new0 (search_waiter_t, 1);
+    waiter->callback = callback;
+    waiter->callback_data = callback_data;
+    g_ptr_array_add (job->waiters, waiter);
+}
+
+static void
+search_job_remove_waiter (search_job_t *job, void *callback_data)
+{
+    for (uint32_t i = 0; i < job->waiters->len; i++) {
+        search_waiter_t *waiter = g_ptr_array_index (job->waiters, i);
+        if (waiter->callback_data == callback_data) {
+            g_ptr_array_remove_index (job->waiters, i);
+            return;
+        }
+    }
+}
+
+// every waiter gets its own copy of the results, windows sort and remove
+// entries independently
+static void
+search_job_deliver (search_job_t *job, DatabaseSearchResult *result)
+{
+    const uint32_t num_waiters = job->waiters->len;
+    if (num_waiters == 0) {
+        db_search_result_free (result);
+        return;
+    }
+    if (num_waiters > 1) {
+        trace ("search service: %d windows share the results of \"%s\"\n", num_waiters, job->key);
+    }
+    bool handed_off = false;
+    for (uint32_t i = 0; i < num_waiters; i++) {
+        search_waiter_t *waiter = g_ptr_array_index (job->waiters, i);
+        DatabaseSearchResult *waiter_result = NULL;
+        if (waiter->num_delivered > 0 && result->results) {
+            // only the rest of the results of a progressive search
+            waiter_result = db_search_result_copy_from (result, waiter->num_delivered);
+        }
+        else if (i == num_waiters - 1) {
+            // the original goes last, the callback may hand it to another thread
+            waiter_result = result;
+            handed_off = true;
+        }
+        else {
+            waiter_result = db_search_result_copy (result);
+        }
+        waiter_result->cb_data = waiter->callback_data;
+        waiter->callback (waiter_result);
+    }
+    if (!handed_off) {
+        db_search_result_free (result);
+    }
+}
+
+// hands the results a progressive search found so far to the waiters, each
+// one gets those it doesn't have yet
+static void
+search_job_publish (search_job_t *job,
+                    GPtrArray *results,
+                    uint32_t num_folders,
+                    uint32_t num_files,
+                    uint32_t num_matched_folders,
+                    uint32_t num_matched_files)
+{
+    DatabaseSearchResult progress = {0};
+    progress.results = results;
+    progress.db = job->db;
+    progress.num_folders = num_folders;
+    progress.num_files = num_files;
+    progress.num_matched_folders = num_matched_folders;
+    progress.num_matched_files = num_matched_files;
+    progress.partial = true;
+
+    g_mutex_lock (&job->service->mutex);
+    for (uint32_t i = 0; i < job->waiters->len; i++) {
+        search_waiter_t *waiter = g_ptr_array_index (job->waiters, i);
+        if (waiter->num_delivered == results->len) {
+            continue;
+        }
+        DatabaseSearchResult *waiter_result = db_search_result_copy_from (&progress, waiter->num_delivered);
+        waiter_result->cb_data = waiter->callback_data;
+        waiter->num_delivered = results->len;
+        waiter->callback (waiter_result);
+    }
+    g_mutex_unlock (&job->service->mutex);
+}
+
+// must be called with the service mutex held
+static void
+db_search_service_remove_waiter (DatabaseSearchService *service,
+                                 void *callback_data,
+                                 bool include_running)
+{
+    GList *l = service->jobs.head;
+    while (l) {
+        GList *next = l->next;
+        search_job_t *job = l->data;
+        search_job_remove_waiter (job, callback_data);
+        if (job->waiters->len == 0) {
+            g_queue_delete_link (&service->jobs, l);
+            search_job_free (job);
+        }
+        l = next;
+    }
+    if (include_running && service->running) {
+        search_job_remove_waiter (service->running, callback_data);
+        if (service->running->waiters->len == 0) {
+            // nobody wants the results anymore
+            atomic_store (&service->running->cancelled, true);
+        }
+    }
+}
+
+static void
+db_search_service_queue (DatabaseSearchService *service, FsearchQuery *query)
+{
+    assert (service != NULL);
+    assert (query != NULL);
+
+    search_job_t *job = search_job_new (service, query);
+    void (*callback)(void *) = query->callback;
+    void *callback_data = query->callback_data;
+
+    g_mutex_lock (&service->mutex);
+    // the window keeps waiting for the running search only if it gives the
+    // same results as the new query
+    search_job_t *same = NULL;
+    if (service->running
+        && !search_job_is_cancelled (service->running)
+        && search_job_equal (service->running, job)) {
+        same = service->running;
+    }
+    // the new query supersedes the pending and running ones of the same
+    // window, which also moves the window to the end of the queue
+    db_search_service_remove_waiter (service, callback_data, same == NULL);
+
+    for (GList *l = service->jobs.head; l && !same; l = l->next) {
+        if (search_job_equal (l->data, job)) {
+            same = l->data;
+        }
+    }
+    if (same) {
+        search_job_add_waiter (same, callback, callback_data);
+        search_job_free (job);
+        job = NULL;
+    }
+    else {
+        search_job_add_waiter (job, callback, callback_data);
+        g_queue_push_tail (&service->jobs, job);
+        g_cond_signal (&service->start_cond);
+    }
+    g_mutex_unlock (&service->mutex);
+}
+
+static gpointer
+db_search_service_thread (gpointer user_data)
+{
+    DatabaseSearchService *service = user_data;
+
+    g_mutex_lock (&service->mutex);
+    while (!service->terminate) {
+        search_job_t *job = g_queue_pop_head (&service->jobs);
+        if (!job) {
+            g_cond_wait (&service->start_cond, &service->mutex);
+            continue;
+        }
+        service->running = job;
+        job->progressive = service->progressive;
+        const size_t cache_size = service->cache_size;
+        g_mutex_unlock (&service->mutex);
+
+        result_cache_set_budget (service->cache, cache_size);
+        // published databases aren't modified, so this only waits while
+        // one is changed in place
+        db_read_lock (job->db);
+        const int64_t start_time = g_get_monotonic_time ();
+        // if query is empty string we are done here
+        DatabaseSearchResult *result = NULL;
+        if (query_is_empty (job->query->query)) {
+            if (!job->query->hide_results) {
+                result = db_perform_empty_search (job);
             }
             else {
-                result = db_perform_normal_search (search, query);
+                result = calloc (1, sizeof (DatabaseSearchResult));
             }
-            result->cb_data = query->callback_data;
-            query->callback (result);
-            fsearch_query_free (query);
-            g_mutex_lock (&search->query_mutex);
         }
+        else {
+            result = db_perform_cached_search (service, job);
+        }
+        result->search_time = g_get_monotonic_time () - start_time;
+        result->db = db_ref (job->db);
+        db_read_unlock (job->db);
+#ifdef DEBUG
+        DatabaseLockStats lock_stats = {0};
+        db_get_lock_stats (job->db, &lock_stats);
+        if (lock_stats.num_read_waits) {
+            trace ("search service: waited for the database lock %lu of %lu times, %ld ms in total\n",
+                   (unsigned long)lock_stats.num_read_waits,
+                   (unsigned long)lock_stats.num_reads,
+                   (long)(lock_stats.read_wait_time / 1000));
+        }
+#endif
+
+        // callbacks are only invoked with the mutex held, so none is
+        // invoked once a window has cancelled its search
+        g_mutex_lock (&service->mutex);
+        service->running = NULL;
+        search_job_deliver (job, result);
+        search_job_free (job);
+        job = NULL;
+    }
+    g_mutex_unlock (&service->mutex);
+    return NULL;
+}
+
+DatabaseSearchService *
+db_search_service_new (FsearchThreadPool *pool)
+{
+    DatabaseSearchService *service = calloc (1, sizeof (DatabaseSearchService));
+    assert (service != NULL);
+
+    service->pool = pool;
+    service->terminate = false;
+    g_mutex_init (&service->mutex);
+    g_cond_init (&service->start_cond);
+    g_queue_init (&service->jobs);
+    service->running = NULL;
+    service->cache = result_cache_new (0);
+    service->thread = g_thread_new ("fsearch_search_thread", db_search_service_thread, service);
+    return service;
+}
+
+void
+db_search_service_free (DatabaseSearchService *service)
+{
+    if (!service) {
+        return;
+    }
+
+    g_mutex_lock (&service->mutex);
+    service->terminate = true;
+    g_cond_signal (&service->start_cond);
+    g_mutex_unlock (&service->mutex);
+    g_thread_join (service->thread);
+    service->thread = NULL;
+
+    search_job_t *job = NULL;
+    while ((job = g_queue_pop_head (&service->jobs))) {
+        search_job_free (job);
+    }
+    g_mutex_clear (&service->mutex);
+    g_cond_clear (&service->start_cond);
+    result_cache_free (service->cache);
+    service->cache = NULL;
+    free (service);
+    service = NULL;
+}
+
+void
+db_search_service_set_result_cache_size (DatabaseSearchService *service, size_t size)
+{
+    assert (service != NULL);
+
+    g_mutex_lock (&service->mutex);
+    service->cache_size = size;
+    g_mutex_unlock (&service->mutex);
+}
+
+void
+db_search_service_set_progressive (DatabaseSearchService *service, bool progressive)
+{
+    assert (service != NULL);
+
+    g_mutex_lock (&service->mutex);
+    service->progressive = progressive;
+    g_mutex_unlock (&service->mutex);
+}
+
+static void *
+search_chunk_run (void *user_data)
+{
+    search_thread_context_t *ctx = user_data;
+    if (!search_job_is_cancelled (ctx->search)) {
+        ctx->thread_func (ctx);
     }
-    g_mutex_unlock (&search->query_mutex);
+
+    search_progress_t *progress = ctx->progress;
+    g_mutex_lock (&progress->mutex);
+    ctx->done = true;
+    g_cond_broadcast (&progress->done_cond);
+    g_mutex_unlock (&progress->mutex);
     return NULL;
 }
 
+// returns false if the chunk isn't done at end_time
+static bool
+search_chunk_wait_until (search_thread_context_t *ctx, int64_t end_time)
+{
+    search_progress_t *progress = ctx->progress;
+    g_mutex_lock (&progress->mutex);
+    while (!ctx->done) {
+        if (!g_cond_wait_until (&progress->done_cond, &progress->mutex, end_time)) {
+            break;
+        }
+    }
+    const bool done = ctx->done;
+    g_mutex_unlock (&progress->mutex);
+    return done;
+}
 
 static search_thread_context_t *
-new_thread_data (DatabaseSearch *search,
+new_thread_data (search_job_t *search,
                  search_query_t **queries,
                  uint32_t num_queries,
+                 search_regex_t *regex,
+                 PredicateProgram *predicates,
+                 Bitmap *candidates,
                  uint32_t start_pos,
                  uint32_t end_pos)
 {
@@ -140,7 +879,16 @@ new_thread_data (DatabaseSearch *search,
     ctx->search = search;
     ctx->queries = queries;
     ctx->num_queries = num_queries;
-    ctx->results = calloc (end_pos - start_pos + 1, sizeof (BTreeNode *));
+    ctx->regex = regex;
+    ctx->predicates = predicates;
+    ctx->candidates = candidates;
+    if (regex && regex->has_jit) {
+        ctx->jit_stack = pcre_jit_stack_alloc (JIT_STACK_START_SIZE, JIT_STACK_MAX_SIZE);
+    }
+    const uint32_t max_results = search->query->max_results;
+    const uint32_t num_entries = end_pos - start_pos + 1;
+    ctx->results = calloc (max_results ? MIN (num_entries, max_results) : num_entries,
+                           sizeof (BTreeNode *));
     assert (ctx->results != NULL);
 
     ctx->num_results = 0;
@@ -167,8 +915,244 @@ filter_node (BTreeNode *node, FsearchFilter filter)
     return false;
 }
 
-static void *
-search_thread (void * user_data)
+// With candidates the search only visits their positions instead of
+// every entry in the range
+static inline uint32_t
+first_entry (Bitmap *candidates, BitmapIter *iter, uint32_t start)
+{
+    if (!candidates) {
+        return start;
+    }
+    bitmap_iter_init (iter, candidates, start);
+    uint32_t next = 0;
+    return bitmap_iter_next (iter, &next) ? next : UINT32_MAX;
+}
+
+static inline uint32_t
+next_entry (Bitmap *candidates, BitmapIter *iter, uint32_t i)
+{
+    if (!candidates) {
+        return i + 1;
+    }
+    uint32_t next = 0;
+    return bitmap_iter_next (iter, &next) ? next : UINT32_MAX;
+}
+
+#define PREFETCH_DISTANCE 4
+
+// Requests the node a few iterations ahead and the name of the next one,
+// so they're already in the cache when the loop gets there. Nodes and
+// names are spread over the heap, the hardware prefetcher can't guess them.
+static inline void
+prefetch_entries (DynamicArray *entries, Bitmap *candidates, uint32_t i, uint32_t end)
+{
+    if (candidates) {
+        // the next positions aren't known in advance
+        return;
+    }
+    if (i + PREFETCH_DISTANCE <= end) {
+        __builtin_prefetch (darray_get_item (entries, i + PREFETCH_DISTANCE));
+    }
+    if (i + 1 <= end) {
+        BTreeNode *next = darray_get_item (entries, i + 1);
+        if (next) {
+            __builtin_prefetch (next->name);
+        }
+    }
+}
+
+// Relevance of a name for a query term, the better the term matches
+// the name as a whole the higher the score
+#define RELEVANCE_EXACT 1000
+#define RELEVANCE_PREFIX 400
+#define RELEVANCE_WORD 200
+#define RELEVANCE_SUBSTRING 100
+#define RELEVANCE_DEPTH_PENALTY 10
+
+static inline bool
+is_word_boundary (const char *name, const char *match)
+{
+    if (match == name) {
+        return true;
+    }
+    const char c = *(match - 1);
+    return c == ' ' || c == '.' || c == '_' || c == '-';
+}
+
+static int32_t
+relevance_score (search_query_t **queries,
+                 uint32_t num_queries,
+                 BTreeNode *node,
+                 bool match_case,
+                 time_t now)
+{
+    const char *name = node->name;
+    const size_t name_len = node->name_len;
+    int32_t score = 0;
+
+    for (uint32_t i = 0; i < num_queries; i++) {
+        search_query_t *query = queries[i];
+        if (query->negated) {
+            continue;
+        }
+        const char *match = match_case
+            ? strstr (name, query->query)
+            : strcasestr (name, query->query);
+        if (!match) {
+            // the term only matched somewhere in the path
+            continue;
+        }
+        if (match == name && query->query_len == name_len) {
+            score += RELEVANCE_EXACT;
+        }
+        else if (match == name) {
+            score += RELEVANCE_PREFIX;
+        }
+        else if (is_word_boundary (name, match)) {
+            score += RELEVANCE_WORD;
+        }
+        else {
+            score += RELEVANCE_SUBSTRING;
+        }
+    }
+
+    // prefer files closer to the root
+    score -= RELEVANCE_DEPTH_PENALTY * (int32_t)btree_node_depth (node);
+
+    // and recently modified ones
+    const time_t age = now - node->mtime;
+    if (age < 24 * 60 * 60) {
+        score += 100;
+    }
+    else if (age < 7 * 24 * 60 * 60) {
+        score += 60;
+    }
+    else if (age < 30 * 24 * 60 * 60) {
+        score += 30;
+    }
+    else if (age < 365 * 24 * 60 * 60) {
+        score += 10;
+    }
+    return score;
+}
+
+// Tests the AND terms one after another, in the order of the query plan.
+// any_path is false if no term needs the full path.
+SEARCH_KERNEL_INLINE bool
+search_queries_match (search_query_t **queries,
+                      uint32_t num_queries,
+                      BTreeNode *node,
+                      const bool match_case,
+                      const bool any_path,
+                      char *full_path,
+                      size_t full_path_len)
+{
+    const char *haystack_path = NULL;
+    size_t haystack_path_len = 0;
+    uint64_t path_signature = 0;
+
+    for (uint32_t i = 0; i < num_queries; i++) {
+        search_query_t *query = queries[i];
+        const char *haystack = NULL;
+        size_t haystack_len = 0;
+        if (any_path && query->needs_path) {
+            // a single compare rejects most entries before any string search
+            if (!path_signature) {
+                path_signature = btree_node_path_signature (node);
+            }
+            if (!fsearch_signature_contains (path_signature, query->signature)) {
+                return false;
+            }
+            if (!haystack_path) {
+                btree_node_get_path_full (node, full_path, full_path_len);
+                haystack_path = full_path;
+                haystack_path_len = strlen (full_path);
+            }
+            haystack = haystack_path;
+            haystack_len = haystack_path_len;
+        }
+        else {
+            if (!fsearch_signature_contains (node->signature, query->signature)) {
+                return false;
+            }
+            haystack = node->name;
+            haystack_len = node->name_len;
+        }
+        if (haystack_len < query->query_len) {
+            return false;
+        }
+
+        char *ptr = query->query;
+        if (match_case) {
+            if (!memmem (haystack, haystack_len, ptr, query->query_len)) {
+            //if (!fsearch_strstr (haystack, ptr, query->query_len)) {
+                return false;
+            }
+        }
+        else {
+            if (!strcasestr (haystack, ptr)) {
+            //if (!fsearch_strcasestr (haystack, ptr, query->query_len)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Returns false as soon as one group can't be satisfied anymore. Groups
+// which contain unknown terms are only decided once they're known.
+static inline bool
+search_groups_eval (search_matcher_t *matcher, uint64_t found, uint64_t unknown)
+{
+    for (uint32_t i = 0; i < matcher->num_groups; i++) {
+        const search_group_t *group = &matcher->groups[i];
+        if ((found & group->terms) || (~found & ~unknown & group->negated_terms)) {
+            continue;
+        }
+        if ((group->terms | group->negated_terms) & unknown) {
+            continue;
+        }
+        return false;
+    }
+    return true;
+}
+
+static bool
+search_matcher_match (search_matcher_t *matcher,
+                      BTreeNode *node,
+                      char *full_path,
+                      size_t full_path_len)
+{
+    if (node->name_len < matcher->name_min_len
+        || !fsearch_signature_contains (node->signature, matcher->name_signature)) {
+        return false;
+    }
+    if (matcher->path_signature
+        && !fsearch_signature_contains (btree_node_path_signature (node), matcher->path_signature)) {
+        return false;
+    }
+
+    uint64_t found = 0;
+    if (matcher->name_automaton) {
+        found = aho_corasick_scan (matcher->name_automaton, node->name);
+    }
+    if (!matcher->path_automaton) {
+        return search_groups_eval (matcher, found, 0);
+    }
+    // building the full path is expensive, skip it if the name decides
+    if (!search_groups_eval (matcher, found, matcher->path_terms)) {
+        return false;
+    }
+    btree_node_get_path_full (node, full_path, full_path_len);
+    found |= aho_corasick_scan (matcher->path_automaton, full_path);
+    return search_groups_eval (matcher, found, 0);
+}
+
+SEARCH_KERNEL_INLINE void *
+search_thread_run (void *user_data,
+                   const FsearchFilter filter,
+                   const bool match_case,
+                   const bool any_path)
 {
     search_thread_context_t *ctx = (search_thread_context_t *)user_data;
     assert (ctx != NULL);
@@ -176,23 +1160,32 @@ search_thread (void * user_data)
 
     const uint32_t start = ctx->start_pos;
     const uint32_t end = ctx->end_pos;
-    const uint32_t max_results = ctx->search->max_results;
+    const uint32_t max_results = ctx->search->query->max_results ? ctx->search->query->max_results : UINT32_MAX;
     const uint32_t num_queries = ctx->num_queries;
-    const FsearchFilter filter = ctx->search->filter;
     search_query_t **queries = ctx->queries;
-    const uint32_t search_in_path = ctx->search->search_in_path;
-    const uint32_t auto_search_in_path = ctx->search->auto_search_in_path;
-    const uint32_t match_case = ctx->search->match_case;
     DynamicArray *entries = ctx->search->entries;
-
+    PredicateProgram *predicates = ctx->predicates;
+    search_matcher_t *matcher = ctx->matcher;
+    // ranked searches keep the best matches instead of the first ones
+    TopK *top_k = ctx->top_k;
+    const time_t now = time (NULL);
 
     uint32_t num_results = 0;
+    uint32_t num_folders = 0;
+    uint32_t num_files = 0;
     BTreeNode **results = ctx->results;
     char full_path[PATH_MAX] = "";
-    for (uint32_t i = start; i <= end; i++) {
-        if (max_results && num_results == max_results) {
+    Bitmap *candidates = ctx->candidates;
+    Bitmap *matches = ctx->matches;
+    BitmapIter iter;
+    uint32_t num_visited = 0;
+    for (uint32_t i = first_entry (candidates, &iter, start);
+         i <= end;
+         i = next_entry (candidates, &iter, i)) {
+        if (++num_visited % SEARCH_CANCEL_CHECK_INTERVAL == 0 && search_job_is_cancelled (ctx->search)) {
             break;
         }
+        prefetch_entries (entries, candidates, i, end);
         BTreeNode *node = darray_get_item (entries, i);
         if (!node) {
             continue;
@@ -200,56 +1193,100 @@ search_thread (void * user_data)
         if (!filter_node (node, filter)) {
             continue;
         }
-
-        const char *haystack_path = NULL;
-        const char *haystack_name = node->name;
-        if (search_in_path) {
-            btree_node_get_path_full (node, full_path, sizeof (full_path));
-            haystack_path = full_path;
+        // numeric predicates are much cheaper than any string matching
+        if (predicates && !predicate_program_eval (predicates, node)) {
+            continue;
         }
 
-        uint32_t num_found = 0;
-        while (true) {
-            if (num_found == num_queries) {
-                results[num_results] = node;
-                num_results++;
-                break;
-            }
-            search_query_t *query = queries[num_found++];
-            if (!query) {
-                break;
-            }
-            char *ptr = query->query;
-            const char *haystack = NULL;
-            if (search_in_path || (auto_search_in_path && query->has_separator)) {
-                if (!haystack_path) {
-                    btree_node_get_path_full (node, full_path, sizeof (full_path));
-                    haystack_path = full_path;
-                }
-                haystack = haystack_path;
-            }
-            else {
-                haystack = haystack_name;
-            }
-            if (match_case) {
-                if (!strstr (haystack, ptr)) {
-                //if (!fsearch_strstr (haystack, ptr, query->query_len)) {
-                    break;
-                }
-            }
-            else {
-                if (!strcasestr (haystack, ptr)) {
-                //if (!fsearch_strcasestr (haystack, ptr, query->query_len)) {
-                    break;
-                }
-            }
+        bool matched = false;
+        if (matcher) {
+            matched = search_matcher_match (matcher, node, full_path, sizeof (full_path));
+        }
+        else {
+            matched = search_queries_match (queries,
+                                            num_queries,
+                                            node,
+                                            match_case,
+                                            any_path,
+                                            full_path,
+                                            sizeof (full_path));
+        }
+        if (!matched) {
+            continue;
         }
 
+        // every match is counted, so the totals are exact even if only the
+        // first max_results are stored
+        if (node->is_dir) {
+            num_folders++;
+        }
+        else {
+            num_files++;
+        }
+        if (top_k) {
+            top_k_push (top_k,
+                        relevance_score (queries, num_queries, node, match_case, now),
+                        i,
+                        node);
+        }
+        else if (num_results < max_results) {
+            results[num_results] = node;
+            num_results++;
+        }
+        if (matches) {
+            bitmap_add (matches, i);
+        }
     }
     ctx->num_results = num_results;
+    ctx->num_matched_folders = num_folders;
+    ctx->num_matched_files = num_files;
     return NULL;
 }
 
+#define DEFINE_SEARCH_THREAD(suffix, filter, match_case, any_path) \
+    static void * \
+    search_thread_##suffix##_##match_case##_##any_path (void *user_data) \
+    { \
+        return search_thread_run (user_data, filter, match_case, any_path); \
+    }
+
+#define DEFINE_SEARCH_THREADS(suffix, filter) \
+    DEFINE_SEARCH_THREAD (suffix, filter, 0, 0) \
+    DEFINE_SEARCH_THREAD (suffix, filter, 0, 1) \
+    DEFINE_SEARCH_THREAD (suffix, filter, 1, 0) \
+    DEFINE_SEARCH_THREAD (suffix, filter, 1, 1)
+
+DEFINE_SEARCH_THREADS (none, FSEARCH_FILTER_NONE)
+DEFINE_SEARCH_THREADS (folders, FSEARCH_FILTER_FOLDERS)
+DEFINE_SEARCH_THREADS (files, FSEARCH_FILTER_FILES)
+
+// indexed by filter, match case and whether any term needs the path
+static const ThreadFunc search_threads[3][2][2] = {
+    [FSEARCH_FILTER_NONE] = {{search_thread_none_0_0, search_thread_none_0_1},
+                             {search_thread_none_1_0, search_thread_none_1_1}},
+    [FSEARCH_FILTER_FOLDERS] = {{search_thread_folders_0_0, search_thread_folders_0_1},
+                                {search_thread_folders_1_0, search_thread_folders_1_1}},
+    [FSEARCH_FILTER_FILES] = {{search_thread_files_0_0, search_thread_files_0_1},
+                              {search_thread_files_1_0, search_thread_files_1_1}},
+};
+
+#ifdef FSEARCH_BENCHMARK
+// the loop without specialization, only used to benchmark the instances
+static void *
+search_thread_generic (void *user_data)
+{
+    search_thread_context_t *ctx = (search_thread_context_t *)user_data;
+    bool any_path = false;
+    for (uint32_t i = 0; i < ctx->num_queries; i++) {
+        any_path |= ctx->queries[i]->needs_path;
+    }
+    return search_thread_run (user_data,
+                              ctx->search->query->filter,
+                              ctx->search->query->match_case,
+                              any_path);
+}
+#endif
+
 #ifdef DEBUG
 static struct timeval tm1;
 #endif
@@ -272,79 +1309,353 @@ static inline void stop()
 #endif
 }
 
-static void *
-search_regex_thread (void * user_data)
+SEARCH_KERNEL_INLINE void *
+search_regex_thread_run (void *user_data,
+                         const FsearchFilter filter,
+                         const bool needs_path)
 {
     search_thread_context_t *ctx = (search_thread_context_t *)user_data;
     assert (ctx != NULL);
     assert (ctx->results != NULL);
+    assert (ctx->regex != NULL);
 
-    search_query_t **queries = ctx->queries;
-    search_query_t *query = queries[0];
-    const char *error;
-    int erroffset;
-    pcre *regex = pcre_compile (query->query,
-                                ctx->search->match_case ? 0 : PCRE_CASELESS,
-                                &error,
-                                &erroffset,
-                                NULL);
+    const pcre *regex = ctx->regex->regex;
+    const pcre_extra *extra = ctx->regex->extra;
+    RegexLiterals *literals = ctx->regex->literals;
+    pcre_jit_stack *jit_stack = ctx->jit_stack;
+    const bool match_case = ctx->search->query->match_case;
 
     int ovector[OVECCOUNT];
 
-    if (regex) {
-        const uint32_t start = ctx->start_pos;
-        const uint32_t end = ctx->end_pos;
-        const uint32_t max_results = ctx->search->max_results;
-        const bool search_in_path = ctx->search->search_in_path;
-        const bool auto_search_in_path = ctx->search->auto_search_in_path;
-        DynamicArray *entries = ctx->search->entries;
-        BTreeNode **results = ctx->results;
-        const FsearchFilter filter = ctx->search->filter;
-
-        uint32_t num_results = 0;
-        char full_path[PATH_MAX] = "";
-        for (uint32_t i = start; i <= end; ++i) {
-            if (max_results && num_results == max_results) {
-                break;
+    const uint32_t start = ctx->start_pos;
+    const uint32_t end = ctx->end_pos;
+    const uint32_t max_results = ctx->search->query->max_results ? ctx->search->query->max_results : UINT32_MAX;
+    DynamicArray *entries = ctx->search->entries;
+    BTreeNode **results = ctx->results;
+    PredicateProgram *predicates = ctx->predicates;
+
+    uint32_t num_results = 0;
+    uint32_t num_folders = 0;
+    uint32_t num_files = 0;
+    char full_path[PATH_MAX] = "";
+    Bitmap *candidates = ctx->candidates;
+    Bitmap *matches = ctx->matches;
+    BitmapIter iter;
+    uint32_t num_visited = 0;
+    for (uint32_t i = first_entry (candidates, &iter, start);
+         i <= end;
+         i = next_entry (candidates, &iter, i)) {
+        if (++num_visited % SEARCH_CANCEL_CHECK_INTERVAL == 0 && search_job_is_cancelled (ctx->search)) {
+            break;
+        }
+        prefetch_entries (entries, candidates, i, end);
+        BTreeNode *node = darray_get_item (entries, i);
+        if (!node) {
+            continue;
+        }
+
+        if (!filter_node (node, filter)) {
+            continue;
+        }
+        if (predicates && !predicate_program_eval (predicates, node)) {
+            continue;
+        }
+
+        const char *haystack = NULL;
+        size_t haystack_len = 0;
+        if (needs_path) {
+            btree_node_get_path_full (node, full_path, sizeof (full_path));
+            haystack = full_path;
+            haystack_len = strlen (full_path);
+        }
+        else {
+            haystack = node->name;
+            haystack_len = node->name_len;
+        }
+
+        if (literals
+            && !regex_literals_match (literals, haystack, haystack_len, match_case)) {
+            continue;
+        }
+
+        int res = 0;
+        if (jit_stack) {
+            res = pcre_jit_exec (regex,
+                                 extra,
+                                 haystack,
+                                 haystack_len,
+                                 0,
+                                 0,
+                                 ovector,
+                                 OVECCOUNT,
+                                 jit_stack);
+        }
+        else {
+            res = pcre_exec (regex,
+                             extra,
+                             haystack,
+                             haystack_len,
+                             0,
+                             0,
+                             ovector,
+                             OVECCOUNT);
+        }
+        if (res < 0) {
+            continue;
+        }
+        if (node->is_dir) {
+            num_folders++;
+        }
+        else {
+            num_files++;
+        }
+        if (num_results < max_results) {
+            results[num_results] = node;
+            num_results++;
+        }
+        if (matches) {
+            bitmap_add (matches, i);
+        }
+    }
+    ctx->num_results = num_results;
+    ctx->num_matched_folders = num_folders;
+    ctx->num_matched_files = num_files;
+    return NULL;
+}
+
+#define DEFINE_SEARCH_REGEX_THREAD(suffix, filter, needs_path) \
+    static void * \
+    search_regex_thread_##suffix##_##needs_path (void *user_data) \
+    { \
+        return search_regex_thread_run (user_data, filter, needs_path); \
+    }
+
+DEFINE_SEARCH_REGEX_THREAD (none, FSEARCH_FILTER_NONE, 0)
+DEFINE_SEARCH_REGEX_THREAD (none, FSEARCH_FILTER_NONE, 1)
+DEFINE_SEARCH_REGEX_THREAD (folders, FSEARCH_FILTER_FOLDERS, 0)
+DEFINE_SEARCH_REGEX_THREAD (folders, FSEARCH_FILTER_FOLDERS, 1)
+DEFINE_SEARCH_REGEX_THREAD (files, FSEARCH_FILTER_FILES, 0)
+DEFINE_SEARCH_REGEX_THREAD (files, FSEARCH_FILTER_FILES, 1)
+
+// indexed by filter and whether the regex is matched against the path
+static const ThreadFunc search_regex_threads[3][2] = {
+    [FSEARCH_FILTER_NONE] = {search_regex_thread_none_0, search_regex_thread_none_1},
+    [FSEARCH_FILTER_FOLDERS] = {search_regex_thread_folders_0, search_regex_thread_folders_1},
+    [FSEARCH_FILTER_FILES] = {search_regex_thread_files_0, search_regex_thread_files_1},
+};
+
+#ifdef FSEARCH_BENCHMARK
+static void *
+search_regex_thread_generic (void *user_data)
+{
+    search_thread_context_t *ctx = (search_thread_context_t *)user_data;
+    search_job_t *search = ctx->search;
+    const bool needs_path = search->query->search_in_path
+        || (search->query->auto_search_in_path && ctx->queries[0]->has_separator);
+    return search_regex_thread_run (user_data, search->query->filter, needs_path);
+}
+#endif
+
+static void *
+search_fuzzy_thread (void * user_data)
+{
+    search_thread_context_t *ctx = (search_thread_context_t *)user_data;
+    assert (ctx != NULL);
+    assert (ctx->fuzzy != NULL);
+    assert (ctx->top_k != NULL);
+
+    const uint32_t start = ctx->start_pos;
+    const uint32_t end = ctx->end_pos;
+    const uint32_t num_queries = ctx->num_queries;
+    const FsearchFilter filter = ctx->search->query->filter;
+    search_query_t **queries = ctx->queries;
+    FuzzyPattern **fuzzy = ctx->fuzzy;
+    DynamicArray *entries = ctx->search->entries;
+    PredicateProgram *predicates = ctx->predicates;
+    search_matcher_t *matcher = ctx->matcher;
+    TopK *top_k = ctx->top_k;
+
+    uint32_t num_folders = 0;
+    uint32_t num_files = 0;
+    char full_path[PATH_MAX] = "";
+    Bitmap *candidates = ctx->candidates;
+    BitmapIter iter;
+    uint32_t num_visited = 0;
+    for (uint32_t i = first_entry (candidates, &iter, start);
+         i <= end;
+         i = next_entry (candidates, &iter, i)) {
+        if (++num_visited % SEARCH_CANCEL_CHECK_INTERVAL == 0 && search_job_is_cancelled (ctx->search)) {
+            break;
+        }
+        prefetch_entries (entries, candidates, i, end);
+        // there's no early exit once max_results are found, the heap only
+        // keeps the best ones of all matches
+        BTreeNode *node = darray_get_item (entries, i);
+        if (!node) {
+            continue;
+        }
+        if (!filter_node (node, filter)) {
+            continue;
+        }
+        if (predicates && !predicate_program_eval (predicates, node)) {
+            continue;
+        }
+
+        const char *haystack_path = NULL;
+        int32_t score = 0;
+        if (matcher) {
+            // with | and ! every term has to be tested to evaluate the groups
+            uint64_t found = 0;
+            for (uint32_t j = 0; j < num_queries; j++) {
+                const char *haystack = node->name;
+                if (queries[j]->needs_path) {
+                    if (!haystack_path) {
+                        btree_node_get_path_full (node, full_path, sizeof (full_path));
+                        haystack_path = full_path;
+                    }
+                    haystack = haystack_path;
+                }
+                int32_t query_score = 0;
+                if (!fuzzy_match (fuzzy[j], haystack, &query_score)) {
+                    continue;
+                }
+                found |= 1ull << j;
+                if (!queries[j]->negated) {
+                    score += query_score;
+                }
             }
-            BTreeNode *node = darray_get_item (entries, i);
-            if (!node) {
-                continue;
+            if (search_groups_eval (matcher, found, 0)) {
+                if (node->is_dir) {
+                    num_folders++;
+                }
+                else {
+                    num_files++;
+                }
+                top_k_push (top_k, score, i, node);
             }
+            continue;
+        }
 
-            if (!filter_node (node, filter)) {
-                continue;
+        uint32_t num_found = 0;
+        for (; num_found < num_queries; num_found++) {
+            const char *haystack = node->name;
+            if (!queries[num_found]->needs_path
+                && (node->name_len < fuzzy[num_found]->pattern_len
+                    || !fsearch_signature_contains (node->signature, fuzzy[num_found]->char_mask))) {
+                break;
             }
-
-            const char *haystack = NULL;
-            if (search_in_path || (auto_search_in_path && query->has_separator)) {
-                btree_node_get_path_full (node, full_path, sizeof (full_path));
-                haystack = full_path;
+            if (queries[num_found]->needs_path) {
+                if (!haystack_path) {
+                    btree_node_get_path_full (node, full_path, sizeof (full_path));
+                    haystack_path = full_path;
+                }
+                haystack = haystack_path;
             }
-            else {
-                haystack = node->name;
+            int32_t query_score = 0;
+            if (!fuzzy_match (fuzzy[num_found], haystack, &query_score)) {
+                break;
             }
-            size_t haystack_len = strlen (haystack);
-
-            if (pcre_exec (regex,
-                           NULL,
-                           haystack,
-                           haystack_len,
-                           0,
-                           0,
-                           ovector,
-                           OVECCOUNT)
-                >= 0) {
-                results[num_results] = node;
-                num_results++;
+            score += query_score;
+        }
+        if (num_found == num_queries) {
+            if (node->is_dir) {
+                num_folders++;
+            }
+            else {
+                num_files++;
             }
+            top_k_push (top_k, score, i, node);
         }
-        ctx->num_results = num_results;
-        pcre_free (regex);
     }
+    ctx->num_matched_folders = num_folders;
+    ctx->num_matched_files = num_files;
     return NULL;
 }
 
+// picks the loop specialized for the flags of the search
+static ThreadFunc
+search_thread_func_get (search_job_t *search,
+                        search_query_t **queries,
+                        uint32_t num_queries,
+                        search_regex_t *regex,
+                        bool fuzzy)
+{
+    if (regex) {
+        const bool regex_needs_path = search->query->search_in_path
+            || (search->query->auto_search_in_path && queries[0]->has_separator);
+        return search_regex_threads[search->query->filter][regex_needs_path];
+    }
+    if (fuzzy) {
+        return search_fuzzy_thread;
+    }
+    bool any_path = false;
+    for (uint32_t i = 0; i < num_queries; i++) {
+        any_path |= queries[i]->needs_path;
+    }
+    return search_threads[search->query->filter][search->query->match_case ? 1 : 0][any_path];
+}
+
+static void
+search_regex_free (search_regex_t *regex)
+{
+    if (!regex) {
+        return;
+    }
+    if (regex->extra) {
+        pcre_free_study (regex->extra);
+        regex->extra = NULL;
+    }
+    if (regex->regex) {
+        pcre_free (regex->regex);
+        regex->regex = NULL;
+    }
+    if (regex->literals) {
+        regex_literals_free (regex->literals);
+        regex->literals = NULL;
+    }
+    free (regex);
+    regex = NULL;
+}
+
+static search_regex_t *
+search_regex_new (const char *pattern, bool match_case, char **error_message)
+{
+    assert (pattern != NULL);
+
+    const char *error = NULL;
+    int erroffset = 0;
+    pcre *regex = pcre_compile (pattern,
+                                match_case ? 0 : PCRE_CASELESS,
+                                &error,
+                                &erroffset,
+                                NULL);
+    if (!regex) {
+        trace ("regex compile failed at offset %d: %s\n", erroffset, error);
+        if (error_message) {
+            *error_message = g_strdup_printf ("Invalid regular expression: %s", error);
+        }
+        return NULL;
+    }
+
+    search_regex_t *new = calloc (1, sizeof (search_regex_t));
+    assert (new != NULL);
+    new->regex = regex;
+
+    // study and jit compile the pattern once, it's shared by all threads
+    error = NULL;
+    new->extra = pcre_study (regex, PCRE_STUDY_JIT_COMPILE, &error);
+    if (error) {
+        trace ("regex study failed: %s\n", error);
+    }
+    int has_jit = 0;
+    if (new->extra
+        && !pcre_fullinfo (regex, new->extra, PCRE_INFO_JIT, &has_jit)) {
+        new->has_jit = has_jit ? true : false;
+    }
+    new->literals = regex_literals_new (pattern);
+    return new;
+}
+
 static int
 is_regex (const char *query)
 {
@@ -392,8 +1703,21 @@ search_query_free (void * data)
         g_free (query->query);
         query->query = NULL;
     }
-    g_free (query);
-    query = NULL;
+    g_free (query);
+    query = NULL;
+}
+
+static void
+search_queries_free (search_query_t **queries, uint32_t num_queries)
+{
+    if (!queries) {
+        return;
+    }
+    for (uint32_t i = 0; i < num_queries; ++i) {
+        search_query_free (queries[i]);
+        queries[i] = NULL;
+    }
+    free (queries);
 }
 
 static search_query_t *
@@ -406,25 +1730,53 @@ search_query_new (const char *query)
     new->query_len = strlen (query);
     new->has_uppercase = str_has_upper (query);
     new->has_separator = strchr (query, '/') ? 1 : 0;
+    new->signature = fsearch_str_signature (query);
     //new->found = 0;
     return new;
 }
 
+// Moves all filter predicates (size:, dm:, ext:, ...) of the query into
+// predicates and returns the remaining text
+static char *
+extract_predicates (const char *query,
+                    PredicateProgram *predicates,
+                    char **error_message)
+{
+    assert (query != NULL);
+    assert (predicates != NULL);
+
+    char **terms = g_strsplit_set (query, " ", -1);
+    GString *text = g_string_sized_new (strlen (query));
+    bool first = true;
+    for (uint32_t i = 0; terms[i]; i++) {
+        if (predicate_program_add_term (predicates, terms[i], error_message)) {
+            continue;
+        }
+        // keep the spacing of the remaining text, it might be a regex
+        if (!first) {
+            g_string_append_c (text, ' ');
+        }
+        g_string_append (text, terms[i]);
+        first = false;
+    }
+    g_strfreev (terms);
+    return g_string_free (text, FALSE);
+}
+
 static search_query_t **
-build_queries (DatabaseSearch *search, FsearchQuery *q)
+build_queries (const char *text, bool enable_regex)
 {
-    assert (search != NULL);
-    assert (q->query != NULL);
+    assert (text != NULL);
 
-    char *tmp_query_copy = strdup (q->query);
+    char *tmp_query_copy = strdup (text);
     assert (tmp_query_copy != NULL);
     // remove leading/trailing whitespace
     g_strstrip (tmp_query_copy);
 
     // check if regex characters are present
-    const bool is_reg = is_regex (q->query);
-    if (is_reg && q->enable_regex) {
-        search_query_t **queries = calloc (2, sizeof (search_thread_context_t *));
+    const bool is_reg = is_regex (tmp_query_copy);
+    if (is_reg && enable_regex) {
+        search_query_t **queries = calloc (2, sizeof (search_query_t *));
         queries[0] = search_query_new (tmp_query_copy);
         queries[1] = NULL;
         g_free (tmp_query_copy);
@@ -432,14 +1784,45 @@ build_queries (DatabaseSearch *search, FsearchQuery *q)
 
         return queries;
     }
-    // whitespace is regarded as AND so split query there in multiple queries
+    // whitespace is regarded as AND so split query there in multiple queries,
+    // terms joined with | form an OR group and a leading ! negates a term
+    uint32_t max_queries = 1;
+    for (const char *c = tmp_query_copy; *c != '\0'; c++) {
+        if (*c == ' ' || *c == '|') {
+            max_queries++;
+        }
+    }
+    search_query_t **queries = calloc (max_queries + 1, sizeof (search_query_t *));
+    assert (queries != NULL);
+
     char **tmp_queries = g_strsplit_set (tmp_query_copy, " ", -1);
     assert (tmp_queries != NULL);
 
-    uint32_t tmp_queries_len = g_strv_length (tmp_queries);
-    search_query_t **queries = calloc (tmp_queries_len + 1, sizeof (search_thread_context_t *));
-    for (uint32_t i = 0; i < tmp_queries_len; i++) {
-        queries[i] = search_query_new (tmp_queries[i]);
+    uint32_t num_queries = 0;
+    uint32_t group = 0;
+    bool join_group = false;
+    for (uint32_t i = 0; tmp_queries[i]; i++) {
+        char **terms = g_strsplit (tmp_queries[i], "|", -1);
+        for (uint32_t j = 0; terms[j]; j++) {
+            if (j > 0) {
+                join_group = true;
+            }
+            const char *term = terms[j];
+            if (term[0] == '\0') {
+                continue;
+            }
+            if (num_queries > 0 && !join_group) {
+                group++;
+            }
+            join_group = false;
+
+            const bool negated = term[0] == '!' && term[1] != '\0';
+            search_query_t *query = search_query_new (negated ? term + 1 : term);
+            query->group = group;
+            query->negated = negated;
+            queries[num_queries++] = query;
+        }
+        g_strfreev (terms);
     }
 
     g_free (tmp_query_copy);
@@ -450,28 +1833,293 @@ build_queries (DatabaseSearch *search, FsearchQuery *q)
     return queries;
 }
 
+static double
+search_query_estimate_selectivity (Database *db, search_query_t *query)
+{
+    const uint32_t num_entries = db ? db_get_num_entries (db) : 0;
+    if (!num_entries) {
+        return 1.0;
+    }
+
+    // assume the characters of a term occur independently of each other,
+    // which isn't true but good enough to tell rare terms from common ones
+    double selectivity = 1.0;
+    uint64_t seen[4] = {0};
+    for (const unsigned char *c = (unsigned char *)query->query; *c != '\0'; c++) {
+        const unsigned char folded = tolower (*c);
+        const uint64_t bit = 1ull << (folded & 63);
+        if (seen[folded >> 6] & bit) {
+            continue;
+        }
+        seen[folded >> 6] |= bit;
+        selectivity *= (db_get_char_count (db, folded) + 1.0) / (num_entries + 1.0);
+    }
+    return selectivity;
+}
+
+static int
+search_query_compare_cost (const void *a, const void *b)
+{
+    const search_query_t *query_a = *(search_query_t **)a;
+    const search_query_t *query_b = *(search_query_t **)b;
+
+    // terms which only need the name are cheap, building the full path
+    // isn't, so run them first to avoid it for most entries
+    if (query_a->needs_path != query_b->needs_path) {
+        return query_a->needs_path ? 1 : -1;
+    }
+    // then the terms which are most likely to reject an entry
+    if (query_a->selectivity != query_b->selectivity) {
+        return query_a->selectivity < query_b->selectivity ? -1 : 1;
+    }
+    // longer terms are more expensive to test
+    if (query_a->query_len != query_b->query_len) {
+        return query_a->query_len > query_b->query_len ? -1 : 1;
+    }
+    return 0;
+}
+
+// Reorders the AND terms of a query so that those which are cheap to test
+// and reject the most entries are evaluated first.
+static void
+search_queries_plan (search_job_t *search,
+                     search_query_t **queries,
+                     uint32_t num_queries)
+{
+    assert (search != NULL);
+    assert (queries != NULL);
+
+    for (uint32_t i = 0; i < num_queries; i++) {
+        search_query_t *query = queries[i];
+        query->needs_path = search->query->search_in_path
+            || (search->query->auto_search_in_path && query->has_separator);
+        query->selectivity = search_query_estimate_selectivity (search->db, query);
+    }
+    if (num_queries < 2) {
+        return;
+    }
+    qsort (queries, num_queries, sizeof (search_query_t *), search_query_compare_cost);
+
+#ifdef DEBUG
+    for (uint32_t i = 0; i < num_queries; i++) {
+        trace ("plan[%d]: \"%s\" (selectivity: %g, path: %d)\n",
+               i,
+               queries[i]->query,
+               queries[i]->selectivity,
+               queries[i]->needs_path);
+    }
+#endif
+}
+
+static bool
+search_queries_have_operators (search_query_t **queries, uint32_t num_queries)
+{
+    // groups are numbered without gaps, fewer groups than terms means
+    // that some were joined with |
+    uint32_t num_groups = 0;
+    for (uint32_t i = 0; i < num_queries; i++) {
+        if (queries[i]->negated) {
+            return true;
+        }
+        num_groups = MAX (num_groups, queries[i]->group + 1);
+    }
+    return num_groups < num_queries;
+}
+
+static void
+search_matcher_free (search_matcher_t *matcher)
+{
+    if (!matcher) {
+        return;
+    }
+    aho_corasick_free (matcher->name_automaton);
+    aho_corasick_free (matcher->path_automaton);
+    if (matcher->groups) {
+        free (matcher->groups);
+        matcher->groups = NULL;
+    }
+    free (matcher);
+    matcher = NULL;
+}
+
+// Builds the group masks from the final order of the terms, so it must be
+// called after they were planned
+static search_matcher_t *
+search_matcher_new (search_query_t **queries, uint32_t num_queries)
+{
+    assert (num_queries <= AHO_CORASICK_MAX_PATTERNS);
+
+    search_matcher_t *matcher = calloc (1, sizeof (search_matcher_t));
+    assert (matcher != NULL);
+
+    for (uint32_t i = 0; i < num_queries; i++) {
+        matcher->num_groups = MAX (matcher->num_groups, queries[i]->group + 1);
+    }
+    matcher->groups = calloc (matcher->num_groups, sizeof (search_group_t));
+    assert (matcher->groups != NULL);
+
+    for (uint32_t i = 0; i < num_queries; i++) {
+        search_group_t *group = &matcher->groups[queries[i]->group];
+        if (queries[i]->negated) {
+            group->negated_terms |= 1ull << i;
+        }
+        else {
+            group->terms |= 1ull << i;
+        }
+    }
+    return matcher;
+}
+
+// One automaton for the terms which are matched against the name and one
+// for those which need the full path
+static void
+search_matcher_compile (search_matcher_t *matcher,
+                        search_query_t **queries,
+                        uint32_t num_queries,
+                        bool match_case)
+{
+    const char *name_terms[AHO_CORASICK_MAX_PATTERNS] = {NULL};
+    const char *path_terms[AHO_CORASICK_MAX_PATTERNS] = {NULL};
+    bool has_name_terms = false;
+    for (uint32_t i = 0; i < num_queries; i++) {
+        // terms which are alone in their group have to be part of every match
+        const search_group_t *group = &matcher->groups[queries[i]->group];
+        const bool required = group->terms == 1ull << i && !group->negated_terms;
+        if (queries[i]->needs_path) {
+            path_terms[i] = queries[i]->query;
+            matcher->path_terms |= 1ull << i;
+            if (required) {
+                matcher->path_signature |= queries[i]->signature;
+            }
+        }
+        else {
+            name_terms[i] = queries[i]->query;
+            has_name_terms = true;
+            if (required) {
+                matcher->name_signature |= queries[i]->signature;
+                matcher->name_min_len = MAX (matcher->name_min_len, queries[i]->query_len);
+            }
+        }
+    }
+    if (has_name_terms) {
+        matcher->name_automaton = aho_corasick_new (name_terms, num_queries, match_case);
+    }
+    if (matcher->path_terms) {
+        matcher->path_automaton = aho_corasick_new (path_terms, num_queries, match_case);
+    }
+}
+
+// Every match has to be in both sets, returns their intersection and
+// frees both. Either may be NULL, which stands for all entries.
+static Bitmap *
+candidates_narrow (Bitmap *candidates, Bitmap *other)
+{
+    if (!other) {
+        return candidates;
+    }
+    if (!candidates) {
+        return other;
+    }
+    Bitmap *both = bitmap_and (candidates, other);
+    bitmap_free (candidates);
+    bitmap_free (other);
+    return both;
+}
+
+static bool
+search_query_is_required (search_query_t **queries, uint32_t num_queries, uint32_t idx)
+{
+    if (queries[idx]->negated) {
+        return false;
+    }
+    for (uint32_t i = 0; i < num_queries; i++) {
+        if (i != idx && queries[i]->group == queries[idx]->group) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// With a suffix index the entries which contain the rarest term every
+// match needs are looked up, instead of testing all entries
+static Bitmap *
+search_queries_get_candidates (search_job_t *search,
+                               search_query_t **queries,
+                               uint32_t num_queries)
+{
+    int32_t best = -1;
+    uint32_t best_count = UINT32_MAX;
+    for (uint32_t i = 0; i < num_queries; i++) {
+        search_query_t *query = queries[i];
+        if (query->needs_path
+            || query->query_len == 0
+            || !search_query_is_required (queries, num_queries, i)) {
+            continue;
+        }
+        const uint32_t count = db_count_substring (search->db, query->query);
+        if (count == UINT32_MAX) {
+            // no suffix index
+            return NULL;
+        }
+        if (best < 0 || count < best_count) {
+            best = i;
+            best_count = count;
+        }
+    }
+    if (best < 0) {
+        return NULL;
+    }
+    trace ("suffix index: \"%s\" occurs %d times\n", queries[best]->query, best_count);
+    return db_get_substring_bitmap (search->db, queries[best]->query);
+}
+
+// Hidden entries are excluded by leaving them out of the candidates, so
+// the search loops never test them. Without candidates this creates the
+// set of all visible entries, unless none is hidden.
+static Bitmap *
+candidates_exclude_hidden (search_job_t *search, Bitmap *candidates)
+{
+    Bitmap *hidden = db_get_hidden_bitmap (search->db);
+    if (!search->query->exclude_hidden || !hidden) {
+        return candidates;
+    }
+    if (!candidates) {
+        if (bitmap_get_cardinality (hidden) == 0) {
+            return NULL;
+        }
+        candidates = bitmap_new_full (search->num_entries);
+    }
+    Bitmap *visible = bitmap_andnot (candidates, hidden);
+    bitmap_free (candidates);
+    return visible;
+}
+
 static DatabaseSearchResult *
-db_perform_empty_search (DatabaseSearch *search)
+db_perform_empty_search (search_job_t *search)
 {
     assert (search != NULL);
     assert (search->entries != NULL);
 
-    const uint32_t num_results = MIN (search->max_results, search->num_entries);
+    const uint32_t num_results = MIN (search->query->max_results, search->num_entries);
     GPtrArray *results = g_ptr_array_sized_new (num_results);
     g_ptr_array_set_free_func (results, (GDestroyNotify)db_search_entry_free);
 
     DynamicArray *entries = search->entries;
 
+    Bitmap *visible = candidates_exclude_hidden (search, NULL);
+    BitmapIter iter;
+
     uint32_t num_folders = 0;
     uint32_t num_files = 0;
     uint32_t pos = 0;
-    for (uint32_t i = 0; pos < num_results && i < search->num_entries; ++i) {
+    uint32_t i = first_entry (visible, &iter, 0);
+    for (; pos < num_results && i < search->num_entries; i = next_entry (visible, &iter, i)) {
         BTreeNode *node = darray_get_item (entries, i);
         if (!node) {
             continue;
         }
 
-        if (!filter_node (node, search->filter)) {
+        if (!filter_node (node, search->query->filter)) {
             continue;
         }
         if (node->is_dir) {
@@ -484,70 +2132,256 @@ db_perform_empty_search (DatabaseSearch *search)
         g_ptr_array_add (results, entry);
         pos++;
     }
+
+    // the rest of the entries is only counted
+    uint32_t num_matched_folders = num_folders;
+    uint32_t num_matched_files = num_files;
+    for (; i < search->num_entries; i = next_entry (visible, &iter, i)) {
+        BTreeNode *node = darray_get_item (entries, i);
+        if (!node
+            || !filter_node (node, search->query->filter)) {
+            continue;
+        }
+        if (node->is_dir) {
+            num_matched_folders++;
+        }
+        else {
+            num_matched_files++;
+        }
+    }
+    bitmap_free (visible);
+    visible = NULL;
+
     DatabaseSearchResult *result_ctx = calloc (1, sizeof (DatabaseSearchResult));
     assert (result_ctx != NULL);
     result_ctx->results = results;
     result_ctx->num_folders = num_folders;
     result_ctx->num_files = num_files;
+    result_ctx->num_matched_folders = num_matched_folders;
+    result_ctx->num_matched_files = num_matched_files;
     return result_ctx;
 }
 
 static DatabaseSearchResult *
-db_perform_normal_search (DatabaseSearch *search, FsearchQuery *q)
+db_perform_normal_search (search_job_t *search)
 {
     assert (search != NULL);
     assert (search->entries != NULL);
 
-    search_query_t **queries = build_queries (search, q);
+    if (search->num_entries == 0) {
+        DatabaseSearchResult *result_ctx = calloc (1, sizeof (DatabaseSearchResult));
+        assert (result_ctx != NULL);
+        result_ctx->results = g_ptr_array_new ();
+        return result_ctx;
+    }
+
+    char *error_message = NULL;
+    PredicateProgram *predicates = predicate_program_new ();
+    char *text = extract_predicates (search->query->query, predicates, &error_message);
+    if (error_message) {
+        g_free (text);
+        text = NULL;
+        predicate_program_free (predicates);
+        predicates = NULL;
+
+        DatabaseSearchResult *result_ctx = calloc (1, sizeof (DatabaseSearchResult));
+        assert (result_ctx != NULL);
+        result_ctx->error_message = error_message;
+        return result_ctx;
+    }
+    Bitmap *candidates = NULL;
+    if (predicate_program_is_empty (predicates)) {
+        predicate_program_free (predicates);
+        predicates = NULL;
+    }
+    else {
+        predicate_program_bind (predicates, search->db);
+        candidates = predicate_program_get_candidates (predicates, search->db);
+    }
+
+    // fuzzy matching takes precedence over regex
+    const bool enable_regex = search->query->enable_regex && !search->query->enable_fuzzy;
+    search_query_t **queries = build_queries (text, enable_regex);
+    uint32_t num_queries = 0;
+    while (queries[num_queries]) {
+        num_queries++;
+    }
+
+    const bool is_reg = enable_regex && is_regex (text);
+    g_free (text);
+    text = NULL;
+
+    search_regex_t *regex = NULL;
+    if (is_reg && num_queries > 0) {
+        // compile the pattern only once for all threads and report errors
+        // here instead of letting every thread fail silently
+        regex = search_regex_new (queries[0]->query, search->query->match_case, &error_message);
+        if (!regex) {
+            search_queries_free (queries, num_queries);
+            queries = NULL;
+            predicate_program_free (predicates);
+            predicates = NULL;
+            bitmap_free (candidates);
+            candidates = NULL;
+
+            DatabaseSearchResult *result_ctx = calloc (1, sizeof (DatabaseSearchResult));
+            assert (result_ctx != NULL);
+            result_ctx->error_message = error_message;
+            return result_ctx;
+        }
+        RegexLiterals *literals = regex->literals;
+        const bool regex_needs_path = search->query->search_in_path
+            || (search->query->auto_search_in_path && queries[0]->has_separator);
+        if (literals && literals->anchored_start && literals->prefix && !regex_needs_path) {
+            // ^literal only matches names in one range of the prefix index
+            candidates = candidates_narrow (candidates,
+                                            db_get_prefix_bitmap (search->db, literals->prefix));
+        }
+    }
+    else {
+        search_queries_plan (search, queries, num_queries);
+        if (!search->query->enable_fuzzy) {
+            candidates = candidates_narrow (candidates,
+                                            search_queries_get_candidates (search, queries, num_queries));
+        }
+    }
+
+    if (search->refine) {
+        candidates = candidates_narrow (candidates, bitmap_copy (search->refine));
+    }
+    Bitmap *folders = db_get_folder_bitmap (search->db);
+    if (folders && search->query->filter == FSEARCH_FILTER_FOLDERS) {
+        candidates = candidates_narrow (candidates, bitmap_copy (folders));
+    }
+    else if (folders && candidates && search->query->filter == FSEARCH_FILTER_FILES) {
+        // without candidates almost all entries are files, a set of them
+        // wouldn't skip much
+        Bitmap *files = bitmap_andnot (candidates, folders);
+        bitmap_free (candidates);
+        candidates = files;
+    }
+    candidates = candidates_exclude_hidden (search, candidates);
+
+    // a single term is faster with strstr, several are found in one pass
+    search_matcher_t *matcher = NULL;
+    const bool has_operators = !regex && search_queries_have_operators (queries, num_queries);
+    if (!regex && num_queries > AHO_CORASICK_MAX_PATTERNS && has_operators) {
+        search_queries_free (queries, num_queries);
+        queries = NULL;
+        predicate_program_free (predicates);
+        predicates = NULL;
+        bitmap_free (candidates);
+        candidates = NULL;
+
+        DatabaseSearchResult *result_ctx = calloc (1, sizeof (DatabaseSearchResult));
+        assert (result_ctx != NULL);
+        result_ctx->error_message = g_strdup_printf ("Too many search terms, | and ! support at most %d",
+                                                     AHO_CORASICK_MAX_PATTERNS);
+        return result_ctx;
+    }
+    if (!regex && num_queries <= AHO_CORASICK_MAX_PATTERNS
+        && (has_operators || (num_queries > 1 && !search->query->enable_fuzzy))) {
+        matcher = search_matcher_new (queries, num_queries);
+        if (!search->query->enable_fuzzy) {
+            search_matcher_compile (matcher, queries, num_queries, search->query->match_case);
+        }
+    }
+
+    FuzzyPattern **fuzzy = NULL;
+    if (search->query->enable_fuzzy && num_queries > 0) {
+        fuzzy = calloc (num_queries, sizeof (FuzzyPattern *));
+        assert (fuzzy != NULL);
+        for (uint32_t i = 0; i < num_queries; i++) {
+            fuzzy[i] = fuzzy_pattern_new (queries[i]->query, search->query->match_case);
+        }
+    }
+
+    // fuzzy matches are always ranked, regex matches never, relevance needs
+    // the plain terms to score them against the names
+    const bool ranked = fuzzy || (search->query->rank_by_relevance && !regex && num_queries > 0);
 
-    const uint32_t num_threads = fsearch_thread_pool_get_num_threads (search->pool);
+    // several jobs per thread let idle workers steal from those which got
+    // the expensive parts of the database; every job needs at least one
+    // entry, otherwise the ranges overflow
+    const uint32_t num_threads = MIN (fsearch_thread_pool_get_num_threads (search->pool)
+                                      * SEARCH_JOBS_PER_THREAD,
+                                      search->num_entries);
     const uint32_t num_items_per_thread = search->num_entries / num_threads;
 
     search_thread_context_t *thread_data[num_threads];
     memset (thread_data, 0, num_threads * sizeof (search_thread_context_t *));
 
-    const uint32_t max_results = search->max_results;
+    const uint32_t max_results = search->query->max_results;
     const bool limit_results = max_results ? true : false;
-    const bool is_reg = is_regex (search->query);
-    uint32_t num_queries = 0;
-    while (queries[num_queries]) {
-        num_queries++;
-    }
     uint32_t start_pos = 0;
     uint32_t end_pos = num_items_per_thread - 1;
 
+    ThreadFunc thread_func = search_thread_func_get (search, queries, num_queries, regex, fuzzy != NULL);
+
+    // ranked results are only known once all entries are searched,
+    // otherwise the chunks are merged in order as soon as they're done
+    const bool progressive = search->progressive && !ranked;
+    search_progress_t progress;
+    if (progressive) {
+        g_mutex_init (&progress.mutex);
+        g_cond_init (&progress.done_cond);
+    }
+
     start ();
-    GList *temp = fsearch_thread_pool_get_threads (search->pool);
+    const int64_t start_time = g_get_monotonic_time ();
+    FsearchTaskGroup *group = fsearch_task_group_new (search->pool);
     for (uint32_t i = 0; i < num_threads; i++) {
         thread_data[i] = new_thread_data (search,
                 queries,
                 num_queries,
+                regex,
+                predicates,
+                candidates,
                 start_pos,
                 i == num_threads - 1 ? search->num_entries - 1 : end_pos);
 
         start_pos = end_pos + 1;
         end_pos += num_items_per_thread;
 
-        fsearch_thread_pool_push_data (search->pool,
-                                       temp,
-                                       is_reg && search->enable_regex ?
-                                           search_regex_thread : search_thread,
-                                       thread_data[i]);
-        temp = temp->next;
-    }
+        thread_data[i]->matcher = matcher;
+        if (search->collect_matches && !fuzzy) {
+            thread_data[i]->matches = bitmap_new ();
+        }
 
-    temp = fsearch_thread_pool_get_threads (search->pool);
-    while (temp) {
-        fsearch_thread_pool_wait_for_thread (search->pool, temp);
-        temp = temp->next;
+        if (fuzzy) {
+            thread_data[i]->fuzzy = fuzzy;
+        }
+        if (ranked) {
+            // keep only the best max_results per job
+            thread_data[i]->top_k = top_k_new (max_results);
+        }
+        // the worker which wrote this part of the entries array has it on
+        // its numa node
+        const uint32_t worker = fsearch_thread_pool_get_worker_for_item (search->pool,
+                                                                         thread_data[i]->start_pos,
+                                                                         search->num_entries);
+        if (progressive) {
+            thread_data[i]->thread_func = thread_func;
+            thread_data[i]->progress = &progress;
+            fsearch_task_group_push_to_worker (group, worker, search_chunk_run, thread_data[i]);
+        }
+        else {
+            fsearch_task_group_push_to_worker (group, worker, thread_func, thread_data[i]);
+        }
     }
+    if (!progressive) {
+        fsearch_task_group_wait (group);
+        fsearch_task_group_free (group);
+        group = NULL;
 
-    trace ("search done: ");
-    stop ();
+        trace ("search done: ");
+        stop ();
+    }
 
-    // get total number of entries found
+    // get total number of entries found, progressive searches don't know
+    // it yet
     uint32_t num_results = 0;
-    for (uint32_t i = 0; i < num_threads; ++i) {
+    for (uint32_t i = 0; i < num_threads && !progressive; ++i) {
         num_results += thread_data[i]->num_results;
     }
 
@@ -558,11 +2392,61 @@ db_perform_normal_search (DatabaseSearch *search, FsearchQuery *q)
     uint32_t num_files = 0;
 
     uint32_t pos = 0;
+    if (ranked) {
+        // the best matches overall are among the best matches of each thread
+        TopK *top_k = top_k_new (max_results);
+        for (uint32_t i = 0; i < num_threads; i++) {
+            top_k_merge (top_k, thread_data[i]->top_k);
+            top_k_free (thread_data[i]->top_k);
+            thread_data[i]->top_k = NULL;
+        }
+        top_k_sort (top_k);
+        for (uint32_t i = 0; i < top_k->num_items; i++) {
+            BTreeNode *node = top_k->items[i].data;
+            if (node->is_dir) {
+                num_folders++;
+            }
+            else {
+                num_files++;
+            }
+            DatabaseSearchEntry *entry = db_search_entry_new (node, pos);
+            entry->score = top_k->items[i].score;
+            g_ptr_array_add (results, entry);
+            pos++;
+        }
+        top_k_free (top_k);
+        top_k = NULL;
+    }
+    if (fuzzy) {
+        for (uint32_t i = 0; i < num_queries; i++) {
+            fuzzy_pattern_free (fuzzy[i]);
+        }
+        free (fuzzy);
+        fuzzy = NULL;
+    }
+
+    // the chunks count all their matches, even past max_results
+    uint32_t num_matched_folders = 0;
+    uint32_t num_matched_files = 0;
+    int64_t publish_time = start_time + PROGRESSIVE_RESULTS_DELAY;
     for (uint32_t i = 0; i < num_threads; i++) {
         search_thread_context_t *ctx = thread_data[i];
-        if (!ctx) {
-            break;
+        if (progressive) {
+            while (!search_chunk_wait_until (ctx, publish_time)) {
+                // this chunk takes a while, show what was found before it
+                if (results->len > 0 && !search_job_is_cancelled (search)) {
+                    search_job_publish (search,
+                                        results,
+                                        num_folders,
+                                        num_files,
+                                        num_matched_folders,
+                                        num_matched_files);
+                }
+                publish_time = g_get_monotonic_time () + PROGRESSIVE_RESULTS_INTERVAL;
+            }
         }
+        num_matched_folders += ctx->num_matched_folders;
+        num_matched_files += ctx->num_matched_files;
         for (uint32_t j = 0; j < ctx->num_results; ++j) {
             if (limit_results) {
                 if (pos >= max_results) {
@@ -580,21 +2464,69 @@ db_perform_normal_search (DatabaseSearch *search, FsearchQuery *q)
             g_ptr_array_add (results, entry);
             pos++;
         }
+        if (progressive
+            && results->len > 0
+            && !search_job_is_cancelled (search)
+            && g_get_monotonic_time () >= publish_time) {
+            search_job_publish (search,
+                                results,
+                                num_folders,
+                                num_files,
+                                num_matched_folders,
+                                num_matched_files);
+            publish_time = g_get_monotonic_time () + PROGRESSIVE_RESULTS_INTERVAL;
+        }
+    }
+    if (progressive) {
+        // all chunks are done, but their tasks may not have returned yet
+        fsearch_task_group_wait (group);
+        fsearch_task_group_free (group);
+        group = NULL;
+        g_mutex_clear (&progress.mutex);
+        g_cond_clear (&progress.done_cond);
+
+        trace ("search done: ");
+        stop ();
+    }
+
+    // the chunks are in database order, so this only appends
+    if (thread_data[0]->matches) {
+        search->matches = bitmap_new ();
+        for (uint32_t i = 0; i < num_threads; i++) {
+            bitmap_or_inplace (search->matches, thread_data[i]->matches);
+        }
+    }
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+        search_thread_context_t *ctx = thread_data[i];
+        if (!ctx) {
+            break;
+        }
         if (ctx->results) {
             g_free (ctx->results);
             ctx->results = NULL;
         }
-        if (ctx) {
-            g_free (ctx);
-            ctx = NULL;
+        if (ctx->jit_stack) {
+            pcre_jit_stack_free (ctx->jit_stack);
+            ctx->jit_stack = NULL;
         }
+        if (ctx->matches) {
+            bitmap_free (ctx->matches);
+            ctx->matches = NULL;
+        }
+        g_free (ctx);
+        ctx = NULL;
     }
 
-    for (uint32_t i = 0; i < num_queries; ++i) {
-        search_query_free (queries[i]);
-        queries[i] = NULL;
-    }
-    free (queries);
+    search_regex_free (regex);
+    regex = NULL;
+    search_matcher_free (matcher);
+    matcher = NULL;
+    predicate_program_free (predicates);
+    predicates = NULL;
+    bitmap_free (candidates);
+    candidates = NULL;
+    search_queries_free (queries, num_queries);
     queries = NULL;
 
     DatabaseSearchResult *result_ctx = calloc (1, sizeof (DatabaseSearchResult));
@@ -602,9 +2534,110 @@ db_perform_normal_search (DatabaseSearch *search, FsearchQuery *q)
     result_ctx->results = results;
     result_ctx->num_folders = num_folders;
     result_ctx->num_files = num_files;
+    result_ctx->num_matched_folders = num_matched_folders;
+    result_ctx->num_matched_files = num_matched_files;
+    result_ctx->ranked = ranked;
     return result_ctx;
 }
 
+#ifdef FSEARCH_BENCHMARK
+bool
+db_search_benchmark_loops (FsearchQuery *query,
+                           DynamicArray *entries,
+                           uint32_t num_entries,
+                           uint32_t num_runs,
+                           DatabaseSearchLoopBenchmark *benchmark)
+{
+    assert (query != NULL);
+    assert (entries != NULL);
+    assert (benchmark != NULL);
+
+    if (num_entries == 0 || query->enable_fuzzy || query_is_empty (query->query)) {
+        return false;
+    }
+
+    // a job without database, the loops only read the entries
+    search_job_t search = {0};
+    search.entries = entries;
+    search.num_entries = num_entries;
+    search.query = query;
+
+    search_query_t **queries = build_queries (query->query, query->enable_regex);
+    uint32_t num_queries = 0;
+    while (queries[num_queries]) {
+        num_queries++;
+    }
+
+    search_regex_t *regex = NULL;
+    search_matcher_t *matcher = NULL;
+    if (query->enable_regex && is_regex (query->query) && num_queries > 0) {
+        char *error_message = NULL;
+        regex = search_regex_new (queries[0]->query, query->match_case, &error_message);
+        if (!regex) {
+            g_free (error_message);
+            error_message = NULL;
+            search_queries_free (queries, num_queries);
+            queries = NULL;
+            return false;
+        }
+    }
+    else {
+        search_queries_plan (&search, queries, num_queries);
+        const bool has_operators = search_queries_have_operators (queries, num_queries);
+        if (num_queries > AHO_CORASICK_MAX_PATTERNS && has_operators) {
+            search_queries_free (queries, num_queries);
+            queries = NULL;
+            return false;
+        }
+        if (num_queries <= AHO_CORASICK_MAX_PATTERNS && (has_operators || num_queries > 1)) {
+            matcher = search_matcher_new (queries, num_queries);
+            search_matcher_compile (matcher, queries, num_queries, query->match_case);
+        }
+    }
+
+    ThreadFunc funcs[2] = {regex ? search_regex_thread_generic : search_thread_generic,
+                           search_thread_func_get (&search, queries, num_queries, regex, false)};
+    search_thread_context_t *ctx = new_thread_data (&search,
+                                                    queries,
+                                                    num_queries,
+                                                    regex,
+                                                    NULL,
+                                                    NULL,
+                                                    0,
+                                                    num_entries - 1);
+    ctx->matcher = matcher;
+
+    int64_t best[2] = {INT64_MAX, INT64_MAX};
+    for (uint32_t run = 0; run < num_runs; run++) {
+        for (uint32_t f = 0; f < 2; f++) {
+            const int64_t start_time = g_get_monotonic_time ();
+            funcs[f] (ctx);
+            best[f] = MIN (best[f], g_get_monotonic_time () - start_time);
+        }
+    }
+    benchmark->generic_time = best[0];
+    benchmark->specialized_time = best[1];
+    benchmark->num_results = ctx->num_matched_folders + ctx->num_matched_files;
+
+    if (ctx->jit_stack) {
+        pcre_jit_stack_free (ctx->jit_stack);
+        ctx->jit_stack = NULL;
+    }
+    free (ctx->results);
+    ctx->results = NULL;
+    free (ctx);
+    ctx = NULL;
+
+    search_regex_free (regex);
+    regex = NULL;
+    search_matcher_free (matcher);
+    matcher = NULL;
+    search_queries_free (queries, num_queries);
+    queries = NULL;
+    return true;
+}
+#endif
+
 void
 db_search_results_clear (DatabaseSearch *search)
 {
@@ -615,6 +2648,10 @@ db_search_results_clear (DatabaseSearch *search)
         g_ptr_array_free (search->results, TRUE);
         search->results = NULL;
     }
+    if (search->results_db) {
+        db_unref (search->results_db);
+        search->results_db = NULL;
+    }
     search->num_folders = 0;
     search->num_files = 0;
     return;
@@ -625,23 +2662,16 @@ db_search_free (DatabaseSearch *search)
 {
     assert (search != NULL);
 
+    db_search_cancel (search);
     db_search_results_clear (search);
+    if (search->db) {
+        db_unref (search->db);
+        search->db = NULL;
+    }
     if (search->query) {
         g_free (search->query);
         search->query = NULL;
     }
-    g_mutex_lock (&search->query_mutex);
-    if (search->query_ctx) {
-        fsearch_query_free (search->query_ctx);
-        search->query_ctx = NULL;
-    }
-    g_mutex_unlock (&search->query_mutex);
-
-    search->search_thread_terminate = true;
-    g_cond_signal (&search->search_thread_start_cond);
-    g_thread_join (search->search_thread);
-    g_mutex_clear (&search->query_mutex);
-    g_cond_clear (&search->search_thread_start_cond);
     g_free (search);
     search = NULL;
     return;
@@ -665,6 +2695,12 @@ db_search_entry_set_pos (DatabaseSearchEntry *entry, uint32_t pos)
     entry->pos = pos;
 }
 
+int32_t
+db_search_entry_get_score (DatabaseSearchEntry *entry)
+{
+    return entry->score;
+}
+
 static void
 db_search_entry_free (DatabaseSearchEntry *entry)
 {
@@ -686,23 +2722,26 @@ db_search_entry_new (BTreeNode *node, uint32_t pos)
 }
 
 DatabaseSearch *
-db_search_new (FsearchThreadPool *pool,
-               DynamicArray *entries,
-               uint32_t num_entries,
+db_search_new (DatabaseSearchService *service,
+               Database *db,
                uint32_t max_results,
                FsearchFilter filter,
                const char *query,
                bool hide_results,
                bool match_case,
                bool enable_regex,
+               bool enable_fuzzy,
+               bool rank_by_relevance,
                bool auto_search_in_path,
-               bool search_in_path)
+               bool search_in_path,
+               bool exclude_hidden)
 {
     DatabaseSearch *db_search = calloc (1, sizeof (DatabaseSearch));
     assert (db_search != NULL);
 
-    db_search->entries = entries;
-    db_search->num_entries = num_entries;
+    db_search->db = db_ref (db);
+    db_search->entries = db_get_entries (db);
+    db_search->num_entries = db_get_num_entries (db);
     db_search->results = NULL;
     if (query) {
         db_search->query = g_strdup (query);
@@ -710,19 +2749,20 @@ db_search_new (FsearchThreadPool *pool,
     else {
         db_search->query = NULL;
     }
-    db_search->pool = pool;
+    db_search->service = service;
+    db_search->callback_data = NULL;
     db_search->num_folders = 0;
     db_search->num_files = 0;
     db_search->enable_regex = enable_regex;
+    db_search->enable_fuzzy = enable_fuzzy;
+    db_search->rank_by_relevance = rank_by_relevance;
     db_search->auto_search_in_path = auto_search_in_path;
     db_search->search_in_path = search_in_path;
+    db_search->exclude_hidden = exclude_hidden;
     db_search->hide_results = hide_results;
     db_search->match_case = match_case;
     db_search->max_results = max_results;
     db_search->filter = filter;
-    g_mutex_init (&db_search->query_mutex);
-    g_cond_init (&db_search->search_thread_start_cond);
-    db_search->search_thread = g_thread_new("fsearch_search_thread", fsearch_search_thread, db_search);
     return db_search;
 }
 
@@ -734,6 +2774,23 @@ db_search_set_search_in_path (DatabaseSearch *search, bool search_in_path)
     search->search_in_path = search_in_path;
 }
 
+void
+db_search_cancel (DatabaseSearch *search)
+{
+    assert (search != NULL);
+
+    DatabaseSearchService *service = search->service;
+    if (!service) {
+        return;
+    }
+    if (search->callback_data) {
+        g_mutex_lock (&service->mutex);
+        db_search_service_remove_waiter (service, search->callback_data, true);
+        g_mutex_unlock (&service->mutex);
+    }
+    search->service = NULL;
+}
+
 void
 db_search_set_query (DatabaseSearch *search, const char *query)
 {
@@ -747,25 +2804,34 @@ db_search_set_query (DatabaseSearch *search, const char *query)
 
 void
 db_search_update (DatabaseSearch *search,
-                  DynamicArray *entries,
-                  uint32_t num_entries,
+                  Database *db,
                   uint32_t max_results,
                   FsearchFilter filter,
                   const char *query,
                   bool hide_results,
                   bool match_case,
                   bool enable_regex,
+                  bool enable_fuzzy,
+                  bool rank_by_relevance,
                   bool auto_search_in_path,
-                  bool search_in_path)
+                  bool search_in_path,
+                  bool exclude_hidden)
 {
     assert (search != NULL);
 
-    search->entries = entries;
-    search->num_entries = num_entries;
+    if (search->db != db) {
+        db_unref (search->db);
+        search->db = db_ref (db);
+    }
+    search->entries = db_get_entries (db);
+    search->num_entries = db_get_num_entries (db);
     db_search_set_query (search, query);
     search->enable_regex = enable_regex;
+    search->enable_fuzzy = enable_fuzzy;
+    search->rank_by_relevance = rank_by_relevance;
     search->search_in_path = search_in_path;
     search->auto_search_in_path = auto_search_in_path;
+    search->exclude_hidden = exclude_hidden;
     search->hide_results = hide_results;
     search->match_case = match_case;
     search->max_results = max_results;
@@ -825,30 +2891,29 @@ db_search_get_results (DatabaseSearch *search)
     return search->results;
 }
 
-void
-db_queue_search (DatabaseSearch *search, FsearchQuery *query)
-{
-    g_mutex_lock (&search->query_mutex);
-    if (search->query_ctx) {
-        fsearch_query_free (search->query_ctx);
-    }
-    search->query_ctx = query;
-    g_mutex_unlock (&search->query_mutex);
-    g_cond_signal (&search->search_thread_start_cond);
-}
-
 void
 db_perform_search (DatabaseSearch *search, void (*callback)(void *), void *callback_data)
 {
     assert (search != NULL);
-    if (search->entries == NULL) {
+    if (search->entries == NULL || search->service == NULL) {
         return;
     }
 
-    //db_search_results_clear (search);
-
-    FsearchQuery *q = fsearch_query_new (search->query, callback, callback_data, false, false, false, false);
-    db_queue_search (search, q);
-    //db_perform_normal_search (search);
+    search->callback_data = callback_data;
+    FsearchQuery *q = fsearch_query_new (search->db,
+                                         search->query,
+                                         search->filter,
+                                         search->max_results,
+                                         callback,
+                                         callback_data,
+                                         search->hide_results,
+                                         search->match_case,
+                                         search->enable_regex,
+                                         search->enable_fuzzy,
+                                         search->rank_by_relevance,
+                                         search->auto_search_in_path,
+                                         search->search_in_path,
+                                         search->exclude_hidden);
+    db_search_service_queue (search->service, q);
 }
 
@@ -20,48 +20,64 @@
 
 #include <stdint.h>
 #include "array.h"
+#include "database.h"
 #include "btree.h"
 #include "query.h"
 #include "fsearch_thread_pool.h"
+#include "result_cache.h"
 
 typedef struct _DatabaseSearch DatabaseSearch;
 typedef struct _DatabaseSearchEntry DatabaseSearchEntry;
+typedef struct _DatabaseSearchService DatabaseSearchService;
 
 // search modes
 enum {
     DB_SEARCH_MODE_NORMAL = 0,
     DB_SEARCH_MODE_REGEX = 1,
+    DB_SEARCH_MODE_FUZZY = 2,
 };
 
-typedef enum {
-    FSEARCH_FILTER_NONE,
-    FSEARCH_FILTER_FOLDERS,
-    FSEARCH_FILTER_FILES,
-} FsearchFilter;
-
 typedef struct
 {
     GPtrArray *results;
+    // the database the results point into, the result holds a reference
+    Database *db;
     void *cb_data;
+    // set when the query couldn't be processed, e.g. an invalid regex
+    char *error_message;
+    // results are ordered by relevance instead of by name
+    bool ranked;
+    // the results continue those delivered before instead of replacing
+    // them, see db_search_service_set_progressive
+    bool append;
+    // more results of the same search follow
+    bool partial;
     uint32_t num_folders;
     uint32_t num_files;
+    // all matching folders and files, including those past max_results
+    uint32_t num_matched_folders;
+    uint32_t num_matched_files;
+    // time the search took in microseconds
+    int64_t search_time;
 } DatabaseSearchResult;
 
+// The search of a window: its query and the results it shows. The
+// searches themselves are run by the search service, which all windows share.
 struct _DatabaseSearch
 {
     GPtrArray *results;
-    FsearchThreadPool *pool;
-
+    // the database the results point into, which might already have been
+    // replaced by a newer one
+    Database *results_db;
+    DatabaseSearchService *service;
+    // passed to the callback of the last search, identifies us to the service
+    void *callback_data;
+
+    Database *db;
     DynamicArray *entries;
     uint32_t num_entries;
 
-    GThread *search_thread;
-    bool search_thread_terminate;
-    GMutex query_mutex;
-    GCond search_thread_start_cond;
-
     char *query;
-    FsearchQuery *query_ctx;
     FsearchFilter filter;
     uint32_t max_results;
     uint32_t num_folders;
@@ -69,25 +85,54 @@ struct _DatabaseSearch
     bool hide_results;
     bool match_case;
     bool enable_regex;
+    bool enable_fuzzy;
+    bool rank_by_relevance;
     bool search_in_path;
     bool auto_search_in_path;
+    bool exclude_hidden;
 };
 
+// Runs the searches of all windows on one thread, which spreads every
+// search over the thread pool. Searches are run in the order they were
+// queued, with at most one pending search per window: a new one replaces
+// the pending one, so a window which searches as the user types can't
+// starve the others. Searches with the same query, flags and database are
+// run only once, every window gets its own copy of the results.
+DatabaseSearchService *
+db_search_service_new (FsearchThreadPool *pool);
+
+// results of the running search are still delivered, pending ones are
+// dropped
+void
+db_search_service_free (DatabaseSearchService *service);
+
+// memory the cache of recent search results may take, 0 disables it
+void
+db_search_service_set_result_cache_size (DatabaseSearchService *service, size_t size);
+
+// Slow searches deliver the results found so far in database order, long
+// before they're done: the first batch replaces the shown results, later
+// ones are appended to them. Ranked searches are always delivered at once.
+void
+db_search_service_set_progressive (DatabaseSearchService *service, bool progressive);
+
 void
 db_search_free (DatabaseSearch *search);
 
 DatabaseSearch *
-db_search_new (FsearchThreadPool *pool,
-               DynamicArray *entries,
-               uint32_t num_entries,
+db_search_new (DatabaseSearchService *service,
+               Database *db,
                uint32_t max_results,
                FsearchFilter filter,
                const char *query,
                bool hide_results,
                bool match_case,
                bool enable_regex,
+               bool enable_fuzzy,
+               bool rank_by_relevance,
                bool auto_search_in_path,
-               bool search_in_path);
+               bool search_in_path,
+               bool exclude_hidden);
 
 BTreeNode *
 db_search_entry_get_node (DatabaseSearchEntry *entry);
@@ -95,6 +140,9 @@ db_search_entry_get_node (DatabaseSearchEntry *entry);
 uint32_t
 db_search_entry_get_pos (DatabaseSearchEntry *entry);
 
+int32_t
+db_search_entry_get_score (DatabaseSearchEntry *entry);
+
 void
 db_search_entry_set_pos (DatabaseSearchEntry *entry, uint32_t pos);
 
@@ -103,16 +151,18 @@ db_search_set_query (DatabaseSearch *search, const char *query);
 
 void
 db_search_update (DatabaseSearch *search,
-                  DynamicArray *entries,
-                  uint32_t num_entries,
+                  Database *db,
                   uint32_t max_results,
                   FsearchFilter filter,
                   const char *query,
                   bool hide_results,
                   bool match_case,
                   bool enable_regex,
+                  bool enable_fuzzy,
+                  bool rank_by_relevance,
                   bool auto_search_in_path,
-                  bool search_in_path);
+                  bool search_in_path,
+                  bool exclude_hidden);
 
 void
 db_search_results_clear (DatabaseSearch *search);
@@ -120,6 +170,11 @@ db_search_results_clear (DatabaseSearch *search);
 void
 db_search_set_search_in_path (DatabaseSearch *search, bool search_in_path);
 
+// drops the pending search, after that the callback isn't called anymore
+// and the search can't be performed again
+void
+db_search_cancel (DatabaseSearch *search);
+
 uint32_t
 db_search_get_num_results (DatabaseSearch *search);
 
@@ -137,3 +192,24 @@ db_search_remove_entry (DatabaseSearch *search, DatabaseSearchEntry *entry);
 
 void
 db_perform_search (DatabaseSearch *search, void (*callback)(void *), void *callback_data);
+
+#ifdef FSEARCH_BENCHMARK
+// best times in microseconds of the search loop which tests the flags of
+// the query for every entry and of the one specialized for them
+typedef struct
+{
+    int64_t generic_time;
+    int64_t specialized_time;
+    uint32_t num_results;
+} DatabaseSearchLoopBenchmark;
+
+// Runs both loops num_runs times over all entries on the calling thread,
+// without any index. Returns false for queries without such loops, i.e.
+// empty and fuzzy ones, or invalid regular expressions.
+bool
+db_search_benchmark_loops (FsearchQuery *query,
+                           DynamicArray *entries,
+                           uint32_t num_entries,
+                           uint32_t num_runs,
+                           DatabaseSearchLoopBenchmark *benchmark);
+#endif
@@ -42,13 +42,19 @@ struct _FsearchApplication
 {
     GtkApplication parent;
     Database *db;
-    DatabaseSearch *search;
+    DatabaseSearchService *search_service;
     FsearchConfig *config;
     FsearchThreadPool *pool;
 
     ListModel *list_model;
     gint sb_context_id;
-    bool initialized;
+    // only one database is built at a time, rescans requested meanwhile are
+    // folded into one which runs once the current build is published; both
+    // are only accessed by the main thread
+    bool db_loading;
+    bool db_rescan_pending;
+    // the database of the running build, cancelled when the app quits
+    Database *loading_db;
 
     GMutex mutex;
 };
@@ -63,6 +69,8 @@ static guint signals [LAST_SIGNAL];
 
 G_DEFINE_TYPE (FsearchApplication, fsearch_application, GTK_TYPE_APPLICATION)
 
+// the published database is only swapped on the main thread, so it can
+// be used there without taking a reference
 Database *
 fsearch_application_get_db (FsearchApplication *fsearch)
 {
@@ -77,6 +85,13 @@ fsearch_application_get_thread_pool (FsearchApplication *fsearch)
     return fsearch->pool;
 }
 
+DatabaseSearchService *
+fsearch_application_get_search_service (FsearchApplication *fsearch)
+{
+    g_assert (FSEARCH_IS_APPLICATION (fsearch));
+    return fsearch->search_service;
+}
+
 FsearchConfig *
 fsearch_application_get_config (FsearchApplication *fsearch)
 {
@@ -144,8 +159,9 @@ fsearch_application_init (FsearchApplication *app)
         }
     }
     app->db = NULL;
-    app->search = NULL;
-    app->initialized = false;
+    app->search_service = NULL;
+    app->db_loading = false;
+    app->db_rescan_pending = false;
     app->sb_context_id = -1;
     g_mutex_init (&app->mutex);
 }
@@ -156,6 +172,13 @@ fsearch_application_shutdown (GApplication *app)
     g_assert (FSEARCH_IS_APPLICATION (app));
     FsearchApplication *fsearch = FSEARCH_APPLICATION (app);
 
+    // freeing the pool waits for the build, the scan stops at the next entry
+    if (fsearch->loading_db) {
+        // the build task frees it once it notices
+        db_cancel_build (fsearch->loading_db);
+        fsearch->loading_db = NULL;
+    }
+
     GtkWindow *window = NULL;
     GList *windows = gtk_application_get_windows (GTK_APPLICATION (app));
 
@@ -169,7 +192,14 @@ fsearch_application_shutdown (GApplication *app)
 
     if (fsearch->db) {
         db_save_locations (fsearch->db);
-        db_clear (fsearch->db);
+    }
+    if (fsearch->search_service) {
+        db_search_service_free (fsearch->search_service);
+        fsearch->search_service = NULL;
+    }
+    if (fsearch->db) {
+        db_unref (fsearch->db);
+        fsearch->db = NULL;
     }
     if (fsearch->pool) {
         fsearch_thread_pool_free (fsearch->pool);
@@ -186,12 +216,42 @@ fsearch_application_finalize (GObject *object)
     G_OBJECT_CLASS (fsearch_application_parent_class)->finalize (object);
 }
 
+typedef struct {
+    FsearchApplication *app;
+    // scan all locations instead of loading them from disk
+    bool rescan;
+    // the newly built database
+    Database *db;
+} database_load_t;
+
+static void
+load_database_thread (FsearchApplication *app, bool rescan);
+
 static gboolean
 updated_database_signal_emit_cb (gpointer user_data)
 {
-    FsearchApplication *self = FSEARCH_APPLICATION (user_data);
-    //update_windows_after_db_update (self);
+    database_load_t *load = user_data;
+    FsearchApplication *self = load->app;
+
+    self->loading_db = NULL;
+    self->db_loading = false;
+
+    // publish the new snapshot, searches which still run on the old one
+    // keep it alive until they're done
+    Database *old_db = self->db;
+    self->db = load->db;
+    if (old_db) {
+        db_unref (old_db);
+    }
+    g_free (load);
+    load = NULL;
+
     g_signal_emit (self, signals [DATABASE_UPDATED], 0);
+
+    if (self->db_rescan_pending) {
+        self->db_rescan_pending = false;
+        load_database_thread (self, true);
+    }
     return G_SOURCE_REMOVE;
 }
 
@@ -203,22 +263,6 @@ update_database_signal_emit_cb (gpointer user_data)
     return G_SOURCE_REMOVE;
 }
 
-static void
-prepare_windows_for_db_update (FsearchApplication *app)
-{
-    GtkWindow *window = NULL;
-    GList *windows = gtk_application_get_windows (GTK_APPLICATION (app));
-
-    for (; windows; windows = windows->next) {
-        window = windows->data;
-
-        if (FSEARCH_WINDOW_IS_WINDOW (window)) {
-            fsearch_application_window_remove_model (window);
-        }
-    }
-    return;
-}
-
 #ifdef DEBUG
 static struct timeval tm1;
 #endif
@@ -244,78 +288,82 @@ static inline void stop()
 static gpointer
 load_database (gpointer user_data)
 {
-
     g_assert (user_data != NULL);
-    g_assert (FSEARCH_IS_APPLICATION (user_data));
-    FsearchApplication *app = FSEARCH_APPLICATION (user_data);
-    app->initialized = false;
+    database_load_t *load = user_data;
+    FsearchApplication *app = load->app;
     g_idle_add (update_database_signal_emit_cb, app);
 
-    if (!app->db) {
-        // create new database
-        start ();
-        app->db = db_database_new ();
-
-        bool loaded = false;
-        bool build_new = false;
-        for (GList *l = app->config->locations; l != NULL; l = l->next) {
-            if (app->config->update_database_on_launch) {
-                if (db_location_build_new (app->db, l->data, build_location_callback)) {
-                    loaded = true;
-                    build_new = true;
-                }
+    // the new database is built off to the side, until it's published all
+    // searches run on the current one
+    start ();
+    Database *db = load->db;
+
+    bool loaded = false;
+    bool build_new = false;
+    for (GList *l = app->config->locations; l != NULL && !db_build_is_cancelled (db); l = l->next) {
+        if (load->rescan || app->config->update_database_on_launch) {
+            if (db_location_build_new (db, l->data, build_location_callback)) {
+                loaded = true;
+                build_new = true;
             }
-            else {
-                if (!db_location_load (app->db, l->data)) {
-                    if (db_location_build_new (app->db, l->data, build_location_callback)) {
-                        loaded = true;
-                        build_new = true;
-                    }
-                }
-                else {
+        }
+        else {
+            // files in an older format fail to load as well, e.g. those
+            // which may lack hidden items
+            if (!db_location_load (db, l->data)) {
+                if (db_location_build_new (db, l->data, build_location_callback)) {
                     loaded = true;
+                    build_new = true;
                 }
             }
-        }
-        if (loaded) {
-            if (build_new) {
-                db_build_initial_entries_list (app->db);
-            }
             else {
-                db_update_entries_list (app->db);
+                loaded = true;
             }
         }
-        trace ("loaded db in:");
-        stop ();
     }
-    else {
-        trace ("update\n");
-        start ();
-        db_clear (app->db);
-        if (app->config->locations) {
-            for (GList *l = app->config->locations; l != NULL; l = l->next) {
-                db_location_build_new (app->db, l->data, build_location_callback);
-            }
-            db_build_initial_entries_list (app->db);
+    if (loaded && !db_build_is_cancelled (db)) {
+        if (build_new) {
+            db_build_initial_entries_list (db);
+        }
+        else {
+            db_update_entries_list (db);
+        }
+        if (app->config->build_suffix_index) {
+            db_build_suffix_index (db);
         }
-        trace ("loaded db in:");
-        stop ();
     }
-    uint32_t num_items = db_get_num_entries (app->db);
-    app->initialized = true;
-
-    gchar sb_text[100] = "";
-    snprintf (sb_text, sizeof (sb_text), "Database loaded (%'d Items)", num_items);
-
-    g_idle_add (updated_database_signal_emit_cb, app);
+    trace ("loaded db in:");
+    stop ();
+
+    if (db_build_is_cancelled (db)) {
+        // the app quits, the main loop won't run the callback anymore
+        db_unref (db);
+        g_free (load);
+        load = NULL;
+        return NULL;
+    }
+    g_idle_add (updated_database_signal_emit_cb, load);
 
     return NULL;
 }
 
-static GThread *
-load_database_thread (FsearchApplication *app)
+static void
+load_database_thread (FsearchApplication *app, bool rescan)
 {
-    return g_thread_new("update_database", load_database, app);
+    if (app->db_loading) {
+        // the running build may have read the locations before they changed
+        app->db_rescan_pending = true;
+        return;
+    }
+    app->db_loading = true;
+
+    database_load_t *load = g_new0 (database_load_t, 1);
+    load->app = app;
+    load->rescan = rescan;
+    load->db = db_database_new (app->pool);
+    app->loading_db = load->db;
+    // scanning and indexing mustn't slow down searches
+    fsearch_thread_pool_push (app->pool, FSEARCH_TASK_PRIORITY_BACKGROUND, load_database, load);
 }
 
 static void
@@ -369,11 +417,25 @@ void
 update_database (void)
 {
     FsearchApplication *app = FSEARCH_APPLICATION_DEFAULT;
-    prepare_windows_for_db_update (app);
-    g_thread_new("update_database", load_database, app);
+    load_database_thread (app, true);
     return;
 }
 
+void
+update_searches (void)
+{
+    FsearchApplication *app = FSEARCH_APPLICATION_DEFAULT;
+    GList *windows = gtk_application_get_windows (GTK_APPLICATION (app));
+
+    for (; windows; windows = windows->next) {
+        GtkWindow *window = windows->data;
+
+        if (FSEARCH_WINDOW_IS_WINDOW (window)) {
+            fsearch_application_window_update_search (window);
+        }
+    }
+}
+
 static void
 update_database_activated (GSimpleAction *action,
                 GVariant      *parameter,
@@ -434,7 +496,12 @@ fsearch_application_startup (GApplication* app)
     gtk_application_set_accels_for_action (GTK_APPLICATION (app), "win.search_in_path", search_in_path);
     static const gchar *quit[] = { "<control>q", NULL };
     gtk_application_set_accels_for_action (GTK_APPLICATION (app), "app.quit", quit);
-    FSEARCH_APPLICATION (app)->pool = fsearch_thread_pool_init ();
+    FSEARCH_APPLICATION (app)->pool = fsearch_thread_pool_init (fsearch->config->thread_pool_policy,
+                                                                fsearch->config->thread_pool_num_threads,
+                                                                fsearch->config->thread_pool_cpus);
+    fsearch_thread_pool_set_lower_background_priority (FSEARCH_APPLICATION (app)->pool,
+                                                       fsearch->config->lower_background_priority);
+    FSEARCH_APPLICATION (app)->search_service = db_search_service_new (FSEARCH_APPLICATION (app)->pool);
 }
 
 static void
@@ -459,7 +526,7 @@ fsearch_application_activate (GApplication *app)
     }
     window = GTK_WINDOW (fsearch_application_window_new (FSEARCH_APPLICATION (app)));
     gtk_window_present (window);
-    load_database_thread (FSEARCH_APPLICATION (app));
+    load_database_thread (FSEARCH_APPLICATION (app), false);
 }
 
 static void
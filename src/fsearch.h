@@ -25,6 +25,7 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 #include "database.h"
 #include "config.h"
 #include "fsearch_thread_pool.h"
+#include "database_search.h"
 
 G_BEGIN_DECLS
 
@@ -40,6 +41,11 @@ G_END_DECLS
 void
 update_database (void);
 
+// searches again in all windows, e.g. after a setting the results depend
+// on has changed
+void
+update_searches (void);
+
 Database *
 fsearch_application_get_db (FsearchApplication *fsearch);
 
@@ -48,3 +54,6 @@ fsearch_application_get_config (FsearchApplication *fsearch);
 
 FsearchThreadPool *
 fsearch_application_get_thread_pool (FsearchApplication *fsearch);
+
+DatabaseSearchService *
+fsearch_application_get_search_service (FsearchApplication *fsearch);
@@ -16,121 +16,579 @@
    along with this program; if not, see <http://www.gnu.org/licenses/>.
    */
 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 
 #include "fsearch_thread_pool.h"
+#include "cpu_topology.h"
 #include "debug.h"
 
+// must be a power of two
+#define DEQUE_CAPACITY 4096
+// how long a worker waiting for a group sleeps before it looks for tasks
+// again, which others might have pushed to their deques in the meantime
+#define GROUP_WAIT_INTERVAL (1 * G_TIME_SPAN_MILLISECOND)
+// smaller arrays aren't worth splitting across threads
+#define SORT_MIN_ITEMS_PER_RUN 4096
+
+#define NUM_PRIORITIES 2
+// guards against typos in the configured number of threads
+#define MAX_THREADS 1024
+// nice increment of workers while they run background tasks
+#define BACKGROUND_NICE 10
+// see linux/ioprio.h, background tasks get the lowest best effort level
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_BACKGROUND ((IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7)
+
+typedef struct task_s {
+    ThreadFunc func;
+    gpointer data;
+    // NULL for tasks pushed with fsearch_thread_pool_push
+    FsearchTaskGroup *group;
+    FsearchTaskPriority priority;
+    // the worker which should run the task, NULL for any
+    struct worker_s *affinity;
+} task_t;
+
+// Chase-Lev deque, only the owner pushes and pops at the bottom
+typedef struct work_deque_s {
+    _Atomic int64_t top;
+    _Atomic int64_t bottom;
+    _Atomic (task_t *) buffer[DEQUE_CAPACITY];
+} work_deque_t;
+
+typedef struct worker_s {
+    FsearchThreadPool *pool;
+    GThread *thread;
+    // one deque per priority
+    work_deque_t deques[NUM_PRIORITIES];
+    uint32_t id;
+    // picks the first victim when stealing
+    uint32_t rand_state;
+    // of the task which is running right now
+    FsearchTaskPriority priority;
+    // the cpu and i/o priority of the thread were lowered
+    bool os_background;
+    pid_t tid;
+    // the cpu the thread is pinned to, -1 if it isn't
+    int32_t cpu;
+    uint32_t node;
+    // tasks meant for this worker, protected by the pool mutex; others
+    // only take them while the worker is busy with something else
+    GQueue mailbox[NUM_PRIORITIES];
+    _Atomic uint32_t num_mailbox;
+    // the worker runs a task and doesn't look for new ones
+    _Atomic bool running;
+} worker_t;
+
 struct _FsearchThreadPool {
-    GList *threads;
+    worker_t **workers;
     uint32_t num_threads;
-};
+    uint32_t num_nodes;
 
-typedef struct thread_context_s {
-    GThread *thread;
-    gpointer (*thread_func)(gpointer thread_data);
+    // tasks pushed from outside the pool or when a deque is full, one
+    // queue per priority
+    GMutex mutex;
+    GQueue queues[NUM_PRIORITIES];
+    GCond wake_cond;
+    // interactive tasks which no worker has picked up yet, background
+    // tasks yield to them
+    _Atomic uint32_t num_interactive_queued;
+    // incremented with every pushed task, idle workers only go to sleep
+    // if it didn't change while they were looking for tasks
+    _Atomic uint64_t epoch;
+    _Atomic uint32_t num_sleeping;
+    _Atomic uint32_t num_detached;
+    bool terminate;
 
-    gpointer *thread_data;
+    // run background tasks with lower cpu and i/o priority
+    bool lower_background_priority;
+    // the nice value can only be restored if RLIMIT_NICE allows it
+    bool can_renice;
+    int base_nice;
+};
 
+struct _FsearchTaskGroup {
+    FsearchThreadPool *pool;
+    FsearchTaskPriority priority;
+    _Atomic uint32_t num_pending;
     GMutex mutex;
-    GCond start_cond;
     GCond finished_cond;
-    FsearchThreadStatus status;
-    bool terminate;
-} thread_context_t;
+};
+
+typedef struct range_task_s {
+    FsearchTaskGroup *group;
+    FsearchRangeFunc func;
+    gpointer data;
+    uint32_t start;
+    uint32_t end;
+    uint32_t grain;
+} range_task_t;
+
+typedef struct sort_job_s {
+    char *src;
+    char *dest;
+    size_t item_size;
+    FsearchCompareFunc compare;
+    void *data;
+    // src[start, mid) and src[mid, end) are sorted runs
+    size_t start;
+    size_t mid;
+    size_t end;
+} sort_job_t;
+
+// the worker the current thread belongs to, NULL outside of pools
+static _Thread_local worker_t *current_worker = NULL;
+
+// tasks pushed by threads outside of pools are interactive, those pushed
+// by tasks inherit their priority
+static FsearchTaskPriority
+current_priority (FsearchThreadPool *pool)
+{
+    worker_t *worker = current_worker;
+    if (!worker || worker->pool != pool) {
+        return FSEARCH_TASK_PRIORITY_INTERACTIVE;
+    }
+    return worker->priority;
+}
+
+static void
+worker_set_priority (worker_t *worker, FsearchTaskPriority priority)
+{
+    worker->priority = priority;
+
+    FsearchThreadPool *pool = worker->pool;
+    const bool background = pool->lower_background_priority
+        && priority == FSEARCH_TASK_PRIORITY_BACKGROUND;
+    if (background == worker->os_background) {
+        return;
+    }
+    worker->os_background = background;
+#ifdef __linux__
+    if (pool->can_renice) {
+        setpriority (PRIO_PROCESS,
+                     worker->tid,
+                     background ? pool->base_nice + BACKGROUND_NICE : pool->base_nice);
+    }
+    // 0 restores the default, which follows the nice value
+    syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, worker->tid, background ? IOPRIO_BACKGROUND : 0);
+#endif
+}
 
 static bool
-thread_pool_has_thread (FsearchThreadPool *pool, GList *thread)
+deque_push (work_deque_t *deque, task_t *task)
+{
+    const int64_t b = atomic_load_explicit (&deque->bottom, memory_order_relaxed);
+    const int64_t t = atomic_load_explicit (&deque->top, memory_order_acquire);
+    if (b - t >= DEQUE_CAPACITY) {
+        return false;
+    }
+    atomic_store_explicit (&deque->buffer[b & (DEQUE_CAPACITY - 1)], task, memory_order_relaxed);
+    // publishes the task to thieves
+    atomic_store_explicit (&deque->bottom, b + 1, memory_order_release);
+    return true;
+}
+
+static task_t *
+deque_pop (work_deque_t *deque)
 {
-    GList *temp = pool->threads;
-    while (temp) {
-        if (temp == thread) {
-            return true;
+    const int64_t b = atomic_load_explicit (&deque->bottom, memory_order_relaxed) - 1;
+    // reserving the bottom task must be ordered before reading top
+    atomic_store_explicit (&deque->bottom, b, memory_order_seq_cst);
+    int64_t t = atomic_load_explicit (&deque->top, memory_order_seq_cst);
+    if (t > b) {
+        // empty
+        atomic_store_explicit (&deque->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+    task_t *task = atomic_load_explicit (&deque->buffer[b & (DEQUE_CAPACITY - 1)], memory_order_relaxed);
+    if (t == b) {
+        // last task, race against thieves for it
+        if (!atomic_compare_exchange_strong_explicit (&deque->top,
+                                                      &t,
+                                                      t + 1,
+                                                      memory_order_seq_cst,
+                                                      memory_order_relaxed)) {
+            task = NULL;
         }
-        temp = temp->next;
+        atomic_store_explicit (&deque->bottom, b + 1, memory_order_relaxed);
     }
-    return false;
+    return task;
 }
 
-static gpointer
-fsearch_thread_pool_thread (gpointer user_data)
+static task_t *
+deque_steal (work_deque_t *deque)
+{
+    int64_t t = atomic_load_explicit (&deque->top, memory_order_seq_cst);
+    const int64_t b = atomic_load_explicit (&deque->bottom, memory_order_seq_cst);
+    if (t >= b) {
+        return NULL;
+    }
+    task_t *task = atomic_load_explicit (&deque->buffer[t & (DEQUE_CAPACITY - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit (&deque->top,
+                                                  &t,
+                                                  t + 1,
+                                                  memory_order_seq_cst,
+                                                  memory_order_relaxed)) {
+        // lost the race to another thief or the owner
+        return NULL;
+    }
+    return task;
+}
+
+// wakes one sleeping worker, or all if a specific one has to wake up
+static void
+thread_pool_wake (FsearchThreadPool *pool, bool all)
 {
-    thread_context_t *ctx = user_data;
-
-    g_mutex_lock (&ctx->mutex);
-    while (!ctx->terminate) {
-        g_cond_wait (&ctx->start_cond, &ctx->mutex);
-        ctx->status = THREAD_BUSY;
-        if (ctx->thread_data) {
-            ctx->thread_func (ctx->thread_data);
-            ctx->status = THREAD_FINISHED;
-            ctx->thread_data = NULL;
-            g_cond_signal (&ctx->finished_cond);
+    atomic_fetch_add (&pool->epoch, 1);
+    if (atomic_load (&pool->num_sleeping) > 0) {
+        g_mutex_lock (&pool->mutex);
+        if (all) {
+            g_cond_broadcast (&pool->wake_cond);
+        }
+        else {
+            g_cond_signal (&pool->wake_cond);
         }
-        ctx->status = THREAD_IDLE;
+        g_mutex_unlock (&pool->mutex);
     }
-    g_mutex_unlock (&ctx->mutex);
-    return NULL;
 }
 
 static void
-thread_context_free (thread_context_t *ctx)
+thread_pool_submit (FsearchThreadPool *pool, task_t *task)
 {
-    if (!ctx) {
+    const FsearchTaskPriority priority = task->priority;
+    if (priority == FSEARCH_TASK_PRIORITY_INTERACTIVE) {
+        atomic_fetch_add (&pool->num_interactive_queued, 1);
+    }
+    worker_t *target = task->affinity;
+    if (target) {
+        g_mutex_lock (&pool->mutex);
+        g_queue_push_tail (&target->mailbox[priority], task);
+        atomic_fetch_add (&target->num_mailbox, 1);
+        g_mutex_unlock (&pool->mutex);
+        thread_pool_wake (pool, true);
         return;
     }
+    worker_t *worker = current_worker;
+    if (!worker || worker->pool != pool || !deque_push (&worker->deques[priority], task)) {
+        g_mutex_lock (&pool->mutex);
+        g_queue_push_tail (&pool->queues[priority], task);
+        g_mutex_unlock (&pool->mutex);
+    }
+    thread_pool_wake (pool, false);
+}
 
-    g_mutex_lock (&ctx->mutex);
-    if (ctx->thread_data) {
-        trace ("search data still there\n");
+// must be called with the pool mutex held
+static task_t *
+mailbox_pop (worker_t *worker, FsearchTaskPriority priority)
+{
+    task_t *task = g_queue_pop_head (&worker->mailbox[priority]);
+    if (task) {
+        atomic_fetch_sub (&worker->num_mailbox, 1);
     }
+    return task;
+}
 
-    // terminate thread
-    ctx->terminate = true;
-    g_cond_signal (&ctx->start_cond);
-    g_mutex_unlock (&ctx->mutex);
-    g_thread_join (ctx->thread);
+static task_t *
+thread_pool_find_task_with_priority (FsearchThreadPool *pool,
+                                     worker_t *self,
+                                     FsearchTaskPriority priority)
+{
+    task_t *task = NULL;
+    if (self) {
+        task = deque_pop (&self->deques[priority]);
+        if (task) {
+            return task;
+        }
+    }
+
+    g_mutex_lock (&pool->mutex);
+    if (self) {
+        task = mailbox_pop (self, priority);
+    }
+    if (!task) {
+        task = g_queue_pop_head (&pool->queues[priority]);
+    }
+    g_mutex_unlock (&pool->mutex);
+    if (task) {
+        return task;
+    }
 
-    g_mutex_clear (&ctx->mutex);
-    g_cond_clear (&ctx->start_cond);
-    g_cond_clear (&ctx->finished_cond);
-    g_free (ctx);
-    ctx = NULL;
+    uint32_t first = 0;
+    if (self) {
+        // xorshift
+        self->rand_state ^= self->rand_state << 13;
+        self->rand_state ^= self->rand_state >> 17;
+        self->rand_state ^= self->rand_state << 5;
+        first = self->rand_state % pool->num_threads;
+    }
+    for (uint32_t i = 0; i < pool->num_threads; i++) {
+        worker_t *victim = pool->workers[(first + i) % pool->num_threads];
+        if (victim == self) {
+            continue;
+        }
+        task = deque_steal (&victim->deques[priority]);
+        if (task) {
+            return task;
+        }
+    }
+
+    // tasks with an affinity are left to their worker, unless it's busy
+    // or gone
+    for (uint32_t i = 0; i < pool->num_threads; i++) {
+        worker_t *victim = pool->workers[(first + i) % pool->num_threads];
+        if (victim == self || atomic_load (&victim->num_mailbox) == 0) {
+            continue;
+        }
+        g_mutex_lock (&pool->mutex);
+        if (atomic_load (&victim->running) || pool->terminate) {
+            task = mailbox_pop (victim, priority);
+        }
+        g_mutex_unlock (&pool->mutex);
+        if (task) {
+            return task;
+        }
+    }
+    return NULL;
 }
 
-static thread_context_t *
-thread_context_new (void)
+// Interactive tasks first, background tasks only if there are none left
+// and max_priority allows them
+static task_t *
+thread_pool_find_task (FsearchThreadPool *pool, worker_t *self, FsearchTaskPriority max_priority)
 {
-    thread_context_t *ctx = g_new0 (thread_context_t, 1);
-    if (!ctx) {
+    task_t *task = thread_pool_find_task_with_priority (pool, self, FSEARCH_TASK_PRIORITY_INTERACTIVE);
+    if (task) {
+        atomic_fetch_sub (&pool->num_interactive_queued, 1);
+        return task;
+    }
+    if (max_priority == FSEARCH_TASK_PRIORITY_INTERACTIVE) {
         return NULL;
     }
-    ctx->thread_data = NULL;
-    ctx->thread_func = NULL;
-    ctx->terminate = false;
-    ctx->status = THREAD_IDLE;
-    g_mutex_init (&ctx->mutex);
-    g_cond_init (&ctx->start_cond);
-    g_cond_init (&ctx->finished_cond);
+    return thread_pool_find_task_with_priority (pool, self, FSEARCH_TASK_PRIORITY_BACKGROUND);
+}
 
-    ctx->thread = g_thread_new("thread pool", fsearch_thread_pool_thread, ctx);
-    return ctx;
+static void
+task_run (FsearchThreadPool *pool, task_t *task)
+{
+    worker_t *self = current_worker;
+    FsearchTaskPriority prev_priority = FSEARCH_TASK_PRIORITY_INTERACTIVE;
+    bool prev_running = false;
+    if (self) {
+        prev_priority = self->priority;
+        worker_set_priority (self, task->priority);
+        prev_running = atomic_exchange (&self->running, true);
+        if (!prev_running && atomic_load (&self->num_mailbox) > 0) {
+            // the rest of our mailbox may be taken by others now
+            thread_pool_wake (pool, true);
+        }
+    }
+
+    task->func (task->data);
+
+    if (self) {
+        atomic_store (&self->running, prev_running);
+        worker_set_priority (self, prev_priority);
+    }
+
+    FsearchTaskGroup *group = task->group;
+    g_free (task);
+    task = NULL;
+
+    if (!group) {
+        atomic_fetch_sub (&pool->num_detached, 1);
+        return;
+    }
+    // the waiter may free the group as soon as it sees no pending tasks,
+    // holding the mutex keeps it alive until we're done with it
+    g_mutex_lock (&group->mutex);
+    if (atomic_fetch_sub (&group->num_pending, 1) == 1) {
+        g_cond_broadcast (&group->finished_cond);
+    }
+    g_mutex_unlock (&group->mutex);
+}
+
+static gpointer
+fsearch_thread_pool_thread (gpointer user_data)
+{
+    worker_t *self = user_data;
+    FsearchThreadPool *pool = self->pool;
+    current_worker = self;
+    self->tid = syscall (SYS_gettid);
+#ifdef __linux__
+    if (self->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO (&set);
+        CPU_SET (self->cpu, &set);
+        if (sched_setaffinity (0, sizeof (set), &set) != 0) {
+            trace ("thread pool: failed to pin worker %d to cpu %d\n", self->id, self->cpu);
+        }
+    }
+#endif
+
+    while (true) {
+        const uint64_t epoch = atomic_load (&pool->epoch);
+        task_t *task = thread_pool_find_task (pool, self, FSEARCH_TASK_PRIORITY_BACKGROUND);
+        if (task) {
+            task_run (pool, task);
+            continue;
+        }
+
+        // announce the sleep before checking the epoch a last time, so
+        // a concurrent push either sees us sleeping or we see its epoch
+        atomic_fetch_add (&pool->num_sleeping, 1);
+        g_mutex_lock (&pool->mutex);
+        // there was no task left, so we're done when the pool shuts down
+        const bool terminate = pool->terminate;
+        while (atomic_load (&pool->epoch) == epoch && !pool->terminate) {
+            g_cond_wait (&pool->wake_cond, &pool->mutex);
+        }
+        g_mutex_unlock (&pool->mutex);
+        atomic_fetch_sub (&pool->num_sleeping, 1);
+
+        if (terminate) {
+            break;
+        }
+    }
+    current_worker = NULL;
+    return NULL;
+}
+
+// picks the cpu of every worker, NULL for workers which aren't pinned
+static uint32_t
+thread_pool_select_cpus (FsearchCpuTopology *topology,
+                         FsearchThreadPoolPolicy policy,
+                         uint32_t num_threads,
+                         const char *cpu_list,
+                         const FsearchCpu ***cpus_out)
+{
+    const FsearchCpu **available = g_new0 (const FsearchCpu *, topology->num_cpus);
+    uint32_t num_available = 0;
+    bool pin = true;
+
+    switch (policy) {
+        case FSEARCH_THREAD_POOL_POLICY_PHYSICAL_CORES:
+            num_available = fsearch_cpu_topology_get_cores (topology, available, topology->num_cpus);
+            num_threads = num_available;
+            break;
+        case FSEARCH_THREAD_POOL_POLICY_ALL_CPUS:
+            for (uint32_t i = 0; i < topology->num_cpus; i++) {
+                available[num_available++] = &topology->cpus[i];
+            }
+            num_threads = num_available;
+            // with a thread on every cpu the scheduler balances them better
+            // than fixed cpus, which other processes compete for as well
+            pin = false;
+            break;
+        case FSEARCH_THREAD_POOL_POLICY_CUSTOM:
+        default:
+            if (cpu_list && *cpu_list != '\0') {
+                uint32_t *ids = g_new0 (uint32_t, CPU_SETSIZE);
+                const uint32_t num_ids = fsearch_cpu_list_parse (cpu_list, ids, CPU_SETSIZE);
+                for (uint32_t i = 0; i < num_ids && num_available < topology->num_cpus; i++) {
+                    const FsearchCpu *cpu = fsearch_cpu_topology_lookup (topology, ids[i]);
+                    if (cpu) {
+                        available[num_available++] = cpu;
+                    }
+                    else {
+                        trace ("thread pool: cpu %d isn't available\n", ids[i]);
+                    }
+                }
+                g_free (ids);
+                ids = NULL;
+            }
+            if (num_available == 0) {
+                // no usable cpu list, let the scheduler place the threads
+                for (uint32_t i = 0; i < topology->num_cpus; i++) {
+                    available[num_available++] = &topology->cpus[i];
+                }
+                pin = false;
+            }
+            if (num_threads == 0) {
+                num_threads = num_available;
+            }
+            break;
+    }
+    num_threads = CLAMP (num_threads, 1, MAX_THREADS);
+
+    const FsearchCpu **cpus = g_new0 (const FsearchCpu *, num_threads);
+    for (uint32_t i = 0; i < num_threads; i++) {
+        cpus[i] = pin && num_available > 0 ? available[i % num_available] : NULL;
+    }
+    g_free (available);
+    available = NULL;
+
+    *cpus_out = cpus;
+    return num_threads;
 }
 
 FsearchThreadPool *
-fsearch_thread_pool_init (void)
+fsearch_thread_pool_init (FsearchThreadPoolPolicy policy, uint32_t num_threads, const char *cpu_list)
 {
     FsearchThreadPool *pool = g_new0 (FsearchThreadPool, 1);
-    pool->threads = NULL;
-    pool->num_threads = 0;
+    g_mutex_init (&pool->mutex);
+    g_cond_init (&pool->wake_cond);
+    for (uint32_t i = 0; i < NUM_PRIORITIES; i++) {
+        g_queue_init (&pool->queues[i]);
+    }
+    atomic_init (&pool->num_interactive_queued, 0);
+    atomic_init (&pool->epoch, 0);
+    atomic_init (&pool->num_sleeping, 0);
+    atomic_init (&pool->num_detached, 0);
+    pool->terminate = false;
+
+    pool->lower_background_priority = false;
+    pool->base_nice = getpriority (PRIO_PROCESS, 0);
+    struct rlimit limit;
+    if (getrlimit (RLIMIT_NICE, &limit) == 0) {
+        // the lowest nice value we may set is 20 - rlim_cur
+        pool->can_renice = limit.rlim_cur == RLIM_INFINITY
+            || pool->base_nice >= 20 - (int)limit.rlim_cur;
+    }
 
-    uint32_t num_cpus = g_get_num_processors ();
-    for (uint32_t i = 0; i < num_cpus; i++) {
-        thread_context_t *ctx = thread_context_new ();
-        if (ctx) {
-            pool->threads = g_list_prepend (pool->threads, ctx);
-            pool->num_threads++;
+    FsearchCpuTopology *topology = fsearch_cpu_topology_new ();
+    const FsearchCpu **cpus = NULL;
+    pool->num_threads = thread_pool_select_cpus (topology, policy, num_threads, cpu_list, &cpus);
+    pool->num_nodes = topology->num_nodes;
+    pool->workers = g_new0 (worker_t *, pool->num_threads);
+    for (uint32_t i = 0; i < pool->num_threads; i++) {
+        worker_t *worker = g_new0 (worker_t, 1);
+        worker->pool = pool;
+        worker->id = i;
+        worker->rand_state = 2654435761u * (i + 1);
+        worker->priority = FSEARCH_TASK_PRIORITY_INTERACTIVE;
+        worker->cpu = cpus[i] ? (int32_t)cpus[i]->id : -1;
+        worker->node = cpus[i] ? cpus[i]->node : 0;
+        for (uint32_t j = 0; j < NUM_PRIORITIES; j++) {
+            atomic_init (&worker->deques[j].top, 0);
+            atomic_init (&worker->deques[j].bottom, 0);
+            g_queue_init (&worker->mailbox[j]);
         }
+        atomic_init (&worker->num_mailbox, 0);
+        atomic_init (&worker->running, false);
+        pool->workers[i] = worker;
+    }
+    trace ("thread pool: %d threads%s\n", pool->num_threads, cpus[0] ? ", pinned" : "");
+    g_free (cpus);
+    cpus = NULL;
+    fsearch_cpu_topology_free (topology);
+    topology = NULL;
+
+    // all workers must exist before the first one starts stealing
+    for (uint32_t i = 0; i < pool->num_threads; i++) {
+        pool->workers[i]->thread = g_thread_new ("thread pool",
+                                                 fsearch_thread_pool_thread,
+                                                 pool->workers[i]);
     }
 
     return pool;
@@ -142,118 +600,404 @@ fsearch_thread_pool_free (FsearchThreadPool *pool)
     if (!pool) {
         return;
     }
-    GList *thread = pool->threads;
-    for (uint32_t i = 0; thread && i < pool->num_threads; i++) {
-        thread_context_t *ctx = thread->data;
-        thread_context_free (ctx);
-        thread = thread->next;
+    if (atomic_load (&pool->num_detached) > 0) {
+        trace ("thread pool: waiting for %d tasks\n", atomic_load (&pool->num_detached));
+    }
+
+    g_mutex_lock (&pool->mutex);
+    pool->terminate = true;
+    g_cond_broadcast (&pool->wake_cond);
+    g_mutex_unlock (&pool->mutex);
+
+    // workers steal from each other until the last one is done
+    for (uint32_t i = 0; i < pool->num_threads; i++) {
+        g_thread_join (pool->workers[i]->thread);
+    }
+    for (uint32_t i = 0; i < pool->num_threads; i++) {
+        g_free (pool->workers[i]);
+        pool->workers[i] = NULL;
     }
+    g_free (pool->workers);
+    pool->workers = NULL;
     pool->num_threads = 0;
+
+    g_mutex_clear (&pool->mutex);
+    g_cond_clear (&pool->wake_cond);
     g_free (pool);
     pool = NULL;
 }
 
-GList *
-fsearch_thread_pool_get_threads (FsearchThreadPool *pool)
+uint32_t
+fsearch_thread_pool_get_num_threads (FsearchThreadPool *pool)
 {
     if (!pool) {
-        return NULL;
+        return 0;
     }
-    return pool->threads;
+    return pool->num_threads;
 }
 
-gpointer
-fsearch_thread_pool_get_data (FsearchThreadPool *pool, GList *thread)
+void
+fsearch_thread_pool_set_lower_background_priority (FsearchThreadPool *pool, bool enable)
 {
-    if (!pool || !thread) {
-        return NULL;
-    }
-    if (!thread_pool_has_thread (pool, thread)) {
-        return NULL;
-    }
-    thread_context_t *ctx = thread->data;
-    if (!ctx) {
-        return NULL;
-    }
-    return ctx->thread_data;
+    assert (pool != NULL);
+    pool->lower_background_priority = enable;
 }
 
-bool
-fsearch_thread_pool_task_is_idle (FsearchThreadPool *pool, GList *thread)
+void
+fsearch_thread_pool_yield (void)
 {
-    bool res = false;
-    if (!thread_pool_has_thread (pool, thread)) {
-        return res;
+    worker_t *self = current_worker;
+    if (!self || self->priority != FSEARCH_TASK_PRIORITY_BACKGROUND) {
+        return;
     }
-    thread_context_t *ctx = thread->data;
-    if (!ctx) {
-        return res;
+    FsearchThreadPool *pool = self->pool;
+    while (atomic_load (&pool->num_interactive_queued) > 0) {
+        task_t *task = thread_pool_find_task (pool, self, FSEARCH_TASK_PRIORITY_INTERACTIVE);
+        if (!task) {
+            break;
+        }
+        task_run (pool, task);
     }
+}
 
-    res = ctx->status == THREAD_IDLE ? true : false;
+void
+fsearch_thread_pool_push (FsearchThreadPool *pool,
+                          FsearchTaskPriority priority,
+                          ThreadFunc func,
+                          gpointer data)
+{
+    assert (pool != NULL);
+    assert (func != NULL);
+
+    task_t *task = g_new0 (task_t, 1);
+    task->func = func;
+    task->data = data;
+    task->priority = priority;
+    atomic_fetch_add (&pool->num_detached, 1);
+    thread_pool_submit (pool, task);
+}
 
-    return res;
+FsearchTaskGroup *
+fsearch_task_group_new (FsearchThreadPool *pool)
+{
+    assert (pool != NULL);
+
+    FsearchTaskGroup *group = g_new0 (FsearchTaskGroup, 1);
+    group->pool = pool;
+    group->priority = current_priority (pool);
+    atomic_init (&group->num_pending, 0);
+    g_mutex_init (&group->mutex);
+    g_cond_init (&group->finished_cond);
+    return group;
 }
 
-bool
-fsearch_thread_pool_task_is_busy (FsearchThreadPool *pool, GList *thread)
+void
+fsearch_task_group_free (FsearchTaskGroup *group)
 {
-    bool res = false;
-    if (!thread_pool_has_thread (pool, thread)) {
-        return res;
+    if (!group) {
+        return;
     }
-    thread_context_t *ctx = thread->data;
-    if (!ctx) {
-        return res;
+    assert (atomic_load (&group->num_pending) == 0);
+
+    g_mutex_clear (&group->mutex);
+    g_cond_clear (&group->finished_cond);
+    g_free (group);
+    group = NULL;
+}
+
+void
+fsearch_task_group_push (FsearchTaskGroup *group, ThreadFunc func, gpointer data)
+{
+    assert (group != NULL);
+    assert (func != NULL);
+
+    task_t *task = g_new0 (task_t, 1);
+    task->func = func;
+    task->data = data;
+    task->group = group;
+    task->priority = group->priority;
+    atomic_fetch_add (&group->num_pending, 1);
+    thread_pool_submit (group->pool, task);
+}
+
+void
+fsearch_task_group_push_to_worker (FsearchTaskGroup *group,
+                                   uint32_t worker,
+                                   ThreadFunc func,
+                                   gpointer data)
+{
+    assert (group != NULL);
+    assert (func != NULL);
+
+    FsearchThreadPool *pool = group->pool;
+    task_t *task = g_new0 (task_t, 1);
+    task->func = func;
+    task->data = data;
+    task->group = group;
+    task->priority = group->priority;
+    task->affinity = pool->workers[worker % pool->num_threads];
+    atomic_fetch_add (&group->num_pending, 1);
+    thread_pool_submit (pool, task);
+}
+
+void
+fsearch_task_group_wait (FsearchTaskGroup *group)
+{
+    assert (group != NULL);
+
+    FsearchThreadPool *pool = group->pool;
+    worker_t *self = current_worker;
+    if (self && self->pool != pool) {
+        self = NULL;
     }
 
-    res = ctx->status == THREAD_BUSY ? true : false;
+    while (atomic_load (&group->num_pending) > 0) {
+        if (self) {
+            // a blocked worker could deadlock the pool, so help instead,
+            // but interactive tasks mustn't wait for background work
+            task_t *task = thread_pool_find_task (pool, self, group->priority);
+            if (task) {
+                task_run (pool, task);
+                continue;
+            }
+        }
+        g_mutex_lock (&group->mutex);
+        if (atomic_load (&group->num_pending) > 0) {
+            if (self) {
+                g_cond_wait_until (&group->finished_cond,
+                                   &group->mutex,
+                                   g_get_monotonic_time () + GROUP_WAIT_INTERVAL);
+            }
+            else {
+                g_cond_wait (&group->finished_cond, &group->mutex);
+            }
+        }
+        g_mutex_unlock (&group->mutex);
+    }
+    // wait for the last task to release the group
+    g_mutex_lock (&group->mutex);
+    g_mutex_unlock (&group->mutex);
+}
 
-    return res;
+static gpointer
+range_task_run (gpointer user_data)
+{
+    range_task_t *range = user_data;
+
+    // split off the upper half until the rest is small enough, idle
+    // workers steal the halves, largest first
+    while (range->end - range->start > range->grain) {
+        const uint32_t mid = range->start + (range->end - range->start) / 2;
+        range_task_t *upper = g_new (range_task_t, 1);
+        *upper = *range;
+        upper->start = mid;
+        range->end = mid;
+        fsearch_task_group_push (range->group, range_task_run, upper);
+    }
+    range->func (range->start, range->end, range->data);
+    g_free (range);
+    range = NULL;
+    return NULL;
 }
 
-bool
-fsearch_thread_pool_wait_for_thread (FsearchThreadPool *pool, GList *thread)
+void
+fsearch_thread_pool_parallel_for (FsearchThreadPool *pool,
+                                  uint32_t start,
+                                  uint32_t end,
+                                  uint32_t grain,
+                                  FsearchRangeFunc func,
+                                  gpointer data)
 {
-    thread_context_t *ctx = thread->data;
-    g_mutex_lock (&ctx->mutex);
-    while (fsearch_thread_pool_task_is_busy (pool, thread)) {
-        trace ("waiting...\n");
-        g_cond_wait (&ctx->finished_cond, &ctx->mutex);
+    assert (func != NULL);
+
+    if (start >= end) {
+        return;
     }
-    g_mutex_unlock (&ctx->mutex);
-    return true;
+    grain = MAX (grain, 1);
+    if (!pool || end - start <= grain) {
+        func (start, end, data);
+        return;
+    }
+
+    FsearchTaskGroup *group = fsearch_task_group_new (pool);
+    range_task_t *range = g_new (range_task_t, 1);
+    *range = (range_task_t){group, func, data, start, end, grain};
+    fsearch_task_group_push (group, range_task_run, range);
+    fsearch_task_group_wait (group);
+    fsearch_task_group_free (group);
+    group = NULL;
+}
+
+// worker i owns the items x with x * num_threads / num_items == i, which
+// starts at the first item with x * num_threads >= i * num_items
+static uint32_t
+worker_part_start (uint32_t worker, uint32_t num_threads, uint32_t num_items)
+{
+    return ((uint64_t)worker * num_items + num_threads - 1) / num_threads;
 }
 
 uint32_t
-fsearch_thread_pool_get_num_threads (FsearchThreadPool *pool)
+fsearch_thread_pool_get_worker_for_item (FsearchThreadPool *pool, uint32_t item, uint32_t num_items)
 {
-    if (!pool) {
+    if (!pool || num_items == 0) {
         return 0;
     }
-    return pool->num_threads;
+    return MIN ((uint64_t)item * pool->num_threads / num_items, pool->num_threads - 1);
 }
 
-bool
-fsearch_thread_pool_push_data (FsearchThreadPool *pool,
-                               GList *thread,
-                               ThreadFunc thread_func,
-                               gpointer thread_data)
+typedef struct worker_part_s {
+    FsearchRangeFunc func;
+    gpointer data;
+    uint32_t start;
+    uint32_t end;
+} worker_part_t;
+
+static gpointer
+worker_part_run (gpointer user_data)
 {
-    if (!pool || !thread || !thread_func || !thread_data) {
-        return false;
+    worker_part_t *part = user_data;
+    part->func (part->start, part->end, part->data);
+    return NULL;
+}
+
+void
+fsearch_thread_pool_parallel_for_workers (FsearchThreadPool *pool,
+                                          uint32_t start,
+                                          uint32_t end,
+                                          FsearchRangeFunc func,
+                                          gpointer data)
+{
+    assert (func != NULL);
+
+    if (start >= end) {
+        return;
     }
-    if (!thread_pool_has_thread (pool, thread)) {
-        return false;
+    if (!pool) {
+        func (start, end, data);
+        return;
     }
-    thread_context_t *ctx = thread->data;
-    g_mutex_lock (&ctx->mutex);
-    ctx->thread_func = thread_func;
-    ctx->thread_data = thread_data;
-    ctx->status = THREAD_BUSY;
 
-    g_cond_signal (&ctx->start_cond);
-    g_mutex_unlock (&ctx->mutex);
-    return true;
+    const uint32_t num_threads = pool->num_threads;
+    const uint32_t num_items = end - start;
+    worker_part_t *parts = g_new0 (worker_part_t, num_threads);
+    FsearchTaskGroup *group = fsearch_task_group_new (pool);
+    for (uint32_t i = 0; i < num_threads; i++) {
+        parts[i].func = func;
+        parts[i].data = data;
+        parts[i].start = start + worker_part_start (i, num_threads, num_items);
+        parts[i].end = start + worker_part_start (i + 1, num_threads, num_items);
+        if (parts[i].start < parts[i].end) {
+            fsearch_task_group_push_to_worker (group, i, worker_part_run, &parts[i]);
+        }
+    }
+    fsearch_task_group_wait (group);
+    fsearch_task_group_free (group);
+    group = NULL;
+    g_free (parts);
+    parts = NULL;
 }
 
+static gpointer
+sort_run (gpointer user_data)
+{
+    sort_job_t *job = user_data;
+    qsort_r (job->src + job->start * job->item_size,
+             job->end - job->start,
+             job->item_size,
+             job->compare,
+             job->data);
+    return NULL;
+}
+
+static gpointer
+merge_runs (gpointer user_data)
+{
+    sort_job_t *job = user_data;
+    const size_t size = job->item_size;
+    size_t i = job->start;
+    size_t j = job->mid;
+    char *dest = job->dest + job->start * size;
+    while (i < job->mid && j < job->end) {
+        // take from the first run on ties, so the merge is stable
+        if (job->compare (job->src + i * size, job->src + j * size, job->data) <= 0) {
+            memcpy (dest, job->src + i * size, size);
+            i++;
+        }
+        else {
+            memcpy (dest, job->src + j * size, size);
+            j++;
+        }
+        dest += size;
+    }
+    memcpy (dest, job->src + i * size, (job->mid - i) * size);
+    dest += (job->mid - i) * size;
+    memcpy (dest, job->src + j * size, (job->end - j) * size);
+    return NULL;
+}
+
+static void
+run_sort_jobs (FsearchThreadPool *pool, ThreadFunc func, sort_job_t *jobs, uint32_t num_jobs)
+{
+    if (num_jobs == 1) {
+        func (&jobs[0]);
+        return;
+    }
+    FsearchTaskGroup *group = fsearch_task_group_new (pool);
+    for (uint32_t i = 0; i < num_jobs; i++) {
+        fsearch_task_group_push (group, func, &jobs[i]);
+    }
+    fsearch_task_group_wait (group);
+    fsearch_task_group_free (group);
+    group = NULL;
+}
+
+void
+fsearch_thread_pool_sort (FsearchThreadPool *pool,
+                          void *base,
+                          size_t num_items,
+                          size_t item_size,
+                          FsearchCompareFunc compare,
+                          void *data)
+{
+    assert (base != NULL || num_items == 0);
+    assert (compare != NULL);
+
+    uint32_t num_runs = MIN (fsearch_thread_pool_get_num_threads (pool),
+                             num_items / SORT_MIN_ITEMS_PER_RUN + 1);
+    if (num_runs <= 1) {
+        qsort_r (base, num_items, item_size, compare, data);
+        return;
+    }
+
+    size_t bounds[num_runs + 1];
+    for (uint32_t i = 0; i <= num_runs; i++) {
+        bounds[i] = num_items * i / num_runs;
+    }
+
+    sort_job_t jobs[num_runs];
+    for (uint32_t i = 0; i < num_runs; i++) {
+        jobs[i] = (sort_job_t){base, NULL, item_size, compare, data, bounds[i], bounds[i + 1], bounds[i + 1]};
+    }
+    run_sort_jobs (pool, sort_run, jobs, num_runs);
+
+    char *src = base;
+    char *dest = g_malloc (num_items * item_size);
+    char *buffer = dest;
+    for (uint32_t width = 1; width < num_runs; width *= 2) {
+        uint32_t num_jobs = 0;
+        for (uint32_t i = 0; i < num_runs; i += 2 * width) {
+            const uint32_t mid = MIN (i + width, num_runs);
+            const uint32_t end = MIN (i + 2 * width, num_runs);
+            jobs[num_jobs++] = (sort_job_t){src, dest, item_size, compare, data, bounds[i], bounds[mid], bounds[end]};
+        }
+        run_sort_jobs (pool, merge_runs, jobs, num_jobs);
+        char *tmp = src;
+        src = dest;
+        dest = tmp;
+    }
+    if (src != base) {
+        memcpy (base, src, num_items * item_size);
+    }
+    g_free (buffer);
+    buffer = NULL;
+}
@@ -22,44 +22,132 @@
 #include <stdint.h>
 #include <glib.h>
 
+// A fixed set of worker threads which run tasks, pinned to one cpu each
+// unless the all cpus policy is used. Every worker has its own deque of
+// tasks: it pushes and pops tasks at the bottom, while idle workers steal
+// from the top of the others. Tasks pushed from outside the pool go
+// through a shared queue.
+//
+// Interactive tasks always run before background tasks. Tasks and groups
+// created by a task inherit its priority, those created outside the pool
+// are interactive.
+//
+// Tasks can be meant for a specific worker, which then runs them unless it
+// is busy. Together with the kernel placing memory on the numa node of the
+// thread which touches it first, this keeps passes over large arrays local:
+// the worker which filled a part of the array scans it later on, as long
+// as the workers are pinned.
+
 typedef struct _FsearchThreadPool FsearchThreadPool;
+typedef struct _FsearchTaskGroup FsearchTaskGroup;
 typedef GThreadFunc ThreadFunc;
 
 typedef enum {
-    THREAD_IDLE,
-    THREAD_BUSY,
-    THREAD_FINISHED
-} FsearchThreadStatus;
+    // one thread per physical core, smt siblings stay idle
+    FSEARCH_THREAD_POOL_POLICY_PHYSICAL_CORES,
+    // one thread per logical cpu, placed by the scheduler
+    FSEARCH_THREAD_POOL_POLICY_ALL_CPUS,
+    // a given number of threads on a given list of cpus
+    FSEARCH_THREAD_POOL_POLICY_CUSTOM,
+} FsearchThreadPoolPolicy;
+
+typedef enum {
+    FSEARCH_TASK_PRIORITY_INTERACTIVE,
+    FSEARCH_TASK_PRIORITY_BACKGROUND,
+} FsearchTaskPriority;
 
+// processes the items [start, end)
+typedef void (*FsearchRangeFunc)(uint32_t start, uint32_t end, gpointer data);
+
+// same as the comparison function of qsort_r
+typedef int (*FsearchCompareFunc)(const void *a, const void *b, void *data);
+
+// Only cpus this process may run on are used. With the custom policy
+// num_threads of 0 means one thread per cpu in cpu_list (like "0-3,8"),
+// threads are assigned to those cpus round robin; without a cpu_list the
+// threads aren't pinned. The other policies ignore both arguments.
 FsearchThreadPool *
-fsearch_thread_pool_init (void);
+fsearch_thread_pool_init (FsearchThreadPoolPolicy policy, uint32_t num_threads, const char *cpu_list);
 
+// waits for all queued tasks to finish
 void
 fsearch_thread_pool_free (FsearchThreadPool *pool);
 
-GList *
-fsearch_thread_pool_get_threads (FsearchThreadPool *pool);
-
 uint32_t
 fsearch_thread_pool_get_num_threads (FsearchThreadPool *pool);
 
-bool
-fsearch_thread_pool_push_data (FsearchThreadPool *pool,
-                               GList *thread,
-                               ThreadFunc thread_func,
-                               gpointer thread_data);
+// lets workers lower their cpu (nice) and i/o priority while they run
+// background tasks
+void
+fsearch_thread_pool_set_lower_background_priority (FsearchThreadPool *pool, bool enable);
 
-bool
-fsearch_thread_pool_wait_for_thread (FsearchThreadPool *pool, GList *thread);
+// called by long running background tasks at convenient points, runs the
+// interactive tasks which are waiting for a worker; a no-op outside of
+// background tasks
+void
+fsearch_thread_pool_yield (void);
 
-bool
-fsearch_thread_pool_task_is_busy (FsearchThreadPool *pool, GList *thread);
+// runs func (data) on the pool without a way to wait for it
+void
+fsearch_thread_pool_push (FsearchThreadPool *pool,
+                          FsearchTaskPriority priority,
+                          ThreadFunc func,
+                          gpointer data);
 
-bool
-fsearch_thread_pool_task_is_idle (FsearchThreadPool *pool, GList *thread);
+// calls func on chunks of [start, end) of at most grain items in parallel
+// and returns when all are done; without a pool func runs on all items
+void
+fsearch_thread_pool_parallel_for (FsearchThreadPool *pool,
+                                  uint32_t start,
+                                  uint32_t end,
+                                  uint32_t grain,
+                                  FsearchRangeFunc func,
+                                  gpointer data);
+
+// splits [start, end) into one part per worker, in worker order, and calls
+// func on every part, preferably on its worker; without a pool func runs on
+// all items
+void
+fsearch_thread_pool_parallel_for_workers (FsearchThreadPool *pool,
+                                          uint32_t start,
+                                          uint32_t end,
+                                          FsearchRangeFunc func,
+                                          gpointer data);
+
+// the worker whose part of [0, num_items) contains item, when split by
+// fsearch_thread_pool_parallel_for_workers
+uint32_t
+fsearch_thread_pool_get_worker_for_item (FsearchThreadPool *pool, uint32_t item, uint32_t num_items);
+
+// sorts like qsort_r, but sorts runs of the array in parallel and merges
+// them, pairs of runs in parallel as well; without a pool it's just qsort_r
+void
+fsearch_thread_pool_sort (FsearchThreadPool *pool,
+                          void *base,
+                          size_t num_items,
+                          size_t item_size,
+                          FsearchCompareFunc compare,
+                          void *data);
+
+FsearchTaskGroup *
+fsearch_task_group_new (FsearchThreadPool *pool);
+
+// the group must have been waited for
+void
+fsearch_task_group_free (FsearchTaskGroup *group);
 
-gpointer
-fsearch_thread_pool_get_data (FsearchThreadPool *pool, GList *thread);
+void
+fsearch_task_group_push (FsearchTaskGroup *group, ThreadFunc func, gpointer data);
 
-bool
-fsearch_thread_pool_set_task_finished (FsearchThreadPool *pool, GList *thread);
+// like fsearch_task_group_push, but the task preferably runs on the given
+// worker
+void
+fsearch_task_group_push_to_worker (FsearchTaskGroup *group,
+                                   uint32_t worker,
+                                   ThreadFunc func,
+                                   gpointer data);
+
+// returns when all tasks of the group have finished; workers run other
+// tasks in the meantime, so tasks may wait for groups of their own
+void
+fsearch_task_group_wait (FsearchTaskGroup *group);
@@ -29,6 +29,11 @@
 #include "listview.h"
 #include "debug.h"
 
+// searches faster than this run on every keystroke, slower ones are delayed
+// until typing pauses for about as long as a search takes
+#define SEARCH_LATENCY_THRESHOLD (10 * G_TIME_SPAN_MILLISECOND)
+#define SEARCH_MAX_DELAY_MS 250
+
 struct _FsearchApplicationWindow {
     GtkApplicationWindow parent_instance;
     DatabaseSearch *search;
@@ -70,6 +75,11 @@ struct _FsearchApplicationWindow {
 
     ListModel *list_model;
 
+    // pending (delayed or retried) search, 0 if there's none
+    guint search_timeout_id;
+    // moving average of the recent search times in microseconds
+    int64_t search_latency;
+
     GMutex mutex;
 };
 
@@ -135,6 +145,12 @@ fsearch_application_window_prepare_shutdown (gpointer self)
     gtk_window_get_size (GTK_WINDOW (self), &width, &height);
     config->window_width = width;
     config->window_height = height;
+
+    FsearchApplicationWindow *win = self;
+    if (win->search) {
+        // the search service goes away with the application
+        db_search_cancel (win->search);
+    }
 }
 
 void
@@ -202,6 +218,10 @@ fsearch_application_window_finalize (GObject *object)
     FsearchApplicationWindow *self = (FsearchApplicationWindow *)object;
     g_assert (FSEARCH_WINDOW_IS_WINDOW (self));
 
+    if (self->search_timeout_id) {
+        g_source_remove (self->search_timeout_id);
+        self->search_timeout_id = 0;
+    }
     if (self->search) {
         db_search_free (self->search);
         self->search = NULL;
@@ -213,16 +233,20 @@ fsearch_application_window_finalize (GObject *object)
 }
 
 static void
-reset_sort_order (FsearchApplicationWindow *win)
+reset_sort_order (FsearchApplicationWindow *win, bool ranked)
 {
     g_assert (FSEARCH_WINDOW_IS_WINDOW (win));
 
+    // results arrive sorted by name, or by relevance when they're ranked
+    win->list_model->sort_id = ranked ? SORT_ID_RELEVANCE : SORT_ID_NAME;
+    win->list_model->sort_order = GTK_SORT_ASCENDING;
+
     GList *list = gtk_tree_view_get_columns (GTK_TREE_VIEW (win->listview));
     GList *l;
     for (l = list; l != NULL; l = l->next)
     {
         GtkTreeViewColumn *col = GTK_TREE_VIEW_COLUMN (l->data);
-        if (l == list) {
+        if (l == list && !ranked) {
             gtk_tree_view_column_set_sort_order (col, GTK_SORT_ASCENDING);
             gtk_tree_view_column_set_sort_indicator (col, TRUE);
             gtk_tree_view_column_set_sort_column_id (col, SORT_ID_NAME);
@@ -283,45 +307,105 @@ update_statusbar (FsearchApplicationWindow *win, const char *text)
     gtk_label_set_text (GTK_LABEL (win->search_label), text);
 }
 
-gboolean
-update_model_cb (gpointer user_data)
+static void
+replace_results (FsearchApplicationWindow *win, DatabaseSearchResult *result)
 {
-    DatabaseSearchResult *result = user_data;
-    FsearchApplicationWindow *win = result->cb_data;
-    FsearchApplication *app = FSEARCH_APPLICATION_DEFAULT;
-    FsearchConfig *config = fsearch_application_get_config (app);
-
     remove_model_from_list (win);
     db_search_results_clear (win->search);
 
-    uint32_t num_results = 0;
+    // the results keep the database they point into alive, even if a
+    // newer one has been published since
+    win->search->results_db = result->db;
+    result->db = NULL;
+
     GPtrArray *results = result->results;
     if (results) {
         list_set_results (win->list_model, results);
         win->search->results = results;
         win->search->num_folders = result->num_folders;;
         win->search->num_files = result->num_files;
-        num_results = results->len;
     }
     else {
         list_set_results (win->list_model, NULL);
         win->search->results = NULL;
         win->search->num_folders = 0;
         win->search->num_files = 0;
-        num_results = 0;
     }
+    result->results = NULL;
 
     apply_model_to_list (win);
-    gchar sb_text[100] = "";
-    snprintf (sb_text, sizeof (sb_text), "%'d Items", num_results);
-    update_statusbar (win, sb_text);
-    reset_sort_order (win);
+    reset_sort_order (win, result->ranked);
+}
+
+// Past this many new rows the model is detached while they're appended,
+// one row-inserted signal per row would take much longer than letting
+// the view pick up the whole model again
+#define APPEND_RESULTS_MAX_INSERTED_ROWS 4096
+
+// a progressive search continues the results it delivered before
+static void
+append_results (FsearchApplicationWindow *win, DatabaseSearchResult *result)
+{
+    // the shown results hold a reference on the same database already
+    if (result->db) {
+        db_unref (result->db);
+        result->db = NULL;
+    }
+    const bool detach = result->results->len > APPEND_RESULTS_MAX_INSERTED_ROWS;
+    if (detach) {
+        remove_model_from_list (win);
+    }
+    list_model_append_results (win->list_model, result->results, !detach);
+    if (detach) {
+        apply_model_to_list (win);
+    }
+    result->results = NULL;
+    win->search->num_folders = result->num_folders;
+    win->search->num_files = result->num_files;
+}
+
+gboolean
+update_model_cb (gpointer user_data)
+{
+    DatabaseSearchResult *result = user_data;
+    FsearchApplicationWindow *win = result->cb_data;
+    FsearchApplication *app = FSEARCH_APPLICATION_DEFAULT;
+    FsearchConfig *config = fsearch_application_get_config (app);
+
+    if (result->append && win->search->results && result->results) {
+        append_results (win, result);
+    }
+    else {
+        replace_results (win, result);
+    }
+    const uint32_t num_results = win->search->results ? win->search->results->len : 0;
+    if (!result->partial) {
+        win->search_latency = (3 * win->search_latency + result->search_time) / 4;
+    }
+
+    if (result->error_message) {
+        update_statusbar (win, result->error_message);
+        g_free (result->error_message);
+        result->error_message = NULL;
+    }
+    else {
+        // limited searches still count all matches
+        const uint32_t num_matches = result->num_matched_folders + result->num_matched_files;
+        gchar sb_text[100] = "";
+        if (num_matches > num_results) {
+            snprintf (sb_text, sizeof (sb_text), "%'d of %'d Items", num_results, num_matches);
+        }
+        else {
+            snprintf (sb_text, sizeof (sb_text), "%'d Items", num_results);
+        }
+        update_statusbar (win, sb_text);
+    }
 
     const gchar *text = gtk_entry_get_text (GTK_ENTRY (win->search_entry));
     if (text[0] == '\0' && config->hide_results_on_empty_search) {
         show_overlay (win, NO_SEARCH_QUERY_OVERLAY);
     }
-    else if (num_results == 0) {
+    else if (num_results == 0 && !result->partial) {
         show_overlay (win, NO_SEARCH_RESULTS_OVERLAY);
     }
     else {
@@ -339,6 +423,39 @@ fsearch_application_window_update_results (void *data)
     g_idle_add (update_model_cb, data);
 }
 
+static gboolean
+search_timeout_cb (gpointer user_data)
+{
+    FsearchApplicationWindow *win = user_data;
+    g_assert (FSEARCH_WINDOW_IS_WINDOW (win));
+
+    win->search_timeout_id = 0;
+    perform_search (win);
+    return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_search (FsearchApplicationWindow *win, guint delay_ms)
+{
+    if (win->search_timeout_id) {
+        g_source_remove (win->search_timeout_id);
+    }
+    win->search_timeout_id = g_timeout_add (delay_ms, search_timeout_cb, win);
+}
+
+static void
+schedule_search_as_you_type (FsearchApplicationWindow *win)
+{
+    if (win->search_latency < SEARCH_LATENCY_THRESHOLD) {
+        perform_search (win);
+        return;
+    }
+    // every keystroke restarts the delay, so fast typing is coalesced into
+    // a single search for the final query
+    const int64_t delay = win->search_latency / G_TIME_SPAN_MILLISECOND;
+    schedule_search (win, MIN (delay, SEARCH_MAX_DELAY_MS));
+}
+
 static gboolean
 perform_search (FsearchApplicationWindow *win)
 {
@@ -353,10 +470,15 @@ perform_search (FsearchApplicationWindow *win)
     }
 
     Database *db = fsearch_application_get_db (app);
-    if (!db_try_lock (db)) {
-        trace ("search: database locked\n");
+    if (!db) {
+        // searches once the database is loaded
         return FALSE;
     }
+    if (win->search_timeout_id) {
+        // the current query supersedes the pending one
+        g_source_remove (win->search_timeout_id);
+        win->search_timeout_id = 0;
+    }
     //g_mutex_lock (&win->mutex);
 
     const gchar *text = gtk_entry_get_text (GTK_ENTRY (win->search_entry));
@@ -364,32 +486,39 @@ perform_search (FsearchApplicationWindow *win)
     uint32_t max_results = config->limit_results ? config->num_results : 0;
     if (win->search) {
         db_search_update (win->search,
-                          db_get_entries (db),
-                          db_get_num_entries (db),
+                          db,
                           max_results,
                           filter,
                           text,
                           config->hide_results_on_empty_search,
                           config->match_case,
                           config->enable_regex,
+                          config->enable_fuzzy,
+                          config->rank_by_relevance,
                           config->auto_search_in_path,
-                          config->search_in_path);
+                          config->search_in_path,
+                          config->exclude_hidden_items);
     }
     else {
-        win->search = db_search_new (fsearch_application_get_thread_pool (app),
-                                     db_get_entries (db),
-                                     db_get_num_entries (db),
+        win->search = db_search_new (fsearch_application_get_search_service (app),
+                                     db,
                                      max_results,
                                      filter,
                                      text,
                                      config->hide_results_on_empty_search,
                                      config->match_case,
                                      config->enable_regex,
+                                     config->enable_fuzzy,
+                                     config->rank_by_relevance,
                                      config->auto_search_in_path,
-                                     config->search_in_path);
+                                     config->search_in_path,
+                                     config->exclude_hidden_items);
     }
+    db_search_service_set_result_cache_size (fsearch_application_get_search_service (app),
+                                             (size_t)config->result_cache_size * 1024 * 1024);
+    db_search_service_set_progressive (fsearch_application_get_search_service (app),
+                                       config->progressive_results);
     db_perform_search (win->search, fsearch_application_window_update_results, win);
-    db_unlock (db);
     return FALSE;
 }
 
@@ -627,7 +756,7 @@ on_search_entry_changed (GtkEntry *entry, gpointer user_data)
 
     FsearchConfig *config = fsearch_application_get_config (FSEARCH_APPLICATION_DEFAULT);
     if (config->search_as_you_type) {
-        perform_search (win);
+        schedule_search_as_you_type (win);
     }
 }
 
@@ -734,7 +863,21 @@ updated_database_cb (gpointer data, gpointer user_data)
     strftime (db_text, sizeof(db_text),
              "Last Updated: %Y-%m-%d %H:%M", //"%Y-%m-%d %H:%M",
              localtime (&timestamp));
-    gtk_widget_set_tooltip_text (win->database_toggle_button, db_text);
+
+    size_t index_size = 0;
+    int64_t index_build_time = 0;
+    if (db_get_suffix_index_stats (db, &index_size, &index_build_time)) {
+        gchar *tooltip = g_strdup_printf ("%s\nSubstring Index: %.1f MiB, built in %.1f s",
+                                          db_text,
+                                          index_size / (1024.0 * 1024.0),
+                                          index_build_time / (double)G_USEC_PER_SEC);
+        gtk_widget_set_tooltip_text (win->database_toggle_button, tooltip);
+        g_free (tooltip);
+        tooltip = NULL;
+    }
+    else {
+        gtk_widget_set_tooltip_text (win->database_toggle_button, db_text);
+    }
 }
 
 static void
@@ -743,7 +886,11 @@ update_database_cb (gpointer data, gpointer user_data)
     FsearchApplicationWindow *win = (FsearchApplicationWindow *) user_data;
     g_assert (FSEARCH_WINDOW_IS_WINDOW (win));
 
-    show_overlay (win, DATABASE_UPDATING_OVERLAY);
+    // during a rebuild the current database can still be searched, the
+    // results are only hidden while there's none yet
+    if (!fsearch_application_get_db (FSEARCH_APPLICATION_DEFAULT)) {
+        show_overlay (win, DATABASE_UPDATING_OVERLAY);
+    }
 
     gtk_stack_set_visible_child (GTK_STACK (win->database_stack), win->database_box1);
     gtk_spinner_start (GTK_SPINNER (win->database_spinner));
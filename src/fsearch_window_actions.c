@@ -329,6 +329,36 @@ fsearch_window_action_search_mode (GSimpleAction *action,
     }
 }
 
+static void
+fsearch_window_action_fuzzy_mode (GSimpleAction *action,
+                                  GVariant      *variant,
+                                  gpointer       user_data)
+{
+    FsearchApplicationWindow *self = user_data;
+    g_simple_action_set_state (action, variant);
+    FsearchConfig *config = fsearch_application_get_config (FSEARCH_APPLICATION_DEFAULT);
+    bool enable_fuzzy_old = config->enable_fuzzy;
+    config->enable_fuzzy = g_variant_get_boolean (variant);
+    if (enable_fuzzy_old != config->enable_fuzzy) {
+        g_idle_add (fsearch_application_window_update_search, self);
+    }
+}
+
+static void
+fsearch_window_action_rank_by_relevance (GSimpleAction *action,
+                                         GVariant      *variant,
+                                         gpointer       user_data)
+{
+    FsearchApplicationWindow *self = user_data;
+    g_simple_action_set_state (action, variant);
+    FsearchConfig *config = fsearch_application_get_config (FSEARCH_APPLICATION_DEFAULT);
+    bool rank_by_relevance_old = config->rank_by_relevance;
+    config->rank_by_relevance = g_variant_get_boolean (variant);
+    if (rank_by_relevance_old != config->rank_by_relevance) {
+        g_idle_add (fsearch_application_window_update_search, self);
+    }
+}
+
 static void
 fsearch_window_action_match_case (GSimpleAction *action,
                                   GVariant      *variant,
@@ -485,6 +515,8 @@ static GActionEntry FsearchWindowActions[] = {
     // Search
     { "search_in_path", action_toggle_state_cb, NULL, "true", fsearch_window_action_search_in_path },
     { "search_mode", action_toggle_state_cb, NULL, "true", fsearch_window_action_search_mode },
+    { "fuzzy_mode", action_toggle_state_cb, NULL, "true", fsearch_window_action_fuzzy_mode },
+    { "rank_by_relevance", action_toggle_state_cb, NULL, "true", fsearch_window_action_rank_by_relevance },
     { "match_case", action_toggle_state_cb, NULL, "true", fsearch_window_action_match_case },
 };
 
@@ -535,6 +567,8 @@ fsearch_window_actions_update   (FsearchApplicationWindow *self)
     action_set_active_bool (group, "show_search_button", config->show_search_button);
     action_set_active_bool (group, "search_in_path", config->search_in_path);
     action_set_active_bool (group, "search_mode", config->enable_regex);
+    action_set_active_bool (group, "fuzzy_mode", config->enable_fuzzy);
+    action_set_active_bool (group, "rank_by_relevance", config->rank_by_relevance);
     action_set_active_bool (group, "match_case", config->match_case);
     action_set_active_bool (group, "show_name_column", true);
     action_set_active_bool (group, "show_path_column", config->show_path_column);
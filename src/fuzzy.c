@@ -0,0 +1,235 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#include "fuzzy.h"
+#include "string_utils.h"
+
+// Scoring similar to the one used by fzf
+#define SCORE_MATCH 16
+#define SCORE_GAP_START -3
+#define SCORE_GAP_EXTENSION -1
+#define BONUS_BOUNDARY 8
+#define BONUS_CAMEL 7
+#define BONUS_CONSECUTIVE 4
+#define BONUS_FIRST_CHAR_MULTIPLIER 2
+
+typedef enum {
+    CHAR_DELIMITER,
+    CHAR_LOWER,
+    CHAR_UPPER,
+    CHAR_DIGIT,
+    CHAR_OTHER,
+} char_class_t;
+
+static inline char_class_t
+char_class (unsigned char c)
+{
+    if (islower (c)) {
+        return CHAR_LOWER;
+    }
+    if (isupper (c)) {
+        return CHAR_UPPER;
+    }
+    if (isdigit (c)) {
+        return CHAR_DIGIT;
+    }
+    switch (c) {
+        case '/':
+        case '_':
+        case '-':
+        case '.':
+        case ' ':
+            return CHAR_DELIMITER;
+        default:
+            return CHAR_OTHER;
+    }
+}
+
+static inline int32_t
+char_bonus (char_class_t prev, char_class_t class)
+{
+    if (prev == CHAR_DELIMITER && class != CHAR_DELIMITER) {
+        return BONUS_BOUNDARY;
+    }
+    if ((prev == CHAR_LOWER && class == CHAR_UPPER)
+        || (prev != CHAR_DIGIT && class == CHAR_DIGIT)) {
+        return BONUS_CAMEL;
+    }
+    return 0;
+}
+
+FuzzyPattern *
+fuzzy_pattern_new (const char *pattern, bool match_case)
+{
+    assert (pattern != NULL);
+
+    FuzzyPattern *new = calloc (1, sizeof (FuzzyPattern));
+    assert (new != NULL);
+
+    new->pattern = strdup (pattern);
+    new->pattern_len = strlen (pattern);
+    new->match_case = match_case;
+    if (!match_case) {
+        for (char *c = new->pattern; *c != '\0'; c++) {
+            *c = tolower (*c);
+        }
+    }
+    new->char_mask = fsearch_str_signature (new->pattern);
+    return new;
+}
+
+void
+fuzzy_pattern_free (FuzzyPattern *pattern)
+{
+    if (!pattern) {
+        return;
+    }
+    if (pattern->pattern) {
+        free (pattern->pattern);
+        pattern->pattern = NULL;
+    }
+    free (pattern);
+    pattern = NULL;
+}
+
+static inline bool
+char_equal (unsigned char a, unsigned char p, bool match_case)
+{
+    return (match_case ? a : tolower (a)) == p;
+}
+
+static int32_t
+calculate_score (FuzzyPattern *pattern,
+                 const unsigned char *haystack,
+                 size_t start,
+                 size_t end)
+{
+    const unsigned char *p = (const unsigned char *)pattern->pattern;
+    const bool match_case = pattern->match_case;
+
+    int32_t score = 0;
+    int32_t first_bonus = 0;
+    uint32_t consecutive = 0;
+    bool in_gap = false;
+    size_t pidx = 0;
+    char_class_t prev_class = start > 0 ? char_class (haystack[start - 1]) : CHAR_DELIMITER;
+
+    for (size_t idx = start; idx < end; idx++) {
+        const unsigned char c = haystack[idx];
+        const char_class_t class = char_class (c);
+        if (pidx < pattern->pattern_len && char_equal (c, p[pidx], match_case)) {
+            int32_t bonus = char_bonus (prev_class, class);
+            if (consecutive == 0) {
+                first_bonus = bonus;
+            }
+            else {
+                // a chunk of consecutive matches is as good as its first char
+                if (bonus >= BONUS_BOUNDARY && bonus > first_bonus) {
+                    first_bonus = bonus;
+                }
+                if (first_bonus > bonus) {
+                    bonus = first_bonus;
+                }
+                if (BONUS_CONSECUTIVE > bonus) {
+                    bonus = BONUS_CONSECUTIVE;
+                }
+            }
+            score += SCORE_MATCH;
+            score += pidx == 0 ? bonus * BONUS_FIRST_CHAR_MULTIPLIER : bonus;
+            in_gap = false;
+            consecutive++;
+            pidx++;
+        }
+        else {
+            score += in_gap ? SCORE_GAP_EXTENSION : SCORE_GAP_START;
+            in_gap = true;
+            consecutive = 0;
+            first_bonus = 0;
+        }
+        prev_class = class;
+    }
+    return score;
+}
+
+bool
+fuzzy_match (FuzzyPattern *pattern,
+             const char *haystack,
+             int32_t *score)
+{
+    assert (pattern != NULL);
+    assert (haystack != NULL);
+
+    const size_t m = pattern->pattern_len;
+    if (m == 0) {
+        if (score) {
+            *score = 0;
+        }
+        return true;
+    }
+
+    const unsigned char *text = (const unsigned char *)haystack;
+    const unsigned char *p = (const unsigned char *)pattern->pattern;
+    const bool match_case = pattern->match_case;
+
+    // cheap rejection: some character of the pattern is missing entirely
+    if (!fsearch_signature_contains (fsearch_str_signature (haystack), pattern->char_mask)) {
+        return false;
+    }
+
+    // forward scan: find the end of the first occurrence as a subsequence
+    size_t pidx = 0;
+    size_t idx = 0;
+    size_t start = 0;
+    for (; text[idx] != '\0'; idx++) {
+        if (char_equal (text[idx], p[pidx], match_case)) {
+            if (pidx == 0) {
+                start = idx;
+            }
+            pidx++;
+            if (pidx == m) {
+                break;
+            }
+        }
+    }
+    if (pidx != m) {
+        return false;
+    }
+    const size_t end = idx + 1;
+
+    // backward scan: find the shortest match ending there
+    pidx = m;
+    for (idx = end; idx > start; idx--) {
+        if (char_equal (text[idx - 1], p[pidx - 1], match_case)) {
+            pidx--;
+            if (pidx == 0) {
+                start = idx - 1;
+                break;
+            }
+        }
+    }
+
+    if (score) {
+        *score = calculate_score (pattern, text, start, end);
+    }
+    return true;
+}
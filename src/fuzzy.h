@@ -0,0 +1,48 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct _FuzzyPattern FuzzyPattern;
+
+struct _FuzzyPattern
+{
+    char *pattern;
+    size_t pattern_len;
+    // every character of the pattern sets a bit, see fsearch_str_signature
+    uint64_t char_mask;
+    bool match_case;
+};
+
+FuzzyPattern *
+fuzzy_pattern_new (const char *pattern, bool match_case);
+
+void
+fuzzy_pattern_free (FuzzyPattern *pattern);
+
+// Returns true if all characters of the pattern appear in haystack in the
+// same order and stores how well they match in score: consecutive
+// characters and matches at word boundaries score higher, gaps lower.
+bool
+fuzzy_match (FuzzyPattern *pattern,
+             const char *haystack,
+             int32_t *score);
@@ -138,15 +138,45 @@ get_mimetype (const gchar *path)
     return NULL;
 }
 
+// Files with the same extension almost always have the same type, so the
+// description is looked up only once per extension
+static const gchar *
+get_cached_file_type (ListModel *list_model, BTreeNode *node, const gchar *path)
+{
+    const char *dot = strrchr (node->name, '.');
+    if (!dot || dot == node->name) {
+        return NULL;
+    }
+    gchar *ext = g_ascii_strdown (dot + 1, -1);
+    const gchar *type = g_hash_table_lookup (list_model->type_cache, ext);
+    if (type) {
+        g_free (ext);
+        return type;
+    }
+
+    gchar node_path[PATH_MAX] = "";
+    if (!path) {
+        btree_node_get_path_full (node, node_path, sizeof (node_path));
+        path = node_path;
+    }
+    gchar *mimetype = get_mimetype (path);
+    if (!mimetype) {
+        mimetype = g_strdup ("Unknown Type");
+    }
+    // the table takes ownership of ext and mimetype
+    g_hash_table_insert (list_model->type_cache, ext, mimetype);
+    return mimetype;
+}
+
 static gchar *
-get_file_type (DatabaseSearchEntry *entry, const gchar *path) {
+get_file_type (ListModel *list_model, BTreeNode *node, const gchar *path) {
     gchar *type = NULL;
-    BTreeNode *node = db_search_entry_get_node (entry);
     if (node->is_dir) {
         type = strdup ("Folder");
     }
     else {
-        type = get_mimetype (path);
+        const gchar *cached_type = get_cached_file_type (list_model, node, path);
+        type = cached_type ? g_strdup (cached_type) : get_mimetype (path);
     }
     if (type == NULL) {
         type = strdup ("Unknown Type");
@@ -299,6 +329,7 @@ list_model_init (ListModel *list_model)
     g_assert (LIST_MODEL_N_COLUMNS == 7);
 
     list_model->results     = NULL;
+    list_model->type_cache  = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
 
     list_model->sort_id    = SORT_ID_NONE;
     list_model->sort_order = GTK_SORT_ASCENDING;
@@ -321,6 +352,10 @@ list_model_finalize (GObject *object)
     ListModel *list_model = LIST_MODEL (object);
     list_model_clear (list_model);
     iconstore_clear ();
+    if (list_model->type_cache) {
+        g_hash_table_destroy (list_model->type_cache);
+        list_model->type_cache = NULL;
+    }
 
     /* must chain up - finalize parent */
     (* parent_class->finalize) (object);
@@ -532,7 +567,7 @@ list_model_get_value (GtkTreeModel *tree_model,
         case LIST_MODEL_COL_TYPE:
             btree_node_get_path (node, node_path, sizeof (node_path));
             snprintf (path, sizeof (path), "%s/%s", node_path, name);
-            mime_type = get_file_type (record, path);
+            mime_type = get_file_type (list_model, node, path);
             g_value_set_string(value, mime_type);
             break;
 
@@ -868,7 +903,10 @@ list_model_sortable_has_default_sort_func (GtkTreeSortable *sortable)
 }
 
 static gint
-list_model_compare_records (gint sort_id, DatabaseSearchEntry *a, DatabaseSearchEntry *b)
+list_model_compare_records (ListModel *list_model,
+                            gint sort_id,
+                            DatabaseSearchEntry *a,
+                            DatabaseSearchEntry *b)
 {
     BTreeNode *node_a = db_search_entry_get_node (a);
     BTreeNode *node_b = db_search_entry_get_node (b);
@@ -928,10 +966,23 @@ list_model_compare_records (gint sort_id, DatabaseSearchEntry *a, DatabaseSearch
                     return 0;
                 }
 
+                // same extension, same type
+                if (node_a->ext_id == node_b->ext_id
+                    && node_a->ext_id != DB_EXT_ID_NONE
+                    && node_a->ext_id != DB_EXT_ID_OTHER) {
+                    return 0;
+                }
+
+                const gchar *cached_type_a = get_cached_file_type (list_model, node_a, NULL);
+                const gchar *cached_type_b = get_cached_file_type (list_model, node_b, NULL);
+                if (cached_type_a && cached_type_b) {
+                    return strverscmp (cached_type_a, cached_type_b);
+                }
+
                 btree_node_get_path_full (node_a, path_a, sizeof (path_a));
-                type_a = get_file_type (a, path_a);
+                type_a = get_file_type (list_model, node_a, path_a);
                 btree_node_get_path_full (node_b, path_b, sizeof (path_b));
-                type_b = get_file_type (b, path_b);
+                type_b = get_file_type (list_model, node_b, path_b);
 
                 if ((type_a) && (type_b)) {
                     return_val = strverscmp (type_a, type_b);
@@ -955,6 +1006,21 @@ list_model_compare_records (gint sort_id, DatabaseSearchEntry *a, DatabaseSearch
 
                 return (node_a->mtime > node_b->mtime) ? 1 : -1;
             }
+        case SORT_ID_RELEVANCE:
+            {
+                // best matches first, ties keep the order of the search
+                const int32_t score_a = db_search_entry_get_score (a);
+                const int32_t score_b = db_search_entry_get_score (b);
+                if (score_a != score_b) {
+                    return (score_a > score_b) ? -1 : 1;
+                }
+                const uint32_t pos_a = db_search_entry_get_pos (a);
+                const uint32_t pos_b = db_search_entry_get_pos (b);
+                if (pos_a == pos_b)
+                    return 0;
+
+                return (pos_a > pos_b) ? 1 : -1;
+            }
         default:
             return 0;
     }
@@ -968,7 +1034,7 @@ list_model_qsort_compare_func (DatabaseSearchEntry **a, DatabaseSearchEntry **b,
 {
     g_assert ((a) && (b) && (list_model));
 
-    gint ret = list_model_compare_records(list_model->sort_id, *a, *b);
+    gint ret = list_model_compare_records(list_model, list_model->sort_id, *a, *b);
 
     /* Swap -1 and 1 if sort order is reverse */
     if (ret != 0  &&  list_model->sort_order == GTK_SORT_DESCENDING)
@@ -1023,3 +1089,40 @@ list_set_results (ListModel *list, GPtrArray *results)
 {
     list->results = results;
 }
+
+void
+list_model_append_results (ListModel *list, GPtrArray *results, bool notify)
+{
+    g_return_if_fail (list);
+    g_return_if_fail (list->results);
+    g_return_if_fail (results);
+
+    for (uint32_t i = 0; i < results->len; i++) {
+        DatabaseSearchEntry *entry = g_ptr_array_index (results, i);
+        const guint row = list->results->len;
+        db_search_entry_set_pos (entry, row);
+        g_ptr_array_add (list->results, entry);
+        if (!notify) {
+            continue;
+        }
+
+        GtkTreeIter iter;
+        iter.stamp = list->stamp;
+        iter.user_data = entry;
+        iter.user_data2 = NULL;
+        iter.user_data3 = NULL;
+
+        GtkTreePath *path = gtk_tree_path_new ();
+        gtk_tree_path_append_index (path, row);
+        gtk_tree_model_row_inserted (GTK_TREE_MODEL (list), path, &iter);
+        gtk_tree_path_free (path);
+    }
+    // the entries belong to the list now
+    g_ptr_array_set_free_func (results, NULL);
+    g_ptr_array_free (results, TRUE);
+
+    // they arrive in database order, which is sorted by name
+    if (list->sort_id != SORT_ID_NAME || list->sort_order != GTK_SORT_ASCENDING) {
+        list_model_resort (list);
+    }
+}
@@ -54,6 +54,7 @@ enum
     SORT_ID_TYPE,
     SORT_ID_SIZE,
     SORT_ID_CHANGED,
+    SORT_ID_RELEVANCE,
 };
 
 
@@ -74,6 +75,9 @@ struct _ListModel
 
     GPtrArray *results;
 
+    /* file type descriptions by (lower case) file extension */
+    GHashTable *type_cache;
+
     /* These two fields are not absolutely necessary, but they    */
     /*   speed things up a bit in our get_value implementation    */
     gint n_columns;
@@ -107,5 +111,11 @@ list_model_sort (ListModel *list_model);
 void
 list_set_results (ListModel *list, GPtrArray *results);
 
+// appends the entries of results and, with notify, tells the view about
+// every new row; without it the model mustn't be attached to a view.
+// results is freed, its entries now belong to the list
+void
+list_model_append_results (ListModel *list, GPtrArray *results, bool notify);
+
 void
 list_model_remove_entry (ListModel *list, DatabaseSearch *search, DatabaseSearchEntry *entry);
@@ -0,0 +1,619 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <limits.h>
+#include <assert.h>
+#include <glib.h>
+
+#include "predicate.h"
+
+#define PREDICATE_MIN INT64_MIN
+#define PREDICATE_MAX INT64_MAX
+
+typedef struct {
+    const char *keyword;
+    PredicateKind kind;
+} predicate_keyword_t;
+
+static const predicate_keyword_t keywords[] = {
+    {"size:", PREDICATE_SIZE},
+    {"dm:", PREDICATE_MTIME},
+    {"datemodified:", PREDICATE_MTIME},
+    {"ext:", PREDICATE_EXT},
+    {"type:", PREDICATE_TYPE},
+    {"depth:", PREDICATE_DEPTH},
+    {"parent:", PREDICATE_PARENT},
+    {"prefix:", PREDICATE_PREFIX},
+    {"startwith:", PREDICATE_PREFIX},
+};
+
+// parses a single value into the interval [lo, hi) it stands for,
+// e.g. "2024-01" covers the whole month
+typedef bool (*parse_value_func) (const char *s, int64_t *lo, int64_t *hi);
+
+static bool
+parse_size (const char *s, int64_t *lo, int64_t *hi)
+{
+    char *end = NULL;
+    double value = strtod (s, &end);
+    if (end == s || value < 0) {
+        return false;
+    }
+    int64_t factor = 1;
+    switch (*end) {
+        case 'k':
+        case 'K':
+            factor = 1ll << 10;
+            end++;
+            break;
+        case 'm':
+        case 'M':
+            factor = 1ll << 20;
+            end++;
+            break;
+        case 'g':
+        case 'G':
+            factor = 1ll << 30;
+            end++;
+            break;
+        case 't':
+        case 'T':
+            factor = 1ll << 40;
+            end++;
+            break;
+        default:
+            break;
+    }
+    if (*end == 'b' || *end == 'B') {
+        end++;
+    }
+    if (*end != '\0') {
+        return false;
+    }
+    *lo = (int64_t)(value * factor);
+    *hi = *lo + 1;
+    return true;
+}
+
+static bool
+parse_number (const char *s, int64_t *lo, int64_t *hi)
+{
+    char *end = NULL;
+    long long value = strtoll (s, &end, 10);
+    if (end == s || *end != '\0' || value < 0) {
+        return false;
+    }
+    *lo = value;
+    *hi = value + 1;
+    return true;
+}
+
+static bool
+parse_date (const char *s, int64_t *lo, int64_t *hi)
+{
+    time_t now = time (NULL);
+    struct tm start = {0};
+    localtime_r (&now, &start);
+    start.tm_hour = 0;
+    start.tm_min = 0;
+    start.tm_sec = 0;
+    start.tm_isdst = -1;
+    struct tm end = start;
+
+    if (!strcasecmp (s, "today")) {
+        end.tm_mday++;
+    }
+    else if (!strcasecmp (s, "yesterday")) {
+        start.tm_mday--;
+    }
+    else {
+        int year = 0;
+        int month = 0;
+        int day = 0;
+        int consumed = 0;
+        int n = sscanf (s, "%4d%n-%2d%n-%2d%n", &year, &consumed, &month, &consumed, &day, &consumed);
+        if (n < 1 || s[consumed] != '\0') {
+            return false;
+        }
+        if ((n >= 2 && (month < 1 || month > 12))
+            || (n >= 3 && (day < 1 || day > 31))) {
+            return false;
+        }
+        start.tm_year = year - 1900;
+        start.tm_mon = n >= 2 ? month - 1 : 0;
+        start.tm_mday = n >= 3 ? day : 1;
+        end = start;
+        if (n == 1) {
+            end.tm_year++;
+        }
+        else if (n == 2) {
+            end.tm_mon++;
+        }
+        else {
+            end.tm_mday++;
+        }
+    }
+    // mktime normalizes overflowing days, months and years
+    time_t t_start = mktime (&start);
+    time_t t_end = mktime (&end);
+    if (t_start == (time_t)-1 || t_end == (time_t)-1) {
+        return false;
+    }
+    *lo = t_start;
+    *hi = t_end;
+    return true;
+}
+
+// Parses "<x", "<=x", ">x", ">=x", "=x", "x" and "a..b" (either bound may be
+// omitted) into the interval [min, max)
+static bool
+parse_range (const char *s, parse_value_func parse_value, int64_t *min, int64_t *max)
+{
+    int64_t lo = 0;
+    int64_t hi = 0;
+
+    const char *dots = strstr (s, "..");
+    if (dots) {
+        *min = PREDICATE_MIN;
+        *max = PREDICATE_MAX;
+        if (dots != s) {
+            char *first = g_strndup (s, dots - s);
+            bool res = parse_value (first, &lo, &hi);
+            g_free (first);
+            if (!res) {
+                return false;
+            }
+            *min = lo;
+        }
+        if (dots[2] != '\0') {
+            if (!parse_value (dots + 2, &lo, &hi)) {
+                return false;
+            }
+            *max = hi;
+        }
+        return true;
+    }
+
+    if (s[0] == '>' && s[1] == '=') {
+        if (!parse_value (s + 2, &lo, &hi)) {
+            return false;
+        }
+        *min = lo;
+        *max = PREDICATE_MAX;
+    }
+    else if (s[0] == '>') {
+        if (!parse_value (s + 1, &lo, &hi)) {
+            return false;
+        }
+        *min = hi;
+        *max = PREDICATE_MAX;
+    }
+    else if (s[0] == '<' && s[1] == '=') {
+        if (!parse_value (s + 2, &lo, &hi)) {
+            return false;
+        }
+        *min = PREDICATE_MIN;
+        *max = hi;
+    }
+    else if (s[0] == '<') {
+        if (!parse_value (s + 1, &lo, &hi)) {
+            return false;
+        }
+        *min = PREDICATE_MIN;
+        *max = lo;
+    }
+    else {
+        if (!parse_value (s[0] == '=' ? s + 1 : s, &lo, &hi)) {
+            return false;
+        }
+        *min = lo;
+        *max = hi;
+    }
+    return true;
+}
+
+static bool
+parse_type (const char *s, Predicate *predicate)
+{
+    // min/max hold the accepted values of is_dir
+    if (!strcasecmp (s, "file")) {
+        predicate->min = 0;
+        predicate->max = 1;
+    }
+    else if (!strcasecmp (s, "folder")
+             || !strcasecmp (s, "dir")
+             || !strcasecmp (s, "directory")) {
+        predicate->min = 1;
+        predicate->max = 2;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+static bool
+parse_ext (const char *s, Predicate *predicate)
+{
+    char **tokens = g_strsplit_set (s, ";,", -1);
+    GPtrArray *exts = g_ptr_array_new ();
+    for (uint32_t i = 0; tokens[i]; i++) {
+        // accept "ext:.log" as well
+        const char *ext = tokens[i][0] == '.' ? tokens[i] + 1 : tokens[i];
+        if (*ext != '\0') {
+            g_ptr_array_add (exts, g_strdup (ext));
+        }
+    }
+    g_strfreev (tokens);
+
+    predicate->num_values = exts->len;
+    g_ptr_array_add (exts, NULL);
+    predicate->values = (char **)g_ptr_array_free (exts, FALSE);
+    return predicate->num_values > 0;
+}
+
+static bool
+parse_parent (const char *s, Predicate *predicate)
+{
+    if (*s == '\0') {
+        return false;
+    }
+    char *path = g_strdup (s);
+    size_t len = strlen (path);
+    // "/var/" and "/var" are the same folder, but keep "/"
+    while (len > 1 && path[len - 1] == '/') {
+        path[--len] = '\0';
+    }
+    predicate->values = g_new0 (char *, 2);
+    predicate->values[0] = path;
+    predicate->num_values = 1;
+    return true;
+}
+
+static bool
+parse_prefix (const char *s, Predicate *predicate)
+{
+    if (*s == '\0') {
+        return false;
+    }
+    predicate->values = g_new0 (char *, 2);
+    predicate->values[0] = g_strdup (s);
+    predicate->num_values = 1;
+    return true;
+}
+
+static void
+predicate_clear (Predicate *predicate)
+{
+    if (predicate->values) {
+        g_strfreev (predicate->values);
+        predicate->values = NULL;
+    }
+    predicate->num_values = 0;
+    if (predicate->ext_ids) {
+        g_free (predicate->ext_ids);
+        predicate->ext_ids = NULL;
+    }
+    predicate->num_ext_ids = 0;
+}
+
+PredicateProgram *
+predicate_program_new (void)
+{
+    PredicateProgram *program = calloc (1, sizeof (PredicateProgram));
+    assert (program != NULL);
+    return program;
+}
+
+void
+predicate_program_free (PredicateProgram *program)
+{
+    if (!program) {
+        return;
+    }
+    for (uint32_t i = 0; i < program->num_predicates; i++) {
+        predicate_clear (&program->predicates[i]);
+    }
+    if (program->predicates) {
+        free (program->predicates);
+        program->predicates = NULL;
+    }
+    free (program);
+    program = NULL;
+}
+
+bool
+predicate_program_is_empty (PredicateProgram *program)
+{
+    return !program || program->num_predicates == 0;
+}
+
+static void
+predicate_program_insert (PredicateProgram *program, Predicate *predicate)
+{
+    program->predicates = realloc (program->predicates,
+                                   (program->num_predicates + 1) * sizeof (Predicate));
+    assert (program->predicates != NULL);
+
+    // keep the program sorted by evaluation cost
+    uint32_t pos = program->num_predicates;
+    while (pos > 0 && program->predicates[pos - 1].kind > predicate->kind) {
+        program->predicates[pos] = program->predicates[pos - 1];
+        pos--;
+    }
+    program->predicates[pos] = *predicate;
+    program->num_predicates++;
+}
+
+bool
+predicate_program_add_term (PredicateProgram *program,
+                            const char *term,
+                            char **error_message)
+{
+    assert (program != NULL);
+    assert (term != NULL);
+
+    const predicate_keyword_t *keyword = NULL;
+    for (uint32_t i = 0; i < G_N_ELEMENTS (keywords); i++) {
+        if (!strncasecmp (term, keywords[i].keyword, strlen (keywords[i].keyword))) {
+            keyword = &keywords[i];
+            break;
+        }
+    }
+    if (!keyword) {
+        return false;
+    }
+
+    const char *value = term + strlen (keyword->keyword);
+    Predicate predicate = {0};
+    predicate.kind = keyword->kind;
+
+    bool res = false;
+    switch (keyword->kind) {
+        case PREDICATE_SIZE:
+            res = parse_range (value, parse_size, &predicate.min, &predicate.max);
+            break;
+        case PREDICATE_MTIME:
+            res = parse_range (value, parse_date, &predicate.min, &predicate.max);
+            break;
+        case PREDICATE_DEPTH:
+            res = parse_range (value, parse_number, &predicate.min, &predicate.max);
+            break;
+        case PREDICATE_TYPE:
+            res = parse_type (value, &predicate);
+            break;
+        case PREDICATE_EXT:
+            res = parse_ext (value, &predicate);
+            break;
+        case PREDICATE_PARENT:
+            res = parse_parent (value, &predicate);
+            break;
+        case PREDICATE_PREFIX:
+            res = parse_prefix (value, &predicate);
+            break;
+    }
+
+    if (!res) {
+        predicate_clear (&predicate);
+        if (error_message && !*error_message) {
+            *error_message = g_strdup_printf ("Invalid filter: %s", term);
+        }
+        // it's still a predicate, just a broken one
+        return true;
+    }
+    predicate_program_insert (program, &predicate);
+    return true;
+}
+
+static uint32_t
+node_get_depth (BTreeNode *node)
+{
+    // the root node holds the path of the location, e.g. "/home/user"
+    uint32_t depth = 0;
+    BTreeNode *root = node;
+    while (root->parent) {
+        depth++;
+        root = root->parent;
+    }
+    for (const char *c = root->name; *c != '\0'; c++) {
+        if (*c != '/' && (c == root->name || *(c - 1) == '/')) {
+            depth++;
+        }
+    }
+    return depth;
+}
+
+void
+predicate_program_bind (PredicateProgram *program, Database *db)
+{
+    assert (program != NULL);
+    assert (db != NULL);
+
+    for (uint32_t i = 0; i < program->num_predicates; i++) {
+        Predicate *predicate = &program->predicates[i];
+        if (predicate->kind != PREDICATE_EXT) {
+            continue;
+        }
+        if (predicate->ext_ids) {
+            g_free (predicate->ext_ids);
+        }
+        predicate->ext_ids = g_new0 (uint16_t, predicate->num_values + 1);
+        predicate->num_ext_ids = 0;
+        for (uint32_t j = 0; j < predicate->num_values; j++) {
+            uint16_t id = 0;
+            if (db_lookup_ext_id (db, predicate->values[j], &id)) {
+                predicate->ext_ids[predicate->num_ext_ids++] = id;
+            }
+        }
+    }
+}
+
+Bitmap *
+predicate_program_get_candidates (PredicateProgram *program, Database *db)
+{
+    assert (program != NULL);
+    assert (db != NULL);
+
+    // every predicate must hold, so only entries in the sets of all of them
+    // can match; the predicates are still evaluated for each candidate
+    Bitmap *candidates = NULL;
+    for (uint32_t i = 0; i < program->num_predicates; i++) {
+        Predicate *predicate = &program->predicates[i];
+        Bitmap *bitmap = NULL;
+        if (predicate->kind == PREDICATE_EXT && predicate->ext_ids) {
+            // only entries with one of the extensions can match
+            bitmap = bitmap_new ();
+            for (uint32_t j = 0; j < predicate->num_ext_ids; j++) {
+                Bitmap *ext_bitmap = db_get_ext_bitmap (db, predicate->ext_ids[j]);
+                if (!ext_bitmap) {
+                    continue;
+                }
+                Bitmap *tmp = bitmap_or (bitmap, ext_bitmap);
+                bitmap_free (bitmap);
+                bitmap = tmp;
+            }
+        }
+        else if (predicate->kind == PREDICATE_PREFIX) {
+            // a binary search in the prefix index
+            bitmap = db_get_prefix_bitmap (db, predicate->values[0]);
+        }
+        if (!bitmap) {
+            continue;
+        }
+        if (!candidates) {
+            candidates = bitmap;
+        }
+        else {
+            Bitmap *both = bitmap_and (candidates, bitmap);
+            bitmap_free (candidates);
+            bitmap_free (bitmap);
+            candidates = both;
+        }
+    }
+    return candidates;
+}
+
+static bool
+node_has_ext (BTreeNode *node, Predicate *predicate)
+{
+    if (node->is_dir) {
+        return false;
+    }
+    if (predicate->ext_ids) {
+        bool is_other = false;
+        for (uint32_t i = 0; i < predicate->num_ext_ids; i++) {
+            if (node->ext_id == predicate->ext_ids[i]) {
+                if (node->ext_id != DB_EXT_ID_OTHER) {
+                    return true;
+                }
+                is_other = true;
+            }
+        }
+        if (!is_other) {
+            return false;
+        }
+        // extensions without an id of their own need to be compared
+    }
+    const char *ext = strrchr (node->name, '.');
+    if (!ext || ext == node->name) {
+        return false;
+    }
+    ext++;
+    for (uint32_t i = 0; i < predicate->num_values; i++) {
+        if (!strcasecmp (ext, predicate->values[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+node_has_parent (BTreeNode *node, Predicate *predicate)
+{
+    BTreeNode *parent = node->parent;
+    if (!parent) {
+        return false;
+    }
+    const char *path = predicate->values[0];
+    if (parent->parent) {
+        // reject most nodes by comparing the folder name before
+        // building the whole path
+        const char *name = strrchr (path, '/');
+        name = name ? name + 1 : path;
+        if (strcmp (parent->name, name)) {
+            return false;
+        }
+    }
+    char parent_path[PATH_MAX] = "";
+    btree_node_get_path_full (parent, parent_path, sizeof (parent_path));
+    return !strcmp (parent_path, path);
+}
+
+static inline bool
+in_range (Predicate *predicate, int64_t value)
+{
+    return value >= predicate->min && value < predicate->max;
+}
+
+bool
+predicate_program_eval (PredicateProgram *program, BTreeNode *node)
+{
+    assert (program != NULL);
+    assert (node != NULL);
+
+    for (uint32_t i = 0; i < program->num_predicates; i++) {
+        Predicate *predicate = &program->predicates[i];
+        bool res = false;
+        switch (predicate->kind) {
+            case PREDICATE_TYPE:
+                res = in_range (predicate, node->is_dir);
+                break;
+            case PREDICATE_SIZE:
+                // folder sizes aren't known
+                res = !node->is_dir && in_range (predicate, node->size);
+                break;
+            case PREDICATE_MTIME:
+                res = in_range (predicate, node->mtime);
+                break;
+            case PREDICATE_DEPTH:
+                res = in_range (predicate, node_get_depth (node));
+                break;
+            case PREDICATE_EXT:
+                res = node_has_ext (node, predicate);
+                break;
+            case PREDICATE_PARENT:
+                res = node_has_parent (node, predicate);
+                break;
+            case PREDICATE_PREFIX:
+                res = !g_ascii_strncasecmp (node->name,
+                                            predicate->values[0],
+                                            strlen (predicate->values[0]));
+                break;
+        }
+        if (!res) {
+            return false;
+        }
+    }
+    return true;
+}
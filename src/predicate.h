@@ -0,0 +1,92 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "btree.h"
+#include "bitmap.h"
+#include "database.h"
+
+typedef struct _PredicateProgram PredicateProgram;
+
+// Ordered by evaluation cost, the program evaluates cheaper predicates first
+typedef enum {
+    PREDICATE_TYPE,
+    PREDICATE_SIZE,
+    PREDICATE_MTIME,
+    PREDICATE_PREFIX,
+    PREDICATE_DEPTH,
+    PREDICATE_EXT,
+    PREDICATE_PARENT,
+} PredicateKind;
+
+typedef struct
+{
+    PredicateKind kind;
+    // numeric predicates match values in [min, max)
+    int64_t min;
+    int64_t max;
+    // ext: list of extensions, parent: the folder path, prefix: the start
+    // of the name
+    char **values;
+    uint32_t num_values;
+    // ext: values resolved to extension ids, NULL until bound to a database
+    uint16_t *ext_ids;
+    uint32_t num_ext_ids;
+} Predicate;
+
+struct _PredicateProgram
+{
+    Predicate *predicates;
+    uint32_t num_predicates;
+};
+
+PredicateProgram *
+predicate_program_new (void);
+
+void
+predicate_program_free (PredicateProgram *program);
+
+// Parses a query term like "size:>1G", "dm:2024-01..2024-03", "ext:log;gz",
+// "type:folder", "depth:<4", "parent:/var" or "prefix:read" and adds it to
+// the program.
+// Returns false if the term isn't a predicate, in which case it should be
+// treated as a regular search term. If it is one but its value can't be
+// parsed, error_message is set.
+bool
+predicate_program_add_term (PredicateProgram *program,
+                            const char *term,
+                            char **error_message);
+
+bool
+predicate_program_is_empty (PredicateProgram *program);
+
+// resolves values against the indexes of the database, so the program can
+// use them instead of comparing strings when it's evaluated
+void
+predicate_program_bind (PredicateProgram *program, Database *db);
+
+// returns a new bitmap with the positions of all entries which can
+// possibly match, or NULL if every entry has to be tested
+Bitmap *
+predicate_program_get_candidates (PredicateProgram *program, Database *db);
+
+bool
+predicate_program_eval (PredicateProgram *program, BTreeNode *node);
@@ -280,6 +280,11 @@ preferences_ui_launch (FsearchConfig *config, GtkWindow *window)
     gtk_toggle_button_set_active (update_db_at_start_button,
                                   main_config->update_database_on_launch);
 
+    GtkToggleButton *build_suffix_index_button = GTK_TOGGLE_BUTTON (builder_get_object (builder,
+                                                                                        "build_suffix_index_button"));
+    gtk_toggle_button_set_active (build_suffix_index_button,
+                                  main_config->build_suffix_index);
+
     // Include page
     GtkTreeModel *include_model = create_tree_model (main_config->locations);
     GtkTreeView *include_list = GTK_TREE_VIEW (builder_get_object (builder,
@@ -388,11 +393,16 @@ preferences_ui_launch (FsearchConfig *config, GtkWindow *window)
 
         main_config->update_database_on_launch = gtk_toggle_button_get_active (update_db_at_start_button);
 
+        // the index is built with the next database
+        main_config->build_suffix_index = gtk_toggle_button_get_active (build_suffix_index_button);
+
 
+        // hidden items are filtered by the search, the database has them all
+        bool search_changed = false;
         bool old_exclude_hidden_items = main_config->exclude_hidden_items;
         main_config->exclude_hidden_items = gtk_toggle_button_get_active (exclude_hidden_items_button);
         if (old_exclude_hidden_items != main_config->exclude_hidden_items) {
-            model_changed = true;
+            search_changed = true;
         }
 
         bool old_follow_symlinks = main_config->follow_symlinks;
@@ -417,6 +427,9 @@ preferences_ui_launch (FsearchConfig *config, GtkWindow *window)
             main_config->exclude_locations = update_location_config (exclude_model, main_config->exclude_locations);
             update_database ();
         }
+        else if (search_changed) {
+            update_searches ();
+        }
     }
 
     g_object_unref (builder);
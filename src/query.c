@@ -23,25 +23,39 @@
 #include "query.h"
 
 FsearchQuery *
-fsearch_query_new (const char *query,
+fsearch_query_new (Database *db,
+                   const char *query,
+                   FsearchFilter filter,
+                   uint32_t max_results,
                    void (*callback)(void *),
                    void *callback_data,
+                   bool hide_results,
                    bool match_case,
                    bool enable_regex,
+                   bool enable_fuzzy,
+                   bool rank_by_relevance,
                    bool auto_search_in_path,
-                   bool search_in_path)
+                   bool search_in_path,
+                   bool exclude_hidden)
 {
     FsearchQuery *q = calloc (1, sizeof (FsearchQuery));
     assert (q != NULL);
+    q->db = db;
     if (query) {
         q->query = strdup (query);
     }
+    q->filter = filter;
+    q->max_results = max_results;
     q->callback = callback;
     q->callback_data = callback_data;
+    q->hide_results = hide_results;
     q->match_case = match_case;
     q->enable_regex = enable_regex;
+    q->enable_fuzzy = enable_fuzzy;
+    q->rank_by_relevance = rank_by_relevance;
     q->auto_search_in_path = auto_search_in_path;
     q->search_in_path = search_in_path;
+    q->exclude_hidden = exclude_hidden;
     return q;
 }
 
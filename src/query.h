@@ -19,27 +19,51 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 
+#include "database.h"
+
+typedef enum {
+    FSEARCH_FILTER_NONE,
+    FSEARCH_FILTER_FOLDERS,
+    FSEARCH_FILTER_FILES,
+} FsearchFilter;
+
+// everything a search depends on, so it can run without its window
 typedef struct
 {
+    Database *db;
     char *query;
+    FsearchFilter filter;
+    uint32_t max_results;
+    bool hide_results;
     bool match_case;
     bool enable_regex;
+    bool enable_fuzzy;
+    bool rank_by_relevance;
     bool auto_search_in_path;
     bool search_in_path;
+    bool exclude_hidden;
 
     void (*callback)(void *);
     void *callback_data;
 } FsearchQuery;
 
 FsearchQuery *
-fsearch_query_new (const char *query,
+fsearch_query_new (Database *db,
+                   const char *query,
+                   FsearchFilter filter,
+                   uint32_t max_results,
                    void (*callback)(void *),
                    void *callback_data,
+                   bool hide_results,
                    bool match_case,
                    bool enable_regex,
+                   bool enable_fuzzy,
+                   bool rank_by_relevance,
                    bool auto_search_in_path,
-                   bool search_in_path);
+                   bool search_in_path,
+                   bool exclude_hidden);
 
 void
 fsearch_query_free (FsearchQuery *query);
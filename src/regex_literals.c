@@ -0,0 +1,464 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <assert.h>
+#include <glib.h>
+
+#include "regex_literals.h"
+
+// The parser is deliberately conservative: whenever it encounters a construct
+// it doesn't fully understand (lookarounds, inline options, backreferences,
+// top level alternations, ...) it gives up and no prefilter is used at all.
+
+typedef struct {
+    GPtrArray *literals;
+    GString *current;
+    uint32_t min_len;
+    // number of atoms seen so far and the atom the current literal started at
+    uint32_t num_atoms;
+    uint32_t current_start;
+    int32_t prefix_idx;
+    bool anchored_start;
+    bool anchored_end;
+} parse_ctx_t;
+
+static void
+flush_literal (parse_ctx_t *ctx)
+{
+    if (ctx->current->len == 0) {
+        return;
+    }
+    if (ctx->anchored_start && ctx->current_start == 0 && ctx->prefix_idx < 0) {
+        ctx->prefix_idx = ctx->literals->len;
+    }
+    g_ptr_array_add (ctx->literals, g_strndup (ctx->current->str, ctx->current->len));
+    g_string_truncate (ctx->current, 0);
+}
+
+static void
+append_literal (parse_ctx_t *ctx, char c, uint32_t count)
+{
+    if (ctx->current->len == 0) {
+        ctx->current_start = ctx->num_atoms;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        g_string_append_c (ctx->current, c);
+    }
+}
+
+// parses {n}, {n,} and {n,m}, returns the number of bytes consumed or 0
+static size_t
+parse_brace_quantifier (const char *s, uint32_t *min, bool *exact)
+{
+    assert (*s == '{');
+    const char *p = s + 1;
+    if (!isdigit (*p)) {
+        return 0;
+    }
+    uint32_t n = 0;
+    while (isdigit (*p)) {
+        n = n * 10 + (*p - '0');
+        p++;
+    }
+    bool is_exact = true;
+    if (*p == ',') {
+        p++;
+        is_exact = false;
+        if (isdigit (*p)) {
+            uint32_t m = 0;
+            while (isdigit (*p)) {
+                m = m * 10 + (*p - '0');
+                p++;
+            }
+            is_exact = m == n;
+        }
+    }
+    if (*p != '}') {
+        return 0;
+    }
+    *min = n;
+    *exact = is_exact;
+    return p - s + 1;
+}
+
+// parses an optional quantifier, returns the number of bytes consumed
+static size_t
+parse_quantifier (const char *s, uint32_t *min, bool *exact)
+{
+    size_t len = 0;
+    *min = 1;
+    *exact = true;
+    switch (*s) {
+        case '*':
+            *min = 0;
+            *exact = false;
+            len = 1;
+            break;
+        case '+':
+            *exact = false;
+            len = 1;
+            break;
+        case '?':
+            *min = 0;
+            *exact = false;
+            len = 1;
+            break;
+        case '{':
+            len = parse_brace_quantifier (s, min, exact);
+            break;
+        default:
+            return 0;
+    }
+    // lazy and possessive modifiers don't change what has to be matched
+    if (len && (s[len] == '?' || s[len] == '+')) {
+        len++;
+    }
+    return len;
+}
+
+// returns the position of the closing bracket of a character class or NULL
+static const char *
+skip_class (const char *s)
+{
+    assert (*s == '[');
+    s++;
+    if (*s == '^') {
+        s++;
+    }
+    if (*s == ']') {
+        s++;
+    }
+    while (*s && *s != ']') {
+        if (*s == '\\' && s[1]) {
+            s += 2;
+        }
+        else if (*s == '[' && s[1] == ':') {
+            const char *end = strstr (s + 2, ":]");
+            if (!end) {
+                return NULL;
+            }
+            s = end + 2;
+        }
+        else {
+            s++;
+        }
+    }
+    return *s ? s : NULL;
+}
+
+// returns the position of the closing parenthesis of a group or NULL
+static const char *
+skip_group (const char *s)
+{
+    assert (*s == '(');
+    uint32_t depth = 0;
+    while (*s) {
+        if (*s == '\\' && s[1]) {
+            s += 2;
+            continue;
+        }
+        if (*s == '[') {
+            s = skip_class (s);
+            if (!s) {
+                return NULL;
+            }
+        }
+        else if (*s == '(') {
+            depth++;
+        }
+        else if (*s == ')') {
+            depth--;
+            if (depth == 0) {
+                return s;
+            }
+        }
+        s++;
+    }
+    return NULL;
+}
+
+static bool
+has_top_level_alternation (const char *s)
+{
+    while (*s) {
+        if (*s == '\\' && s[1]) {
+            s += 2;
+            continue;
+        }
+        if (*s == '|') {
+            return true;
+        }
+        if (*s == '[') {
+            s = skip_class (s);
+        }
+        else if (*s == '(') {
+            s = skip_group (s);
+        }
+        if (!s) {
+            // unbalanced, let pcre deal with that
+            return true;
+        }
+        s++;
+    }
+    return false;
+}
+
+static bool
+parse_pattern (parse_ctx_t *ctx, const char *pattern)
+{
+    const char *p = pattern;
+    while (*p) {
+        // a single character atom which can be part of a literal
+        bool is_char = false;
+        char c = 0;
+        // length of the subject an atom which isn't a character consumes
+        uint32_t atom_len = 0;
+
+        switch (*p) {
+            case '^':
+                if (p != pattern) {
+                    return false;
+                }
+                ctx->anchored_start = true;
+                p++;
+                continue;
+            case '$':
+                if (p[1] != '\0') {
+                    return false;
+                }
+                // the open literal becomes the suffix in regex_literals_new
+                ctx->anchored_end = true;
+                p++;
+                continue;
+            case '|':
+            case ')':
+            case '*':
+            case '+':
+            case '?':
+                return false;
+            case '.':
+                atom_len = 1;
+                p++;
+                break;
+            case '[':
+                p = skip_class (p);
+                if (!p) {
+                    return false;
+                }
+                atom_len = 1;
+                p++;
+                break;
+            case '(':
+                if (p[1] == '?') {
+                    // options, lookarounds, named groups, ...
+                    return false;
+                }
+                p = skip_group (p);
+                if (!p) {
+                    return false;
+                }
+                p++;
+                break;
+            case '\\':
+                c = p[1];
+                if (c == '\0') {
+                    return false;
+                }
+                if (isalnum (c)) {
+                    if (strchr ("dDwWsShHvVN", c)) {
+                        atom_len = 1;
+                    }
+                    else if (c == 'b' || c == 'B') {
+                        // word boundaries don't consume anything
+                    }
+                    else {
+                        // backreferences, hex/unicode escapes, \Q...\E, ...
+                        return false;
+                    }
+                }
+                else {
+                    is_char = true;
+                }
+                p += 2;
+                break;
+            case '{':
+                {
+                    uint32_t min = 0;
+                    bool exact = false;
+                    if (parse_brace_quantifier (p, &min, &exact)) {
+                        // quantifier without anything to quantify
+                        return false;
+                    }
+                }
+                // fall through
+            default:
+                is_char = true;
+                c = *p;
+                p++;
+                break;
+        }
+
+        uint32_t min = 1;
+        bool exact = true;
+        p += parse_quantifier (p, &min, &exact);
+
+        if (is_char && min > 0) {
+            append_literal (ctx, c, min);
+            ctx->min_len += min;
+            if (!exact) {
+                // the character might be repeated, so the literal ends here
+                flush_literal (ctx);
+            }
+        }
+        else {
+            flush_literal (ctx);
+            ctx->min_len += atom_len * min;
+        }
+        ctx->num_atoms++;
+    }
+    return true;
+}
+
+RegexLiterals *
+regex_literals_new (const char *pattern)
+{
+    assert (pattern != NULL);
+
+    if (has_top_level_alternation (pattern)) {
+        return NULL;
+    }
+
+    parse_ctx_t ctx = {0};
+    ctx.literals = g_ptr_array_new ();
+    ctx.current = g_string_new (NULL);
+    ctx.prefix_idx = -1;
+
+    bool res = parse_pattern (&ctx, pattern);
+    int32_t suffix_idx = -1;
+    if (res && ctx.current->len > 0) {
+        // pattern ended with a literal
+        if (ctx.anchored_end) {
+            suffix_idx = ctx.literals->len;
+        }
+        flush_literal (&ctx);
+    }
+    g_string_free (ctx.current, TRUE);
+    ctx.current = NULL;
+
+    if (!res || (ctx.literals->len == 0 && ctx.min_len == 0)) {
+        g_ptr_array_set_free_func (ctx.literals, g_free);
+        g_ptr_array_free (ctx.literals, TRUE);
+        return NULL;
+    }
+
+    RegexLiterals *literals = calloc (1, sizeof (RegexLiterals));
+    assert (literals != NULL);
+
+    literals->min_len = ctx.min_len;
+    literals->anchored_start = ctx.anchored_start;
+    literals->anchored_end = ctx.anchored_end;
+    literals->num_literals = ctx.literals->len;
+    literals->literals = (char **)g_ptr_array_free (ctx.literals, FALSE);
+    if (ctx.prefix_idx >= 0) {
+        literals->prefix = literals->literals[ctx.prefix_idx];
+        literals->prefix_len = strlen (literals->prefix);
+    }
+    if (suffix_idx >= 0) {
+        literals->suffix = literals->literals[suffix_idx];
+        literals->suffix_len = strlen (literals->suffix);
+    }
+    return literals;
+}
+
+void
+regex_literals_free (RegexLiterals *literals)
+{
+    if (!literals) {
+        return;
+    }
+    if (literals->literals) {
+        for (uint32_t i = 0; i < literals->num_literals; i++) {
+            g_free (literals->literals[i]);
+        }
+        g_free (literals->literals);
+        literals->literals = NULL;
+    }
+    free (literals);
+    literals = NULL;
+}
+
+bool
+regex_literals_match (RegexLiterals *literals,
+                      const char *haystack,
+                      size_t haystack_len,
+                      bool match_case)
+{
+    assert (literals != NULL);
+    assert (haystack != NULL);
+
+    if (haystack_len < literals->min_len) {
+        return false;
+    }
+
+    if (literals->prefix) {
+        if (match_case) {
+            if (strncmp (haystack, literals->prefix, literals->prefix_len)) {
+                return false;
+            }
+        }
+        else if (strncasecmp (haystack, literals->prefix, literals->prefix_len)) {
+            return false;
+        }
+    }
+
+    if (literals->suffix) {
+        if (haystack_len < literals->suffix_len) {
+            return false;
+        }
+        const char *end = haystack + haystack_len - literals->suffix_len;
+        if (match_case) {
+            if (strcmp (end, literals->suffix)) {
+                return false;
+            }
+        }
+        else if (strcasecmp (end, literals->suffix)) {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < literals->num_literals; i++) {
+        const char *literal = literals->literals[i];
+        if (literal == literals->prefix || literal == literals->suffix) {
+            continue;
+        }
+        if (match_case) {
+            if (!strstr (haystack, literal)) {
+                return false;
+            }
+        }
+        else if (!strcasestr (haystack, literal)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,59 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct _RegexLiterals RegexLiterals;
+
+// Facts about a regular expression which must hold for every subject it
+// matches: literal substrings which have to be present, whether it's anchored
+// to the start/end of the subject and the minimum subject length.
+// They're used to reject most subjects with cheap string functions before
+// the regex engine gets involved.
+struct _RegexLiterals
+{
+    char **literals;
+    uint32_t num_literals;
+    uint32_t min_len;
+
+    // literal the subject has to start with (anchored with ^), or NULL
+    const char *prefix;
+    uint32_t prefix_len;
+    // literal the subject has to end with (anchored with $), or NULL
+    const char *suffix;
+    uint32_t suffix_len;
+    bool anchored_start;
+    bool anchored_end;
+};
+
+// returns NULL if nothing useful can be extracted from the pattern
+RegexLiterals *
+regex_literals_new (const char *pattern);
+
+void
+regex_literals_free (RegexLiterals *literals);
+
+bool
+regex_literals_match (RegexLiterals *literals,
+                      const char *haystack,
+                      size_t haystack_len,
+                      bool match_case);
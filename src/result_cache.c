@@ -0,0 +1,237 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "result_cache.h"
+#include "debug.h"
+
+typedef struct {
+    char *key;
+    CachedResult *result;
+    size_t size;
+} cache_entry_t;
+
+static size_t
+cached_result_get_size (CachedResult *result)
+{
+    size_t size = sizeof (CachedResult);
+    if (result->matches) {
+        size += bitmap_get_memory_usage (result->matches);
+    }
+    if (result->positions) {
+        size += result->num_results * sizeof (uint32_t);
+    }
+    if (result->scores) {
+        size += result->num_results * sizeof (int32_t);
+    }
+    return size;
+}
+
+CachedResult *
+cached_result_new (uint32_t num_results, bool ranked, Bitmap *matches)
+{
+    CachedResult *result = calloc (1, sizeof (CachedResult));
+    assert (result != NULL);
+
+    result->num_results = num_results;
+    result->ranked = ranked;
+    result->matches = matches;
+    if (ranked || !matches) {
+        result->positions = calloc (MAX (num_results, 1), sizeof (uint32_t));
+        assert (result->positions != NULL);
+    }
+    if (ranked) {
+        result->scores = calloc (MAX (num_results, 1), sizeof (int32_t));
+        assert (result->scores != NULL);
+    }
+    return result;
+}
+
+void
+cached_result_free (CachedResult *result)
+{
+    if (!result) {
+        return;
+    }
+    if (result->matches) {
+        bitmap_free (result->matches);
+        result->matches = NULL;
+    }
+    if (result->positions) {
+        free (result->positions);
+        result->positions = NULL;
+    }
+    if (result->scores) {
+        free (result->scores);
+        result->scores = NULL;
+    }
+    free (result);
+    result = NULL;
+}
+
+static void
+cache_entry_free (cache_entry_t *entry)
+{
+    if (!entry) {
+        return;
+    }
+    cached_result_free (entry->result);
+    entry->result = NULL;
+    g_free (entry->key);
+    entry->key = NULL;
+    free (entry);
+    entry = NULL;
+}
+
+ResultCache *
+result_cache_new (size_t budget)
+{
+    ResultCache *cache = calloc (1, sizeof (ResultCache));
+    assert (cache != NULL);
+
+    cache->entries = g_hash_table_new (g_str_hash, g_str_equal);
+    g_queue_init (&cache->lru);
+    cache->budget = budget;
+    return cache;
+}
+
+void
+result_cache_clear (ResultCache *cache)
+{
+    assert (cache != NULL);
+
+    g_hash_table_remove_all (cache->entries);
+    cache_entry_t *entry = NULL;
+    while ((entry = g_queue_pop_head (&cache->lru))) {
+        cache_entry_free (entry);
+    }
+    cache->size = 0;
+}
+
+void
+result_cache_free (ResultCache *cache)
+{
+    if (!cache) {
+        return;
+    }
+    result_cache_clear (cache);
+    g_hash_table_destroy (cache->entries);
+    cache->entries = NULL;
+    free (cache);
+    cache = NULL;
+}
+
+static void
+result_cache_evict (ResultCache *cache, size_t budget)
+{
+    while (cache->size > budget) {
+        cache_entry_t *entry = g_queue_pop_tail (&cache->lru);
+        if (!entry) {
+            break;
+        }
+        // the key is owned by the entry
+        g_hash_table_remove (cache->entries, entry->key);
+        cache->size -= entry->size;
+        cache_entry_free (entry);
+    }
+}
+
+void
+result_cache_set_budget (ResultCache *cache, size_t budget)
+{
+    assert (cache != NULL);
+
+    cache->budget = budget;
+    result_cache_evict (cache, budget);
+}
+
+CachedResult *
+result_cache_lookup (ResultCache *cache, const char *key)
+{
+    assert (cache != NULL);
+    assert (key != NULL);
+
+    GList *link = g_hash_table_lookup (cache->entries, key);
+    if (!link) {
+        cache->num_misses++;
+        return NULL;
+    }
+    cache->num_hits++;
+    g_queue_unlink (&cache->lru, link);
+    g_queue_push_head_link (&cache->lru, link);
+
+    cache_entry_t *entry = link->data;
+    return entry->result;
+}
+
+CachedResult *
+result_cache_find (ResultCache *cache,
+                   bool (*func)(const char *key, CachedResult *result, void *data),
+                   void *data)
+{
+    assert (cache != NULL);
+    assert (func != NULL);
+
+    for (GList *link = cache->lru.head; link; link = link->next) {
+        cache_entry_t *entry = link->data;
+        if (func (entry->key, entry->result, data)) {
+            return entry->result;
+        }
+    }
+    return NULL;
+}
+
+void
+result_cache_insert (ResultCache *cache, const char *key, CachedResult *result)
+{
+    assert (cache != NULL);
+    assert (key != NULL);
+    assert (result != NULL);
+
+    cache_entry_t *entry = calloc (1, sizeof (cache_entry_t));
+    assert (entry != NULL);
+    entry->key = g_strdup (key);
+    entry->result = result;
+    entry->size = cached_result_get_size (result) + strlen (key) + 1;
+    if (entry->size > cache->budget) {
+        cache_entry_free (entry);
+        return;
+    }
+
+    GList *old = g_hash_table_lookup (cache->entries, key);
+    if (old) {
+        cache_entry_t *old_entry = old->data;
+        g_hash_table_remove (cache->entries, key);
+        g_queue_delete_link (&cache->lru, old);
+        cache->size -= old_entry->size;
+        cache_entry_free (old_entry);
+    }
+
+    result_cache_evict (cache, cache->budget - entry->size);
+    g_queue_push_head (&cache->lru, entry);
+    g_hash_table_insert (cache->entries, entry->key, cache->lru.head);
+    cache->size += entry->size;
+    trace ("result cache: %zu/%zu bytes, %d hits, %d misses\n",
+           cache->size,
+           cache->budget,
+           cache->num_hits,
+           cache->num_misses);
+}
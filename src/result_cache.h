@@ -0,0 +1,99 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <glib.h>
+
+#include "bitmap.h"
+
+typedef struct _ResultCache ResultCache;
+
+// Results of a search in a compact form: the positions of the matching
+// entries in the database, in the order they were returned
+typedef struct
+{
+    // all matches of the query including those past max_results, NULL if
+    // the search didn't collect them
+    Bitmap *matches;
+    // NULL if the results are the first num_results of matches
+    uint32_t *positions;
+    // only set for ranked results
+    int32_t *scores;
+    uint32_t num_results;
+    uint32_t num_folders;
+    uint32_t num_files;
+    // including the matches past max_results
+    uint32_t num_matched_folders;
+    uint32_t num_matched_files;
+    bool ranked;
+} CachedResult;
+
+// Least recently used cache of search results, which keeps the memory of
+// all cached results below a budget
+struct _ResultCache
+{
+    // key -> GList link in lru, whose data is the cache_entry_t
+    GHashTable *entries;
+    // most recently used first
+    GQueue lru;
+    size_t size;
+    size_t budget;
+    uint32_t num_hits;
+    uint32_t num_misses;
+};
+
+// takes ownership of matches, positions are only allocated if the results
+// can't be taken from matches in database order
+CachedResult *
+cached_result_new (uint32_t num_results, bool ranked, Bitmap *matches);
+
+void
+cached_result_free (CachedResult *result);
+
+ResultCache *
+result_cache_new (size_t budget);
+
+void
+result_cache_free (ResultCache *cache);
+
+void
+result_cache_clear (ResultCache *cache);
+
+// evicts the least recently used results until the rest fits in budget
+void
+result_cache_set_budget (ResultCache *cache, size_t budget);
+
+// the result stays owned by the cache and is only valid until the next
+// insert or clear
+CachedResult *
+result_cache_lookup (ResultCache *cache, const char *key);
+
+// takes ownership of result, results larger than the budget are dropped
+void
+result_cache_insert (ResultCache *cache, const char *key, CachedResult *result);
+
+// returns the most recently used result for which func returns true,
+// without counting it as used
+CachedResult *
+result_cache_find (ResultCache *cache,
+                   bool (*func)(const char *key, CachedResult *result, void *data),
+                   void *data);
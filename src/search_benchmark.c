@@ -0,0 +1,174 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+// Compares the generic search loop with the ones specialized for the flags
+// of a query, on a synthetic list of entries:
+//
+//   search_benchmark [number of entries]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+
+#include "array.h"
+#include "btree.h"
+#include "query.h"
+#include "database_search.h"
+
+#define NUM_RUNS 5
+#define DEFAULT_NUM_ENTRIES 1000000
+// one in that many entries is a folder, or hidden
+#define FOLDER_RATIO 10
+#define HIDDEN_RATIO 20
+
+static const char *words[] = {
+    "src", "include", "build", "Documents", "photos", "music", "project", "test",
+    "data", "backup", "config", "cache", "share", "lib", "local", "notes",
+};
+
+static const char *extensions[] = {
+    "c", "h", "txt", "jpg", "png", "mp3", "pdf", "md", "json", "o",
+};
+
+typedef struct {
+    const char *description;
+    const char *query;
+    FsearchFilter filter;
+    bool match_case;
+    bool enable_regex;
+    bool search_in_path;
+} benchmark_query_t;
+
+static const benchmark_query_t benchmark_queries[] = {
+    {"term", "proj", FSEARCH_FILTER_NONE, false, false, false},
+    {"term, match case", "Doc", FSEARCH_FILTER_NONE, true, false, false},
+    {"term, files", "data", FSEARCH_FILTER_FILES, false, false, false},
+    {"term, folders", "lib", FSEARCH_FILTER_FOLDERS, false, false, false},
+    {"several terms", "test .c", FSEARCH_FILTER_NONE, false, false, false},
+    {"term in path", "music/notes", FSEARCH_FILTER_NONE, false, false, false},
+    {"terms with operators", "src|lib !.o", FSEARCH_FILTER_NONE, false, false, false},
+    {"regex", "^back.*\\.json$", FSEARCH_FILTER_NONE, false, true, false},
+    {"regex, files", "[0-9]{4}\\.mp3$", FSEARCH_FILTER_FILES, false, true, false},
+    {"regex in path", "music/.*\\.mp3$", FSEARCH_FILTER_NONE, false, true, true},
+};
+
+// every entry goes into a random folder created before it, so the paths
+// get a few levels deep
+static BTreeNode *
+build_entries (DynamicArray *entries, uint32_t num_entries)
+{
+    GRand *rand = g_rand_new_with_seed (42);
+    GPtrArray *folders = g_ptr_array_new ();
+
+    BTreeNode *root = btree_node_new ("/benchmark", 0, 0, 0, true);
+    g_ptr_array_add (folders, root);
+
+    char name[64] = "";
+    for (uint32_t i = 0; i < num_entries; i++) {
+        BTreeNode *parent = g_ptr_array_index (folders, g_rand_int_range (rand, 0, folders->len));
+        const bool is_dir = g_rand_int_range (rand, 0, FOLDER_RATIO) == 0;
+        const bool is_hidden = g_rand_int_range (rand, 0, HIDDEN_RATIO) == 0;
+        const char *word = words[g_rand_int_range (rand, 0, G_N_ELEMENTS (words))];
+        const uint32_t number = g_rand_int_range (rand, 0, 100000);
+        if (is_dir) {
+            snprintf (name, sizeof (name), "%s%s_%d", is_hidden ? "." : "", word, number);
+        }
+        else {
+            snprintf (name,
+                      sizeof (name),
+                      "%s%s_%d.%s",
+                      is_hidden ? "." : "",
+                      word,
+                      number,
+                      extensions[g_rand_int_range (rand, 0, G_N_ELEMENTS (extensions))]);
+        }
+
+        BTreeNode *node = btree_node_new (name, 0, is_dir ? 0 : number, i, is_dir);
+        btree_node_prepend (parent, node);
+        node->is_hidden = is_hidden || parent->is_hidden;
+        if (is_dir) {
+            g_ptr_array_add (folders, node);
+        }
+        darray_set_item (entries, node, i);
+    }
+
+    g_ptr_array_free (folders, TRUE);
+    folders = NULL;
+    g_rand_free (rand);
+    rand = NULL;
+    return root;
+}
+
+int
+main (int argc, char *argv[])
+{
+    uint32_t num_entries = DEFAULT_NUM_ENTRIES;
+    if (argc > 1) {
+        num_entries = strtoul (argv[1], NULL, 10);
+    }
+    if (num_entries == 0) {
+        fprintf (stderr, "usage: %s [number of entries]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    DynamicArray *entries = darray_new (num_entries);
+    BTreeNode *root = build_entries (entries, num_entries);
+
+    printf ("%d entries, best of %d runs\n\n", num_entries, NUM_RUNS);
+    printf ("%-22s %12s %12s %8s %9s\n", "query", "generic", "specialized", "speedup", "results");
+    for (uint32_t i = 0; i < G_N_ELEMENTS (benchmark_queries); i++) {
+        const benchmark_query_t *q = &benchmark_queries[i];
+        FsearchQuery *query = fsearch_query_new (NULL,
+                                                 q->query,
+                                                 q->filter,
+                                                 0,
+                                                 NULL,
+                                                 NULL,
+                                                 false,
+                                                 q->match_case,
+                                                 q->enable_regex,
+                                                 false,
+                                                 false,
+                                                 true,
+                                                 q->search_in_path,
+                                                 false);
+
+        DatabaseSearchLoopBenchmark benchmark = {0};
+        if (db_search_benchmark_loops (query, entries, num_entries, NUM_RUNS, &benchmark)) {
+            printf ("%-22s %9.3f ms %9.3f ms %7.2fx %9d\n",
+                    q->description,
+                    benchmark.generic_time / 1000.0,
+                    benchmark.specialized_time / 1000.0,
+                    (double)benchmark.generic_time / MAX (benchmark.specialized_time, 1),
+                    benchmark.num_results);
+        }
+        else {
+            printf ("%-22s failed\n", q->description);
+        }
+        fsearch_query_free (query);
+        query = NULL;
+    }
+
+    btree_node_free (root);
+    root = NULL;
+    darray_free (entries);
+    entries = NULL;
+    return EXIT_SUCCESS;
+}
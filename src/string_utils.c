@@ -220,3 +220,27 @@ fsearch_strstr (const char *haystack,
 {
     return my_strstr (haystack, needle);
 }
+
+static inline uint64_t
+signature_bit (unsigned char c)
+{
+    c = tolower (c);
+    if (c >= 'a' && c <= 'z') {
+        return 1ull << (c - 'a');
+    }
+    if (c >= '0' && c <= '9') {
+        return 1ull << (26 + c - '0');
+    }
+    // everything else shares the remaining bits
+    return 1ull << (36 + c % 28);
+}
+
+uint64_t
+fsearch_str_signature (const char *s)
+{
+    uint64_t signature = 0;
+    for (const unsigned char *c = (const unsigned char *)s; *c != '\0'; c++) {
+        signature |= signature_bit (*c);
+    }
+    return signature;
+}
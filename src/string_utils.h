@@ -18,6 +18,8 @@
 
 #pragma once
 #include <unistd.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 const char *
 fsearch_strstr (const char *haystack,
@@ -28,3 +30,15 @@ const char *
 fsearch_strcasestr (const char *haystack,
                     const char *needle,
                     size_t needle_len);
+
+// Folds the characters of s (case insensitive) into a 64 bit mask. If the
+// signature of a haystack doesn't contain all bits of a needle's signature,
+// the needle can't be part of it.
+uint64_t
+fsearch_str_signature (const char *s);
+
+static inline bool
+fsearch_signature_contains (uint64_t haystack, uint64_t needle)
+{
+    return (haystack & needle) == needle;
+}
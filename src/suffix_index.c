@@ -0,0 +1,207 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <glib.h>
+
+#include "suffix_index.h"
+#include "btree.h"
+
+static int
+compare_suffixes (const void *a, const void *b, void *data)
+{
+    const char *text = data;
+    const uint32_t offset_a = *(const uint32_t *)a;
+    const uint32_t offset_b = *(const uint32_t *)b;
+    const int res = strcmp (text + offset_a, text + offset_b);
+    if (res) {
+        return res;
+    }
+    // equal suffixes of different names
+    return offset_a < offset_b ? -1 : offset_a > offset_b;
+}
+
+SuffixIndex *
+suffix_index_new (DynamicArray *entries, uint32_t num_entries, FsearchThreadPool *pool)
+{
+    assert (entries != NULL);
+
+    uint64_t text_len = 0;
+    uint64_t num_suffixes = 0;
+    for (uint32_t i = 0; i < num_entries; i++) {
+        BTreeNode *node = darray_get_item (entries, i);
+        const size_t name_len = node ? strlen (node->name) : 0;
+        text_len += name_len + 1;
+        num_suffixes += name_len;
+    }
+    if (text_len > UINT32_MAX) {
+        return NULL;
+    }
+
+    SuffixIndex *index = calloc (1, sizeof (SuffixIndex));
+    assert (index != NULL);
+
+    index->text_len = text_len;
+    index->text = g_new (char, MAX (text_len, 1));
+    index->num_names = num_entries;
+    index->name_offsets = g_new (uint32_t, MAX (num_entries, 1));
+    index->num_suffixes = num_suffixes;
+    index->suffixes = g_new (uint32_t, MAX (num_suffixes, 1));
+
+    uint32_t offset = 0;
+    uint32_t num_added = 0;
+    for (uint32_t i = 0; i < num_entries; i++) {
+        BTreeNode *node = darray_get_item (entries, i);
+        index->name_offsets[i] = offset;
+        if (node) {
+            for (const char *c = node->name; *c != '\0'; c++) {
+                index->suffixes[num_added++] = offset;
+                index->text[offset++] = g_ascii_tolower (*c);
+            }
+        }
+        index->text[offset++] = '\0';
+    }
+    assert (num_added == num_suffixes);
+
+    fsearch_thread_pool_sort (pool,
+                              index->suffixes,
+                              index->num_suffixes,
+                              sizeof (uint32_t),
+                              compare_suffixes,
+                              index->text);
+    return index;
+}
+
+void
+suffix_index_free (SuffixIndex *index)
+{
+    if (!index) {
+        return;
+    }
+    g_free (index->text);
+    index->text = NULL;
+    g_free (index->suffixes);
+    index->suffixes = NULL;
+    g_free (index->name_offsets);
+    index->name_offsets = NULL;
+    free (index);
+    index = NULL;
+}
+
+size_t
+suffix_index_get_memory_usage (SuffixIndex *index)
+{
+    assert (index != NULL);
+    return sizeof (SuffixIndex)
+        + index->text_len
+        + (size_t)index->num_suffixes * sizeof (uint32_t)
+        + (size_t)index->num_names * sizeof (uint32_t);
+}
+
+// finds the range [first, last) of suffixes which start with needle
+static void
+find_range (SuffixIndex *index, const char *needle, uint32_t *first, uint32_t *last)
+{
+    char *folded = g_ascii_strdown (needle, -1);
+    const size_t len = strlen (folded);
+
+    uint32_t lo = 0;
+    uint32_t hi = index->num_suffixes;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (strncmp (index->text + index->suffixes[mid], folded, len) < 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    *first = lo;
+    hi = index->num_suffixes;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (strncmp (index->text + index->suffixes[mid], folded, len) <= 0) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    *last = lo;
+    g_free (folded);
+}
+
+uint32_t
+suffix_index_count (SuffixIndex *index, const char *needle)
+{
+    assert (index != NULL);
+    assert (needle != NULL);
+
+    uint32_t first = 0;
+    uint32_t last = 0;
+    find_range (index, needle, &first, &last);
+    return last - first;
+}
+
+// position of the entry whose name contains offset
+static inline uint32_t
+entry_for_offset (SuffixIndex *index, uint32_t offset)
+{
+    uint32_t lo = 0;
+    uint32_t hi = index->num_names;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (index->name_offsets[mid] <= offset) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+Bitmap *
+suffix_index_locate (SuffixIndex *index, const char *needle)
+{
+    assert (index != NULL);
+    assert (needle != NULL);
+
+    if (*needle == '\0') {
+        return NULL;
+    }
+
+    uint32_t first = 0;
+    uint32_t last = 0;
+    find_range (index, needle, &first, &last);
+
+    const uint32_t num_hits = last - first;
+    uint32_t *positions = g_new (uint32_t, MAX (num_hits, 1));
+    for (uint32_t i = 0; i < num_hits; i++) {
+        positions[i] = entry_for_offset (index, index->suffixes[first + i]);
+    }
+    // the hits are ordered by suffix, names with several occurrences show
+    // up more than once
+    Bitmap *bitmap = bitmap_new_from_unsorted (positions, num_hits);
+    g_free (positions);
+    positions = NULL;
+    return bitmap;
+}
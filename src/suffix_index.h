@@ -0,0 +1,66 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "array.h"
+#include "bitmap.h"
+#include "fsearch_thread_pool.h"
+
+typedef struct _SuffixIndex SuffixIndex;
+
+// Suffix array over the case folded names of all entries. A substring of
+// any name is the prefix of some of its suffixes, so all occurrences of a
+// term form one range of the sorted suffixes which is found with a binary
+// search. Takes about five bytes per name character.
+struct _SuffixIndex
+{
+    // case folded names in the order of the entries, each one terminated
+    // with '\0'
+    char *text;
+    size_t text_len;
+    // offsets into text of all suffixes, sorted
+    uint32_t *suffixes;
+    uint32_t num_suffixes;
+    // offset into text of the name of every entry
+    uint32_t *name_offsets;
+    uint32_t num_names;
+};
+
+// Builds the index for the names of the nodes in entries, sorting on the
+// pool. Returns NULL if the names don't fit in 4 GiB.
+SuffixIndex *
+suffix_index_new (DynamicArray *entries, uint32_t num_entries, FsearchThreadPool *pool);
+
+void
+suffix_index_free (SuffixIndex *index);
+
+size_t
+suffix_index_get_memory_usage (SuffixIndex *index);
+
+// number of occurrences of needle in all names, ignoring case
+uint32_t
+suffix_index_count (SuffixIndex *index, const char *needle);
+
+// positions of the entries whose name contains needle, ignoring case;
+// NULL for an empty needle, which every entry contains
+Bitmap *
+suffix_index_locate (SuffixIndex *index, const char *needle);
@@ -0,0 +1,103 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+// Searches with several terms find all of them in one pass of the
+// automaton, every scan is checked against strstr for each term.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+
+#include "aho_corasick.h"
+
+static const char *texts[] = {
+    "",
+    "foo",
+    "FooBar.txt",
+    "barfoo",
+    "fofoo",
+    "ushers",
+    "she_sells_his_hers",
+    "a/b/c/readme.md",
+    "xyz",
+};
+
+static uint64_t
+expected_bits (const char **patterns, uint32_t num_patterns, const char *text, bool match_case)
+{
+    uint64_t bits = 0;
+    for (uint32_t i = 0; i < num_patterns; i++) {
+        if (!patterns[i]) {
+            continue;
+        }
+        const char *found = match_case ? strstr (text, patterns[i]) : strcasestr (text, patterns[i]);
+        if (found) {
+            bits |= 1ull << i;
+        }
+    }
+    return bits;
+}
+
+static void
+check_patterns (const char **patterns, uint32_t num_patterns)
+{
+    for (uint32_t match_case = 0; match_case < 2; match_case++) {
+        AhoCorasick *ac = aho_corasick_new (patterns, num_patterns, match_case);
+        for (uint32_t i = 0; i < sizeof (texts) / sizeof (texts[0]); i++) {
+            assert (aho_corasick_scan (ac, texts[i])
+                    == expected_bits (patterns, num_patterns, texts[i], match_case));
+        }
+        aho_corasick_free (ac);
+    }
+}
+
+static void
+test_overlapping_patterns (void)
+{
+    // patterns which are suffixes and prefixes of each other need the
+    // fail links, NULL ones keep their number
+    const char *patterns[] = {"he", "she", "his", "hers", NULL, "foo", "ofo", "o", "Bar"};
+    check_patterns (patterns, sizeof (patterns) / sizeof (patterns[0]));
+}
+
+static void
+test_max_patterns (void)
+{
+    char names[AHO_CORASICK_MAX_PATTERNS][8];
+    const char *patterns[AHO_CORASICK_MAX_PATTERNS];
+    for (uint32_t i = 0; i < AHO_CORASICK_MAX_PATTERNS; i++) {
+        // those ending in e occur in some texts, and repeat every 26 patterns
+        snprintf (names[i], sizeof (names[i]), "%c%c", 'a' + i % 26, i % 2 ? 'e' : '0' + i / 26);
+        patterns[i] = names[i];
+    }
+    check_patterns (patterns, AHO_CORASICK_MAX_PATTERNS);
+}
+
+int
+main (int argc, char *argv[])
+{
+    test_overlapping_patterns ();
+    test_max_patterns ();
+    printf ("aho_corasick: all tests passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,199 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+// The candidate sets of a search are bitmaps, a value missing from one
+// means an entry is skipped. Every operation is checked against a plain
+// array of flags.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <assert.h>
+
+#include "bitmap.h"
+
+// spans several containers, the last one partially
+#define NUM_VALUES (4 * 65536 + 1000)
+
+static uint32_t rand_state = 1;
+
+static uint32_t
+next_rand (void)
+{
+    rand_state = rand_state * 1103515245u + 12345u;
+    return rand_state >> 8;
+}
+
+// one in every density values, dense enough for bitsets at low densities
+// and sparse enough for arrays at high ones
+static Bitmap *
+random_bitmap (bool *flags, uint32_t density)
+{
+    Bitmap *bitmap = bitmap_new ();
+    for (uint32_t i = 0; i < NUM_VALUES; i++) {
+        flags[i] = next_rand () % density == 0;
+        if (flags[i]) {
+            bitmap_add (bitmap, i);
+        }
+    }
+    return bitmap;
+}
+
+static void
+check_bitmap (const Bitmap *bitmap, const bool *flags)
+{
+    uint32_t cardinality = 0;
+    for (uint32_t i = 0; i < NUM_VALUES; i++) {
+        assert (bitmap_contains (bitmap, i) == flags[i]);
+        cardinality += flags[i];
+    }
+    assert (bitmap_get_cardinality (bitmap) == cardinality);
+
+    // the iterator visits the same values in order, from any start
+    const uint32_t starts[] = {0, 1, 65535, 65536, 100000, NUM_VALUES - 1};
+    for (uint32_t s = 0; s < sizeof (starts) / sizeof (starts[0]); s++) {
+        BitmapIter iter;
+        bitmap_iter_init (&iter, bitmap, starts[s]);
+        uint32_t expected = starts[s];
+        uint32_t value = 0;
+        while (bitmap_iter_next (&iter, &value)) {
+            while (expected < NUM_VALUES && !flags[expected]) {
+                expected++;
+            }
+            assert (value == expected);
+            expected++;
+        }
+        while (expected < NUM_VALUES && !flags[expected]) {
+            expected++;
+        }
+        assert (expected >= NUM_VALUES);
+    }
+}
+
+static void
+test_add_contains (void)
+{
+    const uint32_t densities[] = {1, 2, 7, 16, 100, 5000};
+    bool *flags = calloc (NUM_VALUES, sizeof (bool));
+    for (uint32_t d = 0; d < sizeof (densities) / sizeof (densities[0]); d++) {
+        Bitmap *bitmap = random_bitmap (flags, densities[d]);
+        check_bitmap (bitmap, flags);
+
+        Bitmap *copy = bitmap_copy (bitmap);
+        bitmap_free (bitmap);
+        check_bitmap (copy, flags);
+        bitmap_free (copy);
+    }
+    free (flags);
+}
+
+static void
+test_set_operations (void)
+{
+    const uint32_t densities[] = {1, 3, 16, 5000};
+    bool *flags_a = calloc (NUM_VALUES, sizeof (bool));
+    bool *flags_b = calloc (NUM_VALUES, sizeof (bool));
+    bool *expected = calloc (NUM_VALUES, sizeof (bool));
+    for (uint32_t i = 0; i < sizeof (densities) / sizeof (densities[0]); i++) {
+        for (uint32_t j = 0; j < sizeof (densities) / sizeof (densities[0]); j++) {
+            Bitmap *a = random_bitmap (flags_a, densities[i]);
+            Bitmap *b = random_bitmap (flags_b, densities[j]);
+
+            Bitmap *result = bitmap_and (a, b);
+            for (uint32_t k = 0; k < NUM_VALUES; k++) {
+                expected[k] = flags_a[k] && flags_b[k];
+            }
+            check_bitmap (result, expected);
+            bitmap_free (result);
+
+            result = bitmap_andnot (a, b);
+            for (uint32_t k = 0; k < NUM_VALUES; k++) {
+                expected[k] = flags_a[k] && !flags_b[k];
+            }
+            check_bitmap (result, expected);
+            bitmap_free (result);
+
+            result = bitmap_or (a, b);
+            for (uint32_t k = 0; k < NUM_VALUES; k++) {
+                expected[k] = flags_a[k] || flags_b[k];
+            }
+            check_bitmap (result, expected);
+            bitmap_free (result);
+
+            bitmap_or_inplace (a, b);
+            check_bitmap (a, expected);
+
+            bitmap_free (a);
+            bitmap_free (b);
+        }
+    }
+    free (expected);
+    free (flags_b);
+    free (flags_a);
+}
+
+static void
+test_new_from_unsorted (void)
+{
+    const uint32_t num_values = 50000;
+    uint32_t *values = malloc (num_values * sizeof (uint32_t));
+    bool *flags = calloc (NUM_VALUES, sizeof (bool));
+    for (uint32_t i = 0; i < num_values; i++) {
+        // duplicates included
+        values[i] = next_rand () % NUM_VALUES;
+        flags[values[i]] = true;
+    }
+    Bitmap *bitmap = bitmap_new_from_unsorted (values, num_values);
+    check_bitmap (bitmap, flags);
+    bitmap_free (bitmap);
+
+    bitmap = bitmap_new_from_unsorted (NULL, 0);
+    assert (bitmap_get_cardinality (bitmap) == 0);
+    bitmap_free (bitmap);
+
+    free (flags);
+    free (values);
+}
+
+static void
+test_new_full (void)
+{
+    const uint32_t sizes[] = {0, 1, 63, 64, 4096, 4097, 65536, NUM_VALUES};
+    bool *flags = calloc (NUM_VALUES, sizeof (bool));
+    for (uint32_t s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s++) {
+        for (uint32_t i = 0; i < NUM_VALUES; i++) {
+            flags[i] = i < sizes[s];
+        }
+        Bitmap *bitmap = bitmap_new_full (sizes[s]);
+        check_bitmap (bitmap, flags);
+        bitmap_free (bitmap);
+    }
+    free (flags);
+}
+
+int
+main (int argc, char *argv[])
+{
+    test_add_contains ();
+    test_set_operations ();
+    test_new_from_unsorted ();
+    test_new_full ();
+    printf ("bitmap: all tests passed\n");
+    return EXIT_SUCCESS;
+}
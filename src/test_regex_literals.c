@@ -0,0 +1,167 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+// Regex searches skip every name the literals reject without running the
+// regex, so they must never reject a name the regex matches.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+#include "regex_literals.h"
+
+typedef struct {
+    const char *pattern;
+    // the literals in the order they appear, NULL terminated
+    const char *literals[4];
+    const char *prefix;
+    const char *suffix;
+    uint32_t min_len;
+} literals_case_t;
+
+static const literals_case_t literals_cases[] = {
+    {"foo", {"foo"}, NULL, NULL, 3},
+    {"^abc.*def$", {"abc", "def"}, "abc", "def", 6},
+    {"^abc", {"abc"}, "abc", NULL, 3},
+    {"\\.json$", {".json"}, NULL, ".json", 5},
+    {"ab+c", {"ab", "c"}, NULL, NULL, 3},
+    {"colou?r", {"colo", "r"}, NULL, NULL, 5},
+    {"x{3}y", {"xxxy"}, NULL, NULL, 4},
+    {"a{2,}b", {"aa", "b"}, NULL, NULL, 3},
+    {"img_\\d{4}\\.jpg", {"img_", ".jpg"}, NULL, NULL, 12},
+    {"[abc]x[^y]z", {"x", "z"}, NULL, NULL, 4},
+    {"^(foo)bar", {"bar"}, NULL, NULL, 3},
+    {"a.b", {"a", "b"}, NULL, NULL, 3},
+};
+
+// patterns the parser gives up on, no prefilter is used for them
+static const char *unsupported_patterns[] = {
+    "foo|bar",
+    "(?i)foo",
+    "(a)\\1",
+    "foo(?=bar)",
+    "*foo",
+    "a)b",
+    ".*",
+};
+
+typedef struct {
+    const char *pattern;
+    const char *subject;
+    bool match_case;
+    // whether the regex matches the subject
+    bool matches;
+} match_case_t;
+
+static const match_case_t match_cases[] = {
+    {"foo", "a_foo_b", true, true},
+    {"foo", "a_FOO_b", false, true},
+    {"foo", "a_FOO_b", true, false},
+    {"foo", "fo", true, false},
+    {"^abc.*def$", "abcdef", true, true},
+    {"^abc.*def$", "abc_x_def", true, true},
+    {"^abc.*def$", "ABC_x_DEF", false, true},
+    {"^abc.*def$", "xabcdef", true, false},
+    {"^abc.*def$", "abcdefx", true, false},
+    {"\\.json$", "data.json", true, true},
+    {"\\.json$", "data.json.bak", true, false},
+    {"colou?r", "color", true, true},
+    {"colou?r", "colour", true, true},
+    {"colou?r", "colr", true, false},
+    {"ab+c", "abbbc", true, true},
+    {"ab+c", "ac", true, false},
+    {"img_\\d{4}\\.jpg", "img_2024.jpg", true, true},
+    {"img_\\d{4}\\.jpg", "img_24.jpg", true, false},
+    {"a{2,}b", "aaaab", true, true},
+    {"a{2,}b", "ab", true, false},
+    {"^(foo)bar", "foobar", true, true},
+    {"^(foo)bar", "foo", true, false},
+    {"a.b", "a-b", true, true},
+    {"[abc]x[^y]z", "bxqz", true, true},
+};
+
+static void
+test_literals (void)
+{
+    for (uint32_t i = 0; i < sizeof (literals_cases) / sizeof (literals_cases[0]); i++) {
+        const literals_case_t *c = &literals_cases[i];
+        RegexLiterals *literals = regex_literals_new (c->pattern);
+        assert (literals != NULL);
+
+        uint32_t num_literals = 0;
+        while (num_literals < 4 && c->literals[num_literals]) {
+            num_literals++;
+        }
+        assert (literals->num_literals == num_literals);
+        for (uint32_t j = 0; j < num_literals; j++) {
+            assert (!strcmp (literals->literals[j], c->literals[j]));
+        }
+        if (c->prefix) {
+            assert (literals->prefix && !strcmp (literals->prefix, c->prefix));
+            assert (literals->prefix_len == strlen (c->prefix));
+        }
+        else {
+            assert (literals->prefix == NULL);
+        }
+        if (c->suffix) {
+            assert (literals->suffix && !strcmp (literals->suffix, c->suffix));
+            assert (literals->suffix_len == strlen (c->suffix));
+        }
+        else {
+            assert (literals->suffix == NULL);
+        }
+        assert (literals->min_len == c->min_len);
+        regex_literals_free (literals);
+    }
+}
+
+static void
+test_unsupported (void)
+{
+    for (uint32_t i = 0; i < sizeof (unsupported_patterns) / sizeof (unsupported_patterns[0]); i++) {
+        assert (regex_literals_new (unsupported_patterns[i]) == NULL);
+    }
+}
+
+static void
+test_match (void)
+{
+    for (uint32_t i = 0; i < sizeof (match_cases) / sizeof (match_cases[0]); i++) {
+        const match_case_t *c = &match_cases[i];
+        RegexLiterals *literals = regex_literals_new (c->pattern);
+        assert (literals != NULL);
+        const bool res = regex_literals_match (literals, c->subject, strlen (c->subject), c->match_case);
+        // the literals are a prefilter: they have to let every match pass,
+        // and here they also reject all of the subjects which don't match
+        assert (res == c->matches);
+        regex_literals_free (literals);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    test_literals ();
+    test_unsupported ();
+    test_match ();
+    printf ("regex_literals: all tests passed\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,133 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+// Scans a synthetic list of names with a thread pool of every policy and
+// prints the best throughput of a few runs. The single thread is the
+// baseline:
+//
+//   thread_pool_benchmark [number of entries]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <glib.h>
+
+#include "fsearch_thread_pool.h"
+
+#define NUM_RUNS 5
+#define DEFAULT_NUM_ENTRIES 4000000
+
+typedef struct {
+    char **names;
+    uint64_t checksum;
+    GMutex mutex;
+} pool_benchmark_ctx;
+
+// the workers allocate the names they scan later on, so they're on their
+// numa node like the entries of a database
+static void
+pool_benchmark_fill (uint32_t start, uint32_t end, gpointer data)
+{
+    pool_benchmark_ctx *ctx = data;
+    for (uint32_t i = start; i < end; i++) {
+        ctx->names[i] = g_strdup_printf ("benchmark_%u_%x.txt", i, i * 2654435761u);
+    }
+}
+
+// a memory bound pass over the names, like a plain search
+static void
+pool_benchmark_scan (uint32_t start, uint32_t end, gpointer data)
+{
+    pool_benchmark_ctx *ctx = data;
+    uint64_t checksum = 0;
+    for (uint32_t i = start; i < end; i++) {
+        for (const char *c = ctx->names[i]; *c != '\0'; c++) {
+            checksum += *c;
+        }
+    }
+    g_mutex_lock (&ctx->mutex);
+    ctx->checksum += checksum;
+    g_mutex_unlock (&ctx->mutex);
+}
+
+int
+main (int argc, char *argv[])
+{
+    uint32_t num_entries = DEFAULT_NUM_ENTRIES;
+    if (argc > 1) {
+        num_entries = strtoul (argv[1], NULL, 10);
+    }
+    if (num_entries == 0) {
+        fprintf (stderr, "usage: %s [number of entries]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    // the custom policy pins the threads to the listed cpus
+    char *all_cpus = g_strdup_printf ("0-%d", g_get_num_processors () - 1);
+    const struct {
+        const char *name;
+        FsearchThreadPoolPolicy policy;
+        uint32_t num_threads;
+        const char *cpu_list;
+    } configs[] = {
+        {"single thread", FSEARCH_THREAD_POOL_POLICY_CUSTOM, 1, NULL},
+        {"physical cores", FSEARCH_THREAD_POOL_POLICY_PHYSICAL_CORES, 0, NULL},
+        {"all cpus", FSEARCH_THREAD_POOL_POLICY_ALL_CPUS, 0, NULL},
+        {"all cpus, pinned", FSEARCH_THREAD_POOL_POLICY_CUSTOM, 0, all_cpus},
+    };
+
+    printf ("%d entries, best of %d runs\n\n", num_entries, NUM_RUNS);
+    printf ("%-18s %8s %12s %14s\n", "policy", "threads", "time", "entries/s");
+    for (uint32_t i = 0; i < G_N_ELEMENTS (configs); i++) {
+        FsearchThreadPool *pool = fsearch_thread_pool_init (configs[i].policy,
+                                                            configs[i].num_threads,
+                                                            configs[i].cpu_list);
+        pool_benchmark_ctx ctx = {0};
+        g_mutex_init (&ctx.mutex);
+        ctx.names = malloc (num_entries * sizeof (char *));
+        assert (ctx.names != NULL);
+        fsearch_thread_pool_parallel_for_workers (pool, 0, num_entries, pool_benchmark_fill, &ctx);
+
+        int64_t best = INT64_MAX;
+        for (uint32_t run = 0; run < NUM_RUNS; run++) {
+            const int64_t start_time = g_get_monotonic_time ();
+            fsearch_thread_pool_parallel_for_workers (pool, 0, num_entries, pool_benchmark_scan, &ctx);
+            best = MIN (best, g_get_monotonic_time () - start_time);
+        }
+        printf ("%-18s %8d %9.3f ms %12.1f M\n",
+                configs[i].name,
+                fsearch_thread_pool_get_num_threads (pool),
+                best / 1000.0,
+                num_entries / (double)MAX (best, 1));
+
+        for (uint32_t j = 0; j < num_entries; j++) {
+            g_free (ctx.names[j]);
+        }
+        free (ctx.names);
+        ctx.names = NULL;
+        g_mutex_clear (&ctx.mutex);
+        fsearch_thread_pool_free (pool);
+        pool = NULL;
+    }
+
+    g_free (all_cpus);
+    all_cpus = NULL;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "top_k.h"
+
+// true if a ranks lower than b
+static inline bool
+item_less (const TopKItem *a, const TopKItem *b)
+{
+    if (a->score != b->score) {
+        return a->score < b->score;
+    }
+    return a->pos > b->pos;
+}
+
+static inline void
+item_swap (TopKItem *a, TopKItem *b)
+{
+    TopKItem tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void
+sift_up (TopKItem *items, uint32_t idx)
+{
+    while (idx > 0) {
+        const uint32_t parent = (idx - 1) / 2;
+        if (!item_less (&items[idx], &items[parent])) {
+            break;
+        }
+        item_swap (&items[idx], &items[parent]);
+        idx = parent;
+    }
+}
+
+static void
+sift_down (TopKItem *items, uint32_t num_items, uint32_t idx)
+{
+    while (true) {
+        const uint32_t left = 2 * idx + 1;
+        const uint32_t right = left + 1;
+        uint32_t smallest = idx;
+        if (left < num_items && item_less (&items[left], &items[smallest])) {
+            smallest = left;
+        }
+        if (right < num_items && item_less (&items[right], &items[smallest])) {
+            smallest = right;
+        }
+        if (smallest == idx) {
+            break;
+        }
+        item_swap (&items[idx], &items[smallest]);
+        idx = smallest;
+    }
+}
+
+TopK *
+top_k_new (uint32_t k)
+{
+    TopK *top_k = calloc (1, sizeof (TopK));
+    assert (top_k != NULL);
+
+    top_k->k = k;
+    // most searches find far fewer than k matches, grow on demand
+    top_k->capacity = k && k < 64 ? k : 64;
+    top_k->items = calloc (top_k->capacity, sizeof (TopKItem));
+    assert (top_k->items != NULL);
+    return top_k;
+}
+
+void
+top_k_free (TopK *top_k)
+{
+    if (!top_k) {
+        return;
+    }
+    if (top_k->items) {
+        free (top_k->items);
+        top_k->items = NULL;
+    }
+    free (top_k);
+    top_k = NULL;
+}
+
+bool
+top_k_push (TopK *top_k, int32_t score, uint32_t pos, void *data)
+{
+    assert (top_k != NULL);
+
+    TopKItem item = {score, pos, data};
+    if (top_k->k && top_k->num_items == top_k->k) {
+        // the root is the worst of the current top k
+        if (!item_less (&top_k->items[0], &item)) {
+            return false;
+        }
+        top_k->items[0] = item;
+        sift_down (top_k->items, top_k->num_items, 0);
+        return true;
+    }
+    if (top_k->num_items == top_k->capacity) {
+        top_k->capacity *= 2;
+        top_k->items = realloc (top_k->items, top_k->capacity * sizeof (TopKItem));
+        assert (top_k->items != NULL);
+    }
+    top_k->items[top_k->num_items] = item;
+    sift_up (top_k->items, top_k->num_items);
+    top_k->num_items++;
+    return true;
+}
+
+void
+top_k_merge (TopK *dest, TopK *src)
+{
+    assert (dest != NULL);
+    assert (src != NULL);
+
+    for (uint32_t i = 0; i < src->num_items; i++) {
+        TopKItem *item = &src->items[i];
+        top_k_push (dest, item->score, item->pos, item->data);
+    }
+}
+
+void
+top_k_sort (TopK *top_k)
+{
+    assert (top_k != NULL);
+
+    // heap sort: repeatedly move the worst item to the end
+    uint32_t n = top_k->num_items;
+    while (n > 1) {
+        n--;
+        item_swap (&top_k->items[0], &top_k->items[n]);
+        sift_down (top_k->items, n, 0);
+    }
+}
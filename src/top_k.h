@@ -0,0 +1,63 @@
+/*
+   FSearch - A fast file search utility
+   Copyright © 2016 Christian Boxdörfer
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+   */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Keeps the k items with the highest score out of an arbitrary number of
+// pushed items, using a bounded min-heap. Equal scores are ordered by pos,
+// lower positions rank higher.
+
+typedef struct _TopK TopK;
+
+typedef struct
+{
+    int32_t score;
+    uint32_t pos;
+    void *data;
+} TopKItem;
+
+struct _TopK
+{
+    TopKItem *items;
+    uint32_t num_items;
+    uint32_t capacity;
+    // 0 means unbounded
+    uint32_t k;
+};
+
+TopK *
+top_k_new (uint32_t k);
+
+void
+top_k_free (TopK *top_k);
+
+// returns false if the item didn't make it into the top k
+bool
+top_k_push (TopK *top_k, int32_t score, uint32_t pos, void *data);
+
+// pushes all items of src into dest
+void
+top_k_merge (TopK *dest, TopK *src);
+
+// sorts the items from best to worst, after that the heap must not be
+// pushed to anymore
+void
+top_k_sort (TopK *top_k);